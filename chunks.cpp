@@ -0,0 +1,212 @@
+/*
+ * chunks.cpp: Implements content-defined chunking and chunk lists
+ * Written by: Dylan Hoffmann and Lucas Campbell
+ *
+ * A chunk list is a sequence of entries:
+ *   'N' | length (4 bytes) | bytes     -- a chunk not sent before
+ *   'R' | SHA1 of the chunk (20 bytes)  -- a chunk sent earlier
+ */
+
+#include "chunks.h"
+#include "utils.h"
+#include "c150nastyfile.h"
+#include <cstring>
+
+using namespace std;
+using namespace C150NETWORK;
+
+extern int FILE_NASTINESS;
+
+const char CHUNK_NEW = 'N';
+const char CHUNK_REF = 'R';
+// Attempts at reading a chunk back from the target before giving up on it
+const int CHUNK_READ_TRIES = 5;
+// Boundary masks from the FastCDC paper for 8K average chunks: harder to
+// hit before the average size, easier after, which narrows the spread
+const uint64_t CHUNK_MASK_SMALL = 0x0003590703530000ULL;
+const uint64_t CHUNK_MASK_LARGE = 0x0000d90003530000ULL;
+
+/*
+ * gearTable
+ * 256 fixed pseudo-random values, one per byte value, that the rolling
+ * hash mixes in. Client and server must agree on them, so they come from a
+ * fixed seed rather than a random source.
+ */
+static const uint64_t *gearTable()
+{
+    static uint64_t table[256];
+    static bool filled = [] {
+        uint64_t state = 0x9e3779b97f4a7c15ULL;
+        for (int i = 0; i < 256; i++) {
+            // splitmix64
+            uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            table[i] = z ^ (z >> 31);
+        }
+        return true;
+    }();
+    (void)filled;
+    return table;
+}
+
+/*
+ * cutPoint
+ * Length of the chunk starting at 'data', given 'len' bytes remain
+ */
+static size_t cutPoint(const unsigned char *data, size_t len)
+{
+    if (len <= CHUNK_MIN_SIZE)
+        return len;
+    const uint64_t *gear = gearTable();
+    size_t normal = min(len, CHUNK_AVG_SIZE);
+    size_t limit = min(len, CHUNK_MAX_SIZE);
+    uint64_t hash = 0;
+    size_t i = CHUNK_MIN_SIZE;
+    for (; i < normal; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash & CHUNK_MASK_SMALL) == 0)
+            return i + 1;
+    }
+    for (; i < limit; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash & CHUNK_MASK_LARGE) == 0)
+            return i + 1;
+    }
+    return limit;
+}
+
+/*
+ * chunkName
+ * SHA1 of a chunk, as a 20 byte string
+ */
+static string chunkName(const char *data, size_t len)
+{
+    unsigned char hash[SHA1_LEN];
+    computeChecksum((const unsigned char *)data, len, hash);
+    return string((const char *)hash, SHA1_LEN-1);
+}
+
+vector<size_t> findChunks(const string &data)
+{
+    vector<size_t> ends;
+    const unsigned char *bytes = (const unsigned char *)data.data();
+    size_t pos = 0;
+    while (pos < data.size()) {
+        pos += cutPoint(bytes + pos, data.size() - pos);
+        ends.push_back(pos);
+    }
+    return ends;
+}
+
+string makeChunkList(const string &data, set<string> &sent,
+                     const set<string> &stored, vector<string> &added)
+{
+    added.clear();
+    string list;
+    size_t start = 0;
+    vector<size_t> ends = findChunks(data);
+    for (auto iter = ends.begin(); iter != ends.end(); iter++) {
+        size_t len = *iter - start;
+        string name = chunkName(data.data() + start, len);
+        if (sent.count(name) > 0 ||
+            stored.count(name.substr(0, CHUNK_SUMMARY_LEN)) > 0) {
+            list += CHUNK_REF;
+            list += name;
+        }
+        else {
+            list += CHUNK_NEW;
+            appendUint32(list, len);
+            list.append(data, start, len);
+            sent.insert(name);
+            added.push_back(name);
+        }
+        start = *iter;
+    }
+    return list;
+}
+
+ChunkIndex::ChunkIndex(string dir, ChunkStore *store) :
+    dir(dir), store(store)
+{
+}
+
+void ChunkIndex::addFile(string fname, const string &data)
+{
+    size_t start = 0;
+    vector<size_t> ends = findChunks(data);
+    for (auto iter = ends.begin(); iter != ends.end(); iter++) {
+        ChunkLocation location;
+        location.fname = fname;
+        location.offset = start;
+        location.len = *iter - start;
+        string name = chunkName(data.data() + start, location.len);
+        // The first copy of a chunk is as good as any other
+        chunks.insert(make_pair(name, location));
+        if (store != NULL)
+            store->store(name, data.data() + start, location.len);
+        start = *iter;
+    }
+}
+
+bool ChunkIndex::fetch(const string &name, string &data)
+{
+    auto found = chunks.find(name);
+    if (found == chunks.end())
+        return store != NULL && store->fetch(name, data);
+    const ChunkLocation &location = found->second;
+    string full_name = makeFileName(dir, location.fname);
+    data.assign(location.len, '\0');
+    for (int i = 0; i < CHUNK_READ_TRIES; i++) {
+        NASTYFILE inputFile(FILE_NASTINESS);
+        if (inputFile.fopen(full_name.c_str(), "rb") == NULL)
+            return false;
+        bool read_ok =
+            (inputFile.fseek(location.offset, SEEK_SET) == 0 &&
+             inputFile.fread(&data[0], 1, location.len) == location.len);
+        inputFile.fclose();
+        if (read_ok && chunkName(data.data(), data.size()) == name)
+            return true;
+    }
+    return store != NULL && store->fetch(name, data);
+}
+
+bool applyChunkList(const string &list, ChunkIndex &index, string &result)
+{
+    result.clear();
+    // Chunks of this file so far, which later entries may refer to
+    map<string, pair<size_t, size_t>> own_chunks;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        char op = list[pos++];
+        if (op == CHUNK_NEW) {
+            if (pos + 4 > list.size())
+                return false;
+            size_t len = readUint32(list.data() + pos);
+            pos += 4;
+            if (pos + len > list.size())
+                return false;
+            own_chunks.insert(make_pair(chunkName(list.data() + pos, len),
+                                        make_pair(result.size(), len)));
+            result.append(list, pos, len);
+            pos += len;
+        }
+        else if (op == CHUNK_REF) {
+            if (pos + SHA1_LEN-1 > list.size())
+                return false;
+            string name = list.substr(pos, SHA1_LEN-1);
+            pos += SHA1_LEN-1;
+            auto own = own_chunks.find(name);
+            string chunk;
+            if (own != own_chunks.end())
+                result.append(result, own->second.first, own->second.second);
+            else if (index.fetch(name, chunk))
+                result += chunk;
+            else
+                return false;
+        }
+        else
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,118 @@
+/*
+ * chunks.h: Interface for content-defined chunking of files, so data shared
+ *           between files is only sent once
+ * Written By Dylan Hoffmann & Lucas Campbell
+ *
+ * Files are cut into chunks wherever a rolling "gear" hash of the last few
+ * dozen bytes hits a pattern (FastCDC), so the boundaries depend only on the
+ * nearby contents and line up again after an insertion or deletion. Each
+ * chunk is named by its SHA1. A file in ENCODING_CHUNKS is sent as a chunk
+ * list: chunks the server has not seen are sent whole, the rest by name.
+ */
+#ifndef CHUNKS_H
+#define CHUNKS_H
+
+#include "protocol.h"
+#include "chunkstore.h"
+#include <string>
+#include <set>
+#include <map>
+#include <vector>
+
+// Bounds on chunk size; most chunks land near CHUNK_AVG_SIZE
+const size_t CHUNK_MIN_SIZE = 2 * 1024;
+const size_t CHUNK_AVG_SIZE = 8 * 1024;
+const size_t CHUNK_MAX_SIZE = 64 * 1024;
+
+/*
+ * findChunks
+ * Args:
+ * * data: contents of a file
+ *
+ * Returns: offsets at which each chunk of 'data' ends, in order. The last is
+ *          data.size(); an empty file has no chunks.
+ */
+std::vector<size_t> findChunks(const std::string &data);
+
+/*
+ * makeChunkList
+ * Args:
+ * * data: contents of a file
+ * * sent: names of chunks already sent this session. Chunks of 'data' are
+ *         added, so later files (and later parts of this one) can refer to
+ *         them.
+ * * stored: first CHUNK_SUMMARY_LEN bytes of the names of the chunks in the
+ *           server's chunk store, which need not be sent either
+ * * added: filled with the names this call added to 'sent', which the
+ *          server only learns if the file is written
+ *
+ * Returns: the chunk list describing 'data'
+ */
+std::string makeChunkList(const std::string &data,
+                          std::set<std::string> &sent,
+                          const std::set<std::string> &stored,
+                          std::vector<std::string> &added);
+
+/*
+ * ChunkIndex
+ * The server's record of where each chunk seen this session can be found:
+ * the file in the target it is part of, and where. Chunks from earlier
+ * sessions are looked for in the chunk store, if there is one.
+ * Constructor args:
+ * * string dir: target directory
+ * * ChunkStore *store: persistent chunk store, which is also given the
+ *                      chunks of each file added. May be NULL.
+ * Additional info: chunks are read back from the target when needed and
+ * checked against their name, so a file that has since changed only costs
+ * the chunks it held.
+ */
+class ChunkIndex {
+public:
+    ChunkIndex(std::string dir, ChunkStore *store);
+
+    /*
+     * addFile
+     * Record the chunks of a file that has been written to the target
+     * Args:
+     * * fname: name of the file in the target
+     * * data: its contents
+     *
+     * Returns: None
+     */
+    void addFile(std::string fname, const std::string &data);
+
+    /*
+     * fetch
+     * Args:
+     * * name: SHA1 of the chunk
+     * * data: pass-by-reference string, set to the chunk's contents
+     *
+     * Returns: false if the chunk is unknown or could not be read intact
+     */
+    bool fetch(const std::string &name, std::string &data);
+
+private:
+    struct ChunkLocation {
+        std::string fname;
+        size_t offset;
+        size_t len;
+    };
+    std::string dir;
+    ChunkStore *store;
+    std::map<std::string, ChunkLocation> chunks;
+};
+
+/*
+ * applyChunkList
+ * Args:
+ * * list: chunk list from makeChunkList
+ * * index: chunks from files received earlier this session, or in the
+ *          chunk store
+ * * result: pass-by-reference string, filled with the rebuilt file
+ *
+ * Returns: false if the list is malformed or names a chunk we do not have
+ */
+bool applyChunkList(const std::string &list, ChunkIndex &index,
+                    std::string &result);
+
+#endif
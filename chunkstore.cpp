@@ -0,0 +1,188 @@
+/*
+ * chunkstore.cpp: Implements the server's persistent store of file chunks
+ * Written by: Dylan Hoffmann and Lucas Campbell
+ */
+
+#include "chunkstore.h"
+#include "utils.h"
+#include "c150nastyfile.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+using namespace std;
+using namespace C150NETWORK;
+
+extern int FILE_NASTINESS;
+
+// Attempts at reading a chunk before deciding it is damaged
+const int STORE_READ_TRIES = 5;
+const char HEX_DIGITS[] = "0123456789abcdef";
+
+/*
+ * hexToName
+ * Turn a chunk file name back into the 20 byte SHA1 it spells, returning
+ * false if it is not one of ours
+ */
+static bool hexToName(const string &hex, string &name)
+{
+    if (hex.size() != 2*(SHA1_LEN-1))
+        return false;
+    name.clear();
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        const char *high = strchr(HEX_DIGITS, hex[i]);
+        const char *low = strchr(HEX_DIGITS, hex[i+1]);
+        if (hex[i] == '\0' || hex[i+1] == '\0' || high == NULL || low == NULL)
+            return false;
+        name += (char)(((high - HEX_DIGITS) << 4) | (low - HEX_DIGITS));
+    }
+    return true;
+}
+
+ChunkStore::ChunkStore(string dir, uint64_t max_bytes) :
+    dir(dir), max_bytes(max_bytes), total_bytes(0)
+{
+    DIR *STORE = opendir(dir.c_str());
+    if (STORE == NULL) {
+        perror(("Error opening chunk store " + dir).c_str());
+        return;
+    }
+    // Order what is already there by when it was last used
+    vector<pair<struct timespec, string>> found;
+    struct dirent *entry;
+    while ((entry = readdir(STORE)) != NULL) {
+        string name;
+        struct stat statbuf;
+        if (!hexToName(entry->d_name, name) ||
+            lstat(makeFileName(dir, entry->d_name).c_str(), &statbuf) != 0 ||
+            !S_ISREG(statbuf.st_mode))
+            continue;
+        found.push_back(make_pair(statbuf.st_mtim, name));
+        StoredChunk chunk;
+        chunk.size = statbuf.st_size;
+        chunks[name] = chunk;
+        total_bytes += chunk.size;
+    }
+    closedir(STORE);
+    sort(found.begin(), found.end(),
+         [](const pair<struct timespec, string> &a,
+            const pair<struct timespec, string> &b) {
+             if (a.first.tv_sec != b.first.tv_sec)
+                 return a.first.tv_sec > b.first.tv_sec;
+             return a.first.tv_nsec > b.first.tv_nsec;
+         });
+    for (auto iter = found.begin(); iter != found.end(); iter++)
+        chunks[iter->second].lru_pos = lru.insert(lru.end(), iter->second);
+    trim();
+}
+
+string ChunkStore::pathFor(const string &name)
+{
+    string hex;
+    for (size_t i = 0; i < name.size(); i++) {
+        hex += HEX_DIGITS[(unsigned char)name[i] >> 4];
+        hex += HEX_DIGITS[(unsigned char)name[i] & 0xf];
+    }
+    return makeFileName(dir, hex);
+}
+
+/*
+ * touch
+ * Mark a chunk in the store as just used, in memory and on disk
+ */
+void ChunkStore::touch(const string &name)
+{
+    StoredChunk &chunk = chunks[name];
+    lru.erase(chunk.lru_pos);
+    chunk.lru_pos = lru.insert(lru.begin(), name);
+    utimes(pathFor(name).c_str(), NULL);
+}
+
+bool ChunkStore::fetch(const string &name, string &data)
+{
+    lock_guard<mutex> guard(lock);
+    auto found = chunks.find(name);
+    if (found == chunks.end())
+        return false;
+    string path = pathFor(name);
+    data.assign(found->second.size, '\0');
+    for (int i = 0; i < STORE_READ_TRIES; i++) {
+        NASTYFILE chunkFile(FILE_NASTINESS);
+        if (chunkFile.fopen(path.c_str(), "rb") == NULL)
+            break;
+        size_t len = chunkFile.fread(&data[0], 1, data.size());
+        chunkFile.fclose();
+        unsigned char hash[SHA1_LEN];
+        computeChecksum((const unsigned char *)data.data(), len, hash);
+        if (len == data.size() &&
+            string((const char *)hash, SHA1_LEN-1) == name) {
+            touch(name);
+            return true;
+        }
+    }
+    // Gone or damaged, forget it
+    remove(path.c_str());
+    total_bytes -= found->second.size;
+    lru.erase(found->second.lru_pos);
+    chunks.erase(found);
+    return false;
+}
+
+void ChunkStore::store(const string &name, const char *data, size_t len)
+{
+    lock_guard<mutex> guard(lock);
+    if (chunks.count(name) > 0) {
+        touch(name);
+        return;
+    }
+    // Write to the side and rename, so a crash never leaves half a chunk.
+    // Clients will be told we have it, so read it back before we say so.
+    string path = pathFor(name);
+    string tmp_path = path + ".TMP";
+    string readback(len, '\0');
+    bool ok = false;
+    for (int i = 0; i < STORE_READ_TRIES && !ok; i++) {
+        NASTYFILE chunkFile(FILE_NASTINESS);
+        if (chunkFile.fopen(tmp_path.c_str(), "w+b") == NULL)
+            return;
+        ok = (chunkFile.fwrite(data, 1, len) == len &&
+              chunkFile.fseek(0, SEEK_SET) == 0 &&
+              chunkFile.fread(&readback[0], 1, len) == len &&
+              memcmp(readback.data(), data, len) == 0);
+        ok = (chunkFile.fclose() == 0) && ok;
+    }
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        remove(tmp_path.c_str());
+        return;
+    }
+    StoredChunk chunk;
+    chunk.size = len;
+    chunk.lru_pos = lru.insert(lru.begin(), name);
+    chunks[name] = chunk;
+    total_bytes += len;
+}
+
+string ChunkStore::summary()
+{
+    lock_guard<mutex> guard(lock);
+    string names;
+    for (auto iter = chunks.begin(); iter != chunks.end(); iter++)
+        names += iter->first.substr(0, CHUNK_SUMMARY_LEN);
+    return names;
+}
+
+void ChunkStore::trim()
+{
+    lock_guard<mutex> guard(lock);
+    while (total_bytes > max_bytes && !lru.empty()) {
+        string name = lru.back();
+        lru.pop_back();
+        remove(pathFor(name).c_str());
+        total_bytes -= chunks[name].size;
+        chunks.erase(name);
+    }
+}
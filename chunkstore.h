@@ -0,0 +1,90 @@
+/*
+ * chunkstore.h: Interface for the server's persistent store of file chunks
+ * Written By Dylan Hoffmann & Lucas Campbell
+ */
+#ifndef CHUNKSTORE_H
+#define CHUNKSTORE_H
+
+#include <string>
+#include <map>
+#include <list>
+#include <mutex>
+#include <stdint.h>
+
+// Bytes of each chunk name a client is told about. Chunks are always
+// fetched and checked by their full name, so a clash only costs a resend.
+const size_t CHUNK_SUMMARY_LEN = 8;
+
+/*
+ * ChunkStore
+ * Chunks of files received in earlier sessions, kept so that a client that
+ * chunks its files need not send them again. Each chunk is a file in the
+ * store directory named by the hex SHA1 of its contents, and the time it
+ * was last used is the file's modification time, so the store needs no
+ * index of its own and survives any crash.
+ * Constructor args:
+ * * string dir: store directory, which must exist
+ * * uint64_t max_bytes: size the store is trimmed to, dropping the chunks
+ *                       used least recently first
+ * Additional info: the store is only trimmed when created and by trim(), so
+ * chunks advertised to a client stay put until its session is over. It may
+ * be used from several threads at once.
+ */
+class ChunkStore {
+public:
+    ChunkStore(std::string dir, uint64_t max_bytes);
+
+    /*
+     * fetch
+     * Args:
+     * * name: 20 byte SHA1 of the chunk
+     * * data: pass-by-reference string, set to the chunk's contents
+     *
+     * Returns: false if the chunk is not in the store or is damaged
+     */
+    bool fetch(const std::string &name, std::string &data);
+
+    /*
+     * store
+     * Add a chunk, or mark it used if it is already there
+     * Args:
+     * * name: 20 byte SHA1 of the chunk
+     * * data: pointer to the chunk's contents
+     * * len: its length
+     *
+     * Returns: None
+     */
+    void store(const std::string &name, const char *data, size_t len);
+
+    /*
+     * summary
+     * Returns: the first CHUNK_SUMMARY_LEN bytes of the name of every chunk
+     *          in the store, one after the other
+     */
+    std::string summary();
+
+    /*
+     * trim
+     * Remove the least recently used chunks until the store fits its size
+     *
+     * Returns: None
+     */
+    void trim();
+
+private:
+    struct StoredChunk {
+        uint64_t size;
+        std::list<std::string>::iterator lru_pos;
+    };
+    std::string pathFor(const std::string &name);
+    void touch(const std::string &name);
+
+    std::string dir;
+    uint64_t max_bytes;
+    uint64_t total_bytes;
+    std::map<std::string, StoredChunk> chunks;
+    std::list<std::string> lru;     // names, most recently used first
+    std::mutex lock;
+};
+
+#endif
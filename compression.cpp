@@ -0,0 +1,100 @@
+/*
+ * compression.cpp: Implements compression of the data sent for a file
+ * Written by: Dylan Hoffmann and Lucas Campbell
+ */
+
+#include "compression.h"
+#include <zlib.h>
+
+using namespace std;
+
+// Size and number of the samples worthCompressing tries
+const size_t PROBE_SAMPLE_SIZE = 16 * 1024;
+const size_t PROBE_SAMPLES = 4;
+// Samples must shrink below this fraction of their size to be worth it
+const double PROBE_MAX_RATIO = 0.9;
+// Output is produced in pieces of this size while decompressing
+const size_t INFLATE_STEP = 256 * 1024;
+// Most zlib is handed or asked for at once, as it counts bytes in 32 bits
+const size_t ZLIB_STEP = 1 << 30;
+
+/*
+ * deflateAll
+ * Compress 'len' bytes at 'data' at the given zlib level, handing zlib at
+ * most ZLIB_STEP of them at a time
+ */
+static string deflateAll(const char *data, size_t len, int level)
+{
+    z_stream stream = z_stream();
+    if (deflateInit(&stream, level) != Z_OK)
+        return string();
+    string packed(deflateBound(&stream, len), '\0');
+    size_t in_done = 0, out_done = 0;
+    int status = Z_OK;
+    while (status == Z_OK) {
+        // The bound is only promised for one call, make room if need be
+        if (out_done == packed.size())
+            packed.resize(packed.size() + INFLATE_STEP);
+        size_t in_len = min(len - in_done, ZLIB_STEP);
+        size_t out_len = min(packed.size() - out_done, ZLIB_STEP);
+        stream.next_in = (Bytef *)data + in_done;
+        stream.avail_in = in_len;
+        stream.next_out = (Bytef *)&packed[out_done];
+        stream.avail_out = out_len;
+        bool last = (in_done + in_len == len);
+        status = deflate(&stream, last ? Z_FINISH : Z_NO_FLUSH);
+        in_done += in_len - stream.avail_in;
+        out_done += out_len - stream.avail_out;
+    }
+    packed.resize(out_done);
+    deflateEnd(&stream);
+    return packed;
+}
+
+bool worthCompressing(const string &data)
+{
+    // Samples spread evenly over the file, the fastest level will do
+    size_t sampled = 0, packed = 0;
+    size_t step = data.size() / PROBE_SAMPLES;
+    for (size_t i = 0; i < PROBE_SAMPLES && sampled < data.size(); i++) {
+        size_t start = i * step;
+        size_t len = min(PROBE_SAMPLE_SIZE, data.size() - start);
+        sampled += len;
+        packed += deflateAll(data.data() + start, len, Z_BEST_SPEED).size();
+    }
+    return sampled > 0 && packed < sampled * PROBE_MAX_RATIO;
+}
+
+string compressData(const string &data)
+{
+    return deflateAll(data.data(), data.size(), Z_DEFAULT_COMPRESSION);
+}
+
+bool decompressData(const string &packed, string &result)
+{
+    result.clear();
+    z_stream stream = z_stream();
+    if (inflateInit(&stream) != Z_OK)
+        return false;
+    size_t in_done = 0;
+    int status = Z_OK;
+    while (status == Z_OK) {
+        // Input goes in at most ZLIB_STEP at a time too
+        if (stream.avail_in == 0 && in_done < packed.size()) {
+            size_t in_len = min(packed.size() - in_done, ZLIB_STEP);
+            stream.next_in = (Bytef *)packed.data() + in_done;
+            stream.avail_in = in_len;
+            in_done += in_len;
+        }
+        size_t done = result.size();
+        result.resize(done + INFLATE_STEP);
+        stream.next_out = (Bytef *)&result[done];
+        stream.avail_out = INFLATE_STEP;
+        status = inflate(&stream, Z_NO_FLUSH);
+        result.resize(done + INFLATE_STEP - stream.avail_out);
+    }
+    inflateEnd(&stream);
+    // Trailing bytes mean the stream was not what we were sent
+    return status == Z_STREAM_END && stream.avail_in == 0 &&
+           in_done == packed.size();
+}
@@ -0,0 +1,45 @@
+/*
+ * compression.h: Interface for compressing the data sent for a file
+ * Written By Dylan Hoffmann & Lucas Campbell
+ *
+ * A file in ENCODING_ZLIB is sent as a zlib stream of whatever would have
+ * been sent otherwise: its contents, a delta or a chunk list. Before paying
+ * for the whole file the client compresses a few samples of it, so files
+ * that are already compressed (images, archives) are passed through as
+ * they are.
+ */
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <string>
+
+/*
+ * worthCompressing
+ * Args:
+ * * data: data about to be sent for a file
+ *
+ * Returns: true if samples of 'data' compress well enough that the whole of
+ *          it probably will
+ */
+bool worthCompressing(const std::string &data);
+
+/*
+ * compressData
+ * Args:
+ * * data: data to compress
+ *
+ * Returns: 'data' as a zlib stream
+ */
+std::string compressData(const std::string &data);
+
+/*
+ * decompressData
+ * Args:
+ * * packed: zlib stream from compressData
+ * * result: pass-by-reference string, filled with the original data
+ *
+ * Returns: false if 'packed' is not a complete, intact zlib stream
+ */
+bool decompressData(const std::string &packed, std::string &result);
+
+#endif
@@ -0,0 +1,196 @@
+/*
+ * delta.cpp: Implements rsync-style delta encoding
+ * Written by: Dylan Hoffmann and Lucas Campbell
+ *
+ * A delta is a sequence of instructions:
+ *   'C' | first block (4 bytes) | block count (4 bytes)  -- copy from base
+ *   'L' | length (4 bytes) | bytes                      -- literal data
+ */
+
+#include "delta.h"
+#include "utils.h"
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+const size_t DELTA_MAX_BLOCK = 128 * 1024;
+const char DELTA_COPY = 'C';
+const char DELTA_LITERAL = 'L';
+
+size_t chooseDeltaBlockSize(size_t file_size)
+{
+    size_t block_size = (size_t)sqrt((double)file_size);
+    // Keep blocks a whole number of packets, within sensible bounds
+    block_size = (block_size / PACKET_SIZE + 1) * PACKET_SIZE;
+    return min(block_size, DELTA_MAX_BLOCK);
+}
+
+uint32_t rollingChecksum(const unsigned char *data, size_t len)
+{
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < len; i++) {
+        a += data[i];
+        b += (len - i) * data[i];
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+/*
+ * strongChecksum
+ * Truncated SHA1 of a block, used to confirm a rolling checksum match
+ */
+static string strongChecksum(const unsigned char *data, size_t len)
+{
+    unsigned char hash[SHA1_LEN];
+    computeChecksum(data, len, hash);
+    return string((const char *)hash, DELTA_STRONG_LEN);
+}
+
+string makeSignatures(const string &base, size_t block_size)
+{
+    string signatures;
+    const unsigned char *bytes = (const unsigned char *)base.data();
+    // Only whole blocks are signed; a short tail of the base is simply
+    // never matched, costing at most one block of literal data
+    for (size_t offset = 0; offset + block_size <= base.size();
+         offset += block_size) {
+        appendUint32(signatures, rollingChecksum(bytes + offset, block_size));
+        signatures += strongChecksum(bytes + offset, block_size);
+    }
+    return signatures;
+}
+
+/*
+ * DeltaWriter
+ * Accumulates instructions, merging runs of consecutive copied blocks
+ */
+struct DeltaWriter {
+    string delta;
+    uint32_t copy_start;
+    uint32_t copy_count;
+    DeltaWriter() : copy_start(0), copy_count(0) {}
+
+    void flushCopy() {
+        if (copy_count == 0)
+            return;
+        delta += DELTA_COPY;
+        appendUint32(delta, copy_start);
+        appendUint32(delta, copy_count);
+        copy_count = 0;
+    }
+    void copy(uint32_t block) {
+        if (copy_count > 0 && copy_start + copy_count == block) {
+            copy_count++;
+            return;
+        }
+        flushCopy();
+        copy_start = block;
+        copy_count = 1;
+    }
+    void literal(const char *data, size_t len) {
+        if (len == 0)
+            return;
+        flushCopy();
+        delta += DELTA_LITERAL;
+        appendUint32(delta, len);
+        delta.append(data, len);
+    }
+};
+
+string makeDelta(const string &data, const string &signatures,
+                 size_t block_size)
+{
+    size_t num_blocks = signatures.size() / DELTA_SIG_LEN;
+    // Index every block by its rolling checksum
+    unordered_multimap<uint32_t, uint32_t> weak_index;
+    vector<string> strong(num_blocks);
+    for (size_t i = 0; i < num_blocks; i++) {
+        const char *sig = signatures.data() + i*DELTA_SIG_LEN;
+        weak_index.insert(make_pair(readUint32(sig), (uint32_t)i));
+        strong[i] = string(sig + 4, DELTA_STRONG_LEN);
+    }
+
+    DeltaWriter writer;
+    const unsigned char *bytes = (const unsigned char *)data.data();
+    size_t literal_start = 0;
+    size_t pos = 0;
+    uint32_t a = 0, b = 0;
+    bool have_sum = false;
+
+    while (pos + block_size <= data.size()) {
+        if (!have_sum) {
+            uint32_t sum = rollingChecksum(bytes + pos, block_size);
+            a = sum & 0xffff;
+            b = sum >> 16;
+            have_sum = true;
+        }
+        uint32_t weak = a | (b << 16);
+        bool matched = false;
+        auto range = weak_index.equal_range(weak);
+        if (range.first != range.second) {
+            string block_strong = strongChecksum(bytes + pos, block_size);
+            for (auto iter = range.first; iter != range.second; iter++) {
+                if (strong[iter->second] == block_strong) {
+                    writer.literal(data.data() + literal_start,
+                                   pos - literal_start);
+                    writer.copy(iter->second);
+                    pos += block_size;
+                    literal_start = pos;
+                    have_sum = false;
+                    matched = true;
+                    break;
+                }
+            }
+        }
+        if (matched)
+            continue;
+        // Slide the window one byte
+        if (pos + block_size < data.size()) {
+            unsigned char out = bytes[pos];
+            unsigned char in = bytes[pos + block_size];
+            a = (a - out + in) & 0xffff;
+            b = (b - block_size*out + a) & 0xffff;
+        }
+        pos++;
+    }
+    // Whatever is left after the last match goes as literal data
+    writer.literal(data.data() + literal_start, data.size() - literal_start);
+    writer.flushCopy();
+    return writer.delta;
+}
+
+bool applyDelta(const string &base, const string &delta, size_t block_size,
+                string &result)
+{
+    result.clear();
+    size_t pos = 0;
+    while (pos < delta.size()) {
+        char op = delta[pos++];
+        if (op == DELTA_COPY) {
+            if (pos + 8 > delta.size())
+                return false;
+            size_t first = readUint32(delta.data() + pos);
+            size_t count = readUint32(delta.data() + pos + 4);
+            pos += 8;
+            if ((first + count) * block_size > base.size())
+                return false;
+            result.append(base, first * block_size, count * block_size);
+        }
+        else if (op == DELTA_LITERAL) {
+            if (pos + 4 > delta.size())
+                return false;
+            size_t len = readUint32(delta.data() + pos);
+            pos += 4;
+            if (pos + len > delta.size())
+                return false;
+            result.append(delta, pos, len);
+            pos += len;
+        }
+        else
+            return false;
+    }
+    return true;
+}
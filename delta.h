@@ -0,0 +1,85 @@
+/*
+ * delta.h: Interface for rsync-style delta encoding of a file against an
+ *          older version of it held by the server
+ * Written By Dylan Hoffmann & Lucas Campbell
+ *
+ * The server cuts its copy of a file into fixed-size blocks and sends a
+ * signature for each: a cheap rolling checksum plus a truncated SHA1. The
+ * client slides a window over its version looking for blocks the server
+ * already has, and describes the file as a list of "copy these blocks" and
+ * "here are some new bytes" instructions. Only the new bytes cross the wire.
+ */
+#ifndef DELTA_H
+#define DELTA_H
+
+#include "protocol.h"
+#include <string>
+#include <stdint.h>
+
+// Smallest existing file the server will offer a delta against; below this
+// the signature round trips cost more than resending the file
+const size_t DELTA_MIN_SIZE = 16 * PACKET_SIZE;
+// Bytes of each block signature: 4 byte rolling checksum + truncated SHA1
+const size_t DELTA_STRONG_LEN = 8;
+const size_t DELTA_SIG_LEN = 4 + DELTA_STRONG_LEN;
+
+/*
+ * chooseDeltaBlockSize
+ * Args:
+ * * file_size: size of the server's copy of the file
+ *
+ * Returns: block size to cut the file into, roughly the square root of its
+ *          size so signatures and literal data stay balanced
+ */
+size_t chooseDeltaBlockSize(size_t file_size);
+
+/*
+ * rollingChecksum
+ * The weak checksum of a block, as used by rsync
+ * Args:
+ * * data: pointer to the block
+ * * len: length of the block
+ *
+ * Returns: 32 bit checksum, low half the byte sum, high half the weighted sum
+ */
+uint32_t rollingChecksum(const unsigned char *data, size_t len);
+
+/*
+ * makeSignatures
+ * Args:
+ * * base: contents of the server's copy of the file
+ * * block_size: size of the blocks to sign
+ *
+ * Returns: string of DELTA_SIG_LEN byte signatures, one per whole block in
+ *          order. A partial block at the end of the file is not signed.
+ */
+std::string makeSignatures(const std::string &base, size_t block_size);
+
+/*
+ * makeDelta
+ * Args:
+ * * data: contents of the client's version of the file
+ * * signatures: the server's block signatures, as built by makeSignatures
+ * * block_size: block size the signatures were made with
+ *
+ * Returns: encoded list of instructions that rebuild 'data' from the
+ *          server's copy
+ */
+std::string makeDelta(const std::string &data, const std::string &signatures,
+                      size_t block_size);
+
+/*
+ * applyDelta
+ * Args:
+ * * base: contents of the server's copy of the file
+ * * delta: instructions from makeDelta
+ * * block_size: block size the signatures were made with
+ * * result: pass-by-reference string, filled with the rebuilt file
+ *
+ * Returns: false if the instructions are malformed or refer to blocks past
+ *          the end of 'base', true otherwise
+ */
+bool applyDelta(const std::string &base, const std::string &delta,
+                size_t block_size, std::string &result);
+
+#endif
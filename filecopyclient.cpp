@@ -1,661 +1,1165 @@
-// --------------------------------------------------------------
-//
-//                        filecopyclient.cpp
-//
-//        Author: Dylan Hoffmann & Lucas Campbell       
-//   
-//
-//        COMMAND LINE
-//
-//              fileclient <srvrname> <networknasty#> <filenasty#> <src>
-//
-//
-//        OPERATION
-//
-//              Given a server, file and network nastiness levels, and a
-//              directory, sends the contents of the directory to the server.
-//              Quits after receiving an end-to-end response or if the server
-//              times out.
-//
-//
-//        LIMITATIONS
-//
-//              Works with file nastiness level up to 4 and network nastiness
-//              level up to 4.
-//
-//
-//     
-// --------------------------------------------------------------
-
-#include "utils.h"
-#include "protocol.h"
-#include "c150nastydgmsocket.h"
-#include "c150nastyfile.h"
-#include "c150debug.h"
-#include <string>
-#include <vector>
-#include <set>
-#include <iterator>
-#include <algorithm>
-
-
-using namespace std;          // for C++ std library
-using namespace C150NETWORK;  // for all the comp150 utilities 
-
-// forward declarations
-void setUpDebugLogging(const char *logname, int argc, char *argv[]);
-void sendDirPilot(int num_files, string hash, C150NastyDgmSocket *sock,
-                  char *argv[]);
-void sendFiles(DIR* SRC, const char* sourceDir, C150NastyDgmSocket *sock,
-                 map<string, string> &filehash);
-void sendFile(FilePilot fp, string f_data,  C150NastyDgmSocket *sock);
-vector<FilePacket> makeDataPackets(FilePilot fp, string f_data);
-void receiveE2E(C150NastyDgmSocket *sock);
-
-
-
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-//
-//                    Command line arguments and Global Variables
-//
-// The following are used as subscripts to argv, the command line arguments
-// If we want to change the command line syntax, doing this
-// symbolically makes it a bit easier.
-//
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-
-const int SERVER_ARG = 1;     // server name is 1st arg
-const int NETWORK_NASTINESS_ARG = 2;        // network nastiness is 2nd arg
-const int FILE_NASTINESS_ARG = 3;        // file nastiness is 3rd arg
-const int SRC_ARG = 4;            // source directory is 4th arg
-const int TIMEOUT_MS = 300;       //ms for timeout
-extern int NETWORK_NASTINESS;
-extern int FILE_NASTINESS;
-char* PROG_NAME;
-const int MAX_SEND_TO_SERVER_TRIES = 20;
-
-
-
-
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-//
-//                           main program
-//
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
- 
-int main(int argc, char *argv[]) {    
-
-    GRADEME(argc, argv);
-
-    //
-    // Make sure command line looks right
-    //
-    
-    // Command line args not used
-    if (argc != 5) {
-        fprintf(stderr,"Correct syntax is: %s <srvrname>"
-                " <networknasty#> <filenasty#> <src>\n", argv[0]);
-        exit(1);
-    }
-
-    if ((strspn(argv[NETWORK_NASTINESS_ARG], "0123456789") !=
-        strlen(argv[NETWORK_NASTINESS_ARG])) ||
-        (strspn(argv[FILE_NASTINESS_ARG], "0123456789") !=
-         strlen(argv[FILE_NASTINESS_ARG]))) {
-         fprintf(stderr,"Nastiness %s is not numeric\n", argv[FILE_NASTINESS_ARG]);     
-         fprintf(stderr,"Correct syntax is: %s <srvrname>"
-                " <networknasty#> <filenasty#> <src>\n", argv[0]);
-         exit(4);
-     }
-     
-    
-    //
-    // Variable declarations
-    //
-    DIR *SRC;                   // Unix descriptor for open directory
-    NETWORK_NASTINESS = atoi(argv[NETWORK_NASTINESS_ARG]);
-    FILE_NASTINESS = atoi(argv[FILE_NASTINESS_ARG]);
-    PROG_NAME = argv[0];
-    
-    checkDirectory(argv[SRC_ARG]);  //Make sure src exists
-
-    //
-    // Open the source directory
-    //
-    SRC = opendir(argv[SRC_ARG]);
-    *GRADING << "Opening Directory:" << argv[SRC_ARG] << endl;
-    if (SRC == NULL) {
-        fprintf(stderr,"Error opening source directory %s\n", argv[SRC_ARG]);
-        exit(8);
-    }
-
-    //
-    //  Set up debug message logging
-    //
-    setUpDebugLogging("filecopyclientdebug.txt",argc, argv);
-
-    //
-    //
-    //        Send / receive / print 
-    //
-    
-    try {
-
-        // Create the socket
-        c150debug->printf(C150APPLICATION,"Creating C150NastyDgmSocket");
-        c150debug->printf(C150APPLICATION,"Creating"
-                          " C150NastyDgmSocket(nastiness=%d)",
-			 NETWORK_NASTINESS);
-        C150NastyDgmSocket *sock = new C150NastyDgmSocket(NETWORK_NASTINESS);
-
-        // Tell the DGMSocket which server to talk to
-        sock -> setServerName(argv[SERVER_ARG]);  
-        
-        // Timeout of .3 seconds
-        sock -> turnOnTimeouts(TIMEOUT_MS);
-
-        *GRADING << "Prelim Setup Complete\n";
-
-        // Loop through source directory, create hashtable with filenames
-        // as keys and  individual file checksums as values
-        map<string, string> filehash;
-        fillChecksumTable(filehash, SRC, argv[SRC_ARG]);
-        closedir(SRC);
-
-        // Open directory again because we loop through it in fillChecksumTable
-        SRC = opendir(argv[SRC_ARG]);
-        *GRADING << "Opening Directory again:" << argv[SRC_ARG] << endl;
-        if (SRC == NULL) {
-            fprintf(stderr,"Error opening source directory %s\n", argv[SRC_ARG]);
-            exit(8);
-        }
-        int num_files = filehash.size();
-
-        // Creates a total directory checksum value based on filenames and
-        // checksums together
-        string dir_checksum = getDirHash(filehash);
-
-        // Send directory pilot to server
-        sendDirPilot(num_files, dir_checksum, sock, argv);
-        
-        // Loop to send files one by one to server
-        sendFiles(SRC, argv[SRC_ARG], sock, filehash);
-
-        // Wait for end-to-end check from server
-        receiveE2E(sock);
-
-        *GRADING << "Closing dir\n";
-        closedir(SRC);
-        *GRADING << flush;
-        delete sock;
-    }
-
-    
-    //
-    //  Handle networking errors: if an exception is caught, print it to
-    //  screen and exit. Mainly used to report timeouts.
-    //
-    catch (C150NetworkException& e) {
-        // Write to debug log
-        c150debug->printf(C150ALWAYSLOG,"Caught C150NetworkException: %s\n",
-                          e.formattedExplanation().c_str());
-        // In case we're logging to a file, write to the console too
-        cerr << argv[0] << ": caught C150NetworkException: "
-             << e.formattedExplanation() << endl;
-    }
-    
-    
-    return 0;
-}
-
-
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-//
-//                     setUpDebugLogging
-//
-//        For COMP 150-IDS, a set of standards utilities
-//        are provided for logging timestamped debug messages.
-//        You can use them to write your own messages, but 
-//        more importantly, the communication libraries provided
-//        to you will write into the same logs.
-//
-//        As shown below, you can use the enableLogging
-//        method to choose which classes of messages will show up:
-//        You may want to turn on a lot for some debugging, then
-//        turn off some when it gets too noisy and your core code is
-//        working. You can also make up and use your own flags
-//        to create different classes of debug output within your
-//        application code
-//
-//        NEEDSWORK: should be factored into shared code w/pingserver
-//        NEEDSWORK: document arguments
-//
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
- 
-void setUpDebugLogging(const char *logname, int argc, char *argv[]) {
-
-    //   
-    //           Choose where debug output should go
-    //
-    // The default is that debug output goes to cerr.
-    //
-    // Uncomment the following three lines to direct
-    // debug output to a file. Comment them
-    // to default to the console.
-    //
-    // Note: the new DebugStream and ofstream MUST live after we return
-    // from setUpDebugLogging, so we have to allocate
-    // them dynamically.
-    //
-    //
-    // Explanation: 
-    // 
-    //     The first line is ordinary C++ to open a file
-    //     as an output stream.
-    //
-    //     The second line wraps that will all the services
-    //     of a comp 150-IDS debug stream, and names that filestreamp.
-    //
-    //     The third line replaces the global variable c150debug
-    //     and sets it to point to the new debugstream. Since c150debug
-    //     is what all the c150 debug routines use to find the debug stream,
-    //     you've now effectively overridden the default.
-    //
-    ofstream *outstreamp = new ofstream(logname);
-    DebugStream *filestreamp = new DebugStream(outstreamp);
-    DebugStream::setDefaultLogger(filestreamp);
-
-    //
-    //  Put the program name and a timestamp on each line of the debug log.
-    //
-    c150debug->setPrefix(argv[0]);
-    c150debug->enableTimestamp(); 
-
-    //
-    // Ask to receive all classes of debug message
-    //
-    // See c150debug.h for other classes you can enable. To get more than
-    // one class, you can or (|) the flags together and pass the combined
-    // mask to c150debug -> enableLogging 
-    //
-    // By the way, the default is to disable all output except for
-    // messages written with the C150ALWAYSLOG flag. Those are typically
-    // used only for things like fatal errors. So, the default is
-    // for the system to run quietly without producing debug output.
-    //
-    c150debug->enableLogging(C150APPLICATION | C150NETWORKTRAFFIC | 
-                             C150NETWORKDELIVERY); 
-}
-
-
-/* 
- * sendDirPilot
- * Send directory pilot (number of files in directory, hash of directory) over
- * a given socket.
- * * Args:
- *    num_files: the number of files in the directory
- *    hash:      a string containing the checksum for the directory, generated
- *               by getDirHash()
- *    sock:      a socket already opened/configured, to be sent over
- *    argv:      command line arguments to the program, used for error messages
- *
- * Returns: None
- *    
- */
-void sendDirPilot(int num_files, string hash, C150NastyDgmSocket *sock,
-                  char *argv[])
-{
-    ssize_t readlen;
-    bool timedout = true;
-    char incoming_msg[512];   // received message data
-    int num_tries = 0;
-    DirPilot pilot = DirPilot(num_files, hash);
-    // 'Packetized' DirPilot struct
-    string dir_pilot_packet = makeDirPilot(pilot);
-    int pack_len = dir_pilot_packet.size();
-    const char * c_style_msg = dir_pilot_packet.c_str();
-    
-    while (timedout && num_tries < MAX_SEND_TO_SERVER_TRIES) {
-
-        if (num_tries > 0)
-            *GRADING << "Sending DP " << "for dir " << string(argv[SRC_ARG])
-                     << " attempt #" << num_tries+1 << endl;
-        // Send the message to the server
-        c150debug->printf(C150APPLICATION, "%s: Writing message: \"%s\"",
-                          PROG_NAME, c_style_msg);
-        sock->write(c_style_msg,pack_len+1);
-        // Read the response from the server
-        c150debug->printf(C150APPLICATION,"%s: Returned from write,"
-                          " doing read()", PROG_NAME);
-        readlen = sock -> read(incoming_msg, sizeof(incoming_msg));
-        // Check for timeout
-        timedout = sock -> timedout();
-        if (timedout) {
-            num_tries++;
-            continue;
-        }
-        if (readlen == 0) {
-            c150debug->printf(C150APPLICATION,"Read zero length message,"
-                              " trying again");
-            continue;
-        }
-        // Check for acknowledgement from server
-        string incoming(incoming_msg, readlen-1);
-        if (incoming == "DPOK")
-            break;
-    } //we timed out or tried 5 times
-
-    if (num_tries == MAX_SEND_TO_SERVER_TRIES)
-    {
-        throw C150NetworkException("Confirmation from server timed out"
-                                   " too many times for DirPilot");     
-    }
-}
-
-/*
- * sendFiles
- * Loop to send contents of source directory over a given socket
- * Args:
- * * SRC: DIR * of source directory, open for reading.
- * * sourceDir: char *, name of the source directory
- * * sock: A nasty socket pointer, used to communicate with the server
- * * filehash: a map of {filename --> file SHA1} for the files of the source dir
- *
- * Returns: None
- *
- */
-void sendFiles(DIR* SRC, const char* sourceDir, C150NastyDgmSocket* sock,
-                 map<string, string> &filehash)
-{
-    int F_ID = 0; // gets incremented, the nth file has file_ID == n
-    struct dirent *sourceFile;  // Directory entry for source file
-    bool timedout = true;
-    char incoming_msg[512];   // received message data
-    int num_tries = 0;
-    ssize_t readlen;
-    size_t size;
-    // Loop through source dir and create/send file pilot, then send file
-    // packets once we know server has received the correct file pilot
-    while ((sourceFile = readdir(SRC)) != NULL) {
-
-        if ( (strcmp(sourceFile->d_name, ".") == 0) ||
-             (strcmp(sourceFile->d_name, "..")  == 0 ) ) 
-            continue;          // never copy . or ..
-        
-        string filename = sourceFile->d_name;
-        string full_filename = makeFileName(sourceDir, filename);
-        
-        // check that is a regular file
-        if (!isFile(full_filename))
-            continue;                     
-        //
-        // Add {filename, checksum} to the table and construct FilePilot
-        //
-        unsigned char hash[SHA1_LEN];
-        // Read data, compute checksum, put size of file in 'size'
-        char *f_data_c = getFileChecksum(sourceDir, filename, size, hash);
-        string f_data(f_data_c, size);
-        //free malloc'd data
-        free(f_data_c);
-        
-        string hash_str((const char*)hash, SHA1_LEN-1);
-        filehash[filename] = hash_str;
-        int num_packs = size / PACKET_SIZE;
-        if (size % PACKET_SIZE != 0)
-                num_packs++;
-        
-        FilePilot fp = FilePilot(num_packs, F_ID, hash_str, filename);
-        string f_pilot = makeFilePilot(fp); //packetized
-        int pack_len = f_pilot.size();
-        const char * c_style_msg = f_pilot.c_str();
-
-        //
-        // Attempt to send File Pilot to server
-        //
-        while (timedout && num_tries < MAX_SEND_TO_SERVER_TRIES) {
-            if (num_tries > 0)
-                *GRADING << "Sending FP " << fp.file_ID
-                         << " attempt #" << num_tries+1 << endl;
-            // Send the message to the server
-            c150debug->printf(C150APPLICATION,
-                              "%s: Sending File Pilot: \"%s\"",
-                              PROG_NAME, c_style_msg);
-            sock->write(c_style_msg, pack_len+1);
-            // Read the response from the server
-            c150debug->printf(C150APPLICATION,"%s: Returned from write,"
-                              " doing read()", PROG_NAME);
-            readlen = sock -> read(incoming_msg, sizeof(incoming_msg));
-            // Check for timeout or 0 length message (nasty socket)
-            timedout = sock -> timedout();
-            if (timedout) {
-                num_tries++;
-                continue;
-            }
-            if (readlen == 0) {
-                c150debug->printf(C150APPLICATION,"Read zero length message,"
-                                  " trying again");
-                continue;
-            }
-                
-            string inc_str(incoming_msg, readlen-1);
-            // Confirmation from server about specific File Pilot
-            if ((inc_str.substr(0, 4) == "FPOK") &&
-                (stoi(inc_str.substr(4)) == F_ID))
-                break;
-                
-            timedout = true; // If we caught the wrong packet, reset
-            
-        } //we timed out or tried 5 times
-        
-        if (num_tries == MAX_SEND_TO_SERVER_TRIES)
-        {
-            throw C150NetworkException("Server is unresponsive, on FilePilot. "
-                                       "Aborting"); 
-        }
-
-        // If we reached this point, server has received FilePilot and is
-        // ready to receive packets
-        sendFile(fp, f_data, sock);
-
-        // Resets/increments for next file transmission loop
-        num_tries = 0;
-        F_ID++;
-        timedout = true;
-    }
-    *GRADING << "Finished sending files to client\n";
-}
-
-/*
- * sendFile
- * Send contents of a file to server in a series of packetized FilePackets.
- * Args: 
- * * fp: FilePilot for the file being sent, contains metadata for the file
- * * f_data: a string containing the contents of the file
- * * sock: nasty socket used for communication with server
- *
- * Returns: None
- */
-void sendFile(FilePilot fp, string f_data,  C150NastyDgmSocket *sock)
-{
-    *GRADING << "File: " << fp.fname << " beginning transmission\n";
-    ssize_t readlen;
-    char incoming_msg[512];   // received message data
-    int num_file_tries = 0;
-
-    // Break up buffer into FilePacket structs so that we can send data
-    // piecemeal across the wire
-    vector<FilePacket> dps = makeDataPackets(fp, f_data); //dps = data packets
-
-    // packet_ids that the server still needs from us
-    set<int> missing_packs; 
-    // send all packets at least once, so 'missing' contains all packet
-    // numbers to start
-    for (size_t i = 0; i < dps.size(); i++)
-        missing_packs.insert(i);
-   
-    do {
-        if (num_file_tries > 1)
-            *GRADING << "File: " << fp.fname
-                << " sending missing data packets transmission #"
-                << num_file_tries << endl;
-        // Number of times we tried to send this iteration of missing packets
-        int num_missing_tries = 0;
-        bool timedout = true;
-        // Send all packets that the server tells us it needs
-        for (auto iter = missing_packs.begin(); iter != missing_packs.end(); iter++) {
-            // Send each packet 5 times, for redundancy's sake
-            for (int i = 0; i < 5; i++) {
-                string data_pack = makeFilePacket(dps[*iter]);
-                int pack_len = data_pack.size();
-                const char * c_style_msg = data_pack.c_str();
-                c150debug->printf(C150APPLICATION,
-                                  "%s: Sending File Data, msg: \"%s\"",
-                                  PROG_NAME, c_style_msg);
-                sock->write(c_style_msg, pack_len+1);
-            }
-        }
-        if (num_file_tries > 1) {
-            *GRADING << "sent packets ";
-            for (auto iter = missing_packs.begin(); iter != missing_packs.end(); iter++) {
-                *GRADING << *iter << " ";
-            }
-            *GRADING << endl;
-        }
-
-        // Check for server message about which packets it still needs
-        while (timedout && num_missing_tries < MAX_SEND_TO_SERVER_TRIES) {
-
-            readlen = sock -> read(incoming_msg, sizeof(incoming_msg));
-            timedout = sock -> timedout();
-            if (timedout) {
-                num_missing_tries++;
-                continue;
-            }
-            if (readlen == 0) {
-                c150debug->printf(C150APPLICATION,"Read zero length message,"
-                                  " trying again");
-                continue;
-            }
-            string inc_str = string(incoming_msg, readlen-1);
-            if ((inc_str.substr(0, 1) == "M") &&
-                (stoi(inc_str.substr(1, inc_str.find(" ")-1)) == fp.file_ID)) {
-                string missing = inc_str.substr(inc_str.find(" ") + 1);
-                // construct new missing_packs id set using a convenient
-                // constructor
-                stringstream in(missing);
-                missing_packs = set<int>{istream_iterator<int, char>{in},
-                        istream_iterator<int, char>{}};
-                break;
-            }
-                
-            
-            timedout = true; // If we caught the wrong packet, reset
-            
-        } //we timed out or tried 5 times
-        
-        if (num_missing_tries == MAX_SEND_TO_SERVER_TRIES)
-        {
-            throw C150NetworkException("Server is unresponsive on FilePacket. "
-                                       "Aborting"); 
-        }
-
-        num_file_tries++;
- 
-    } while(!missing_packs.empty());
-
-    // We don't report 'waiting for E2E' here, because our E2E is
-    // directory-level
-    *GRADING << "File: " << fp.fname << " transmission complete\n";
-}
-
-/*
- * makeDataPackets
- * Split a buffer containing file contents up into a vector of FilePacket
- * structs
- * Args:
- * * fp: FilePilot for the file, contains necessary metadata
- * * f_data: string containing the contents of the file
- *
- * Returns: vector of FilePacket structs, in the order that the data appears in
- * the file. If each struct's .data member is concatenated in the order it
- * appears in the vector, the resulting string will equal f_data.
- */
-vector<FilePacket> makeDataPackets(FilePilot fp, string f_data){
-    vector<FilePacket> data_packs;
-    int i;
-    for (i = 0; i < fp.num_packets-1; i++) {
-        string data = f_data.substr(i*PACKET_SIZE, PACKET_SIZE);
-        data_packs.push_back(FilePacket(i, fp.file_ID, data));
-    }
-    // Last packet may not be a full packet
-    data_packs.push_back(FilePacket(i, fp.file_ID,
-                                    f_data.substr(i*PACKET_SIZE)));
-    return data_packs;
-}
-
-/*
- * receiveE2E
- * Wait for server to send E2E check over the network, log response
- *
- * Args:
- * * sock: nasty socket for server communication
- *
- * Returns: None
- */
-void receiveE2E(C150NastyDgmSocket *sock)
-{
-    ssize_t readlen = 0;
-    bool timedout = true;
-    char incoming_msg[512];   // received message data
-    int num_tries = 0;
-    string E2EPilot("E2E Ready");
-        
-    while (timedout && (num_tries < MAX_SEND_TO_SERVER_TRIES)) {
-        // Send the message to the server
-        c150debug->printf(C150APPLICATION,
-                          "%s: Sending E2E ready msg: \"%s\"",
-                          PROG_NAME, E2EPilot.c_str());
-        sock->write(E2EPilot.c_str(), E2EPilot.length()+1);
-        readlen = sock -> read(incoming_msg, sizeof(incoming_msg));
-        // Check for timeout
-        timedout = sock -> timedout();
-        if (timedout) {
-            num_tries++;
-            continue;
-        }
-        if (readlen == 0) {
-            c150debug->printf(C150APPLICATION,"Read zero length message,"
-                              " trying again");
-            continue;
-        }
-        string inc_str = string(incoming_msg, readlen-1);
-        // Check for success or failure
-        if (inc_str.substr(0, 4) == "E2ES") {
-            *GRADING << "Directory end-to-end check succeeded.\n";
-            break;
-        }
-        else if (inc_str.substr(0, 4) == "E2EF") {
-            size_t files_start_index = inc_str.find(" ");
-            string num_failed = inc_str.substr(4, files_start_index-4);
-            string files_failed = inc_str.substr(files_start_index);
-            *GRADING << "Directory end-to-end check failed. "<< num_failed <<
-                " file(s) not copied successfully:\n"
-                << files_failed << endl;
-            break;
-        }
-           
-        timedout = true; // If we caught the wrong packet, reset    
-    } //we timed out or tried 5 times
-
-    if (num_tries == MAX_SEND_TO_SERVER_TRIES)
-    {
-        *GRADING << "Did not receive E2E. Aborting...\n";
-        throw C150NetworkException("Did not receive E2E. Aborting..."); 
-    }
-    
-    c150debug->printf(C150APPLICATION, "%s: Sending E2E confirmation",
-                      PROG_NAME);
-    // Blitz of messages to tell server we are done
-    for (int i = 0; i < 10; i++)
-        sock -> write("E2E received", 13);
-}
+// --------------------------------------------------------------
+//
+//                        filecopyclient.cpp
+//
+//        Author: Dylan Hoffmann & Lucas Campbell       
+//   
+//
+//        COMMAND LINE
+//
+//              fileclient <srvrname> <networknasty#> <filenasty#> <src>
+//                         [-j <workers>] [-c <cachefile>] [-k] [-z]
+//                         [-t <subdir>] [-m <megabytes>]
+//                         [-o <order>] [-f <listfile>]
+//
+//              -j: number of threads used to read and hash the source
+//                  directory, then to read files ahead of sending them
+//                  (default: one per core)
+//              -c: file in which to keep the checksums of source files
+//                  between runs, so unchanged files are not re-read
+//              -k: cut files into content-defined chunks and send each
+//                  distinct chunk only once
+//              -z: compress the data sent for files that compress well
+//              -t: subdirectory of the server's target directory to copy
+//                  into, created if need be
+//              -m: megabytes of files that may be read ahead of the one
+//                  being sent (default 64)
+//              -o: order to send files in: "smallest" or "largest"
+//                  first (default: as the directory lists them). Only
+//                  the order changes: files are still sent one at a time.
+//              -f: file naming, one per line, files to send before all
+//                  others, in the order named
+//
+//
+//        OPERATION
+//
+//              Given a server, file and network nastiness levels, and a
+//              directory, sends the contents of the directory to the server.
+//              Files the server's end-to-end response reports as failed
+//              are sent again, up to three times. Quits after the last
+//              end-to-end response or if the server times out.
+//
+//
+//        LIMITATIONS
+//
+//              Works with file nastiness level up to 4 and network nastiness
+//              level up to 4.
+//              Files are sent one at a time: each is piloted, sent and
+//              confirmed before the next is piloted. The server would
+//              take them in any order, several at once, but a big or
+//              lossy file still holds up every file behind it here.
+//
+//
+//     
+// --------------------------------------------------------------
+
+#include "utils.h"
+#include "protocol.h"
+#include "threadpool.h"
+#include "hashcache.h"
+#include "delta.h"
+#include "chunks.h"
+#include "compression.h"
+#include "sparse.h"
+#include "packetpool.h"
+#include "prefetch.h"
+#include "c150nastydgmsocket.h"
+#include "c150nastyfile.h"
+#include "c150debug.h"
+#include <string>
+#include <vector>
+#include <set>
+#include <iterator>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sys/stat.h>
+
+
+using namespace std;          // for C++ std library
+using namespace C150NETWORK;  // for all the comp150 utilities 
+
+/*
+ * SentChunks
+ * The chunks a chunking client has sent in full this session
+ * Fields:
+ * * names: their names, which later files refer to instead of sending
+ *          them again
+ * * by_file: the names each file sent, by file ID. The server only learns
+ *            a chunk once the file carrying it is written, so those of a
+ *            file it fails are taken back out of names.
+ */
+struct SentChunks {
+    set<string> names;
+    map<int, vector<string>> by_file;
+};
+
+// forward declarations
+void setUpDebugLogging(const char *logname, int argc, char *argv[]);
+void parseOptions(int argc, char *argv[]);
+string sendDirPilot(int num_files, string hash, C150NastyDgmSocket *sock,
+                    char *argv[]);
+void sendFiles(DIR* SRC, const char* sourceDir, C150NastyDgmSocket *sock,
+                 map<string, string> &filehash,
+                 const set<string> &stored_chunks,
+                 vector<PrefetchFile> &files, SentChunks &sent_chunks);
+void resendFiles(const char* sourceDir, C150NastyDgmSocket *sock,
+                 const vector<PrefetchFile> &files, const vector<int> &failed,
+                 SentChunks *sent_chunks);
+void sendFileData(FilePilot fp, const string &answer, string &f_data,
+                  C150NastyDgmSocket *sock, SentChunks *sent_chunks,
+                  const set<string> &stored_chunks);
+void orderFiles(vector<PrefetchFile> &files);
+string sendFilePilot(FilePilot fp, C150NastyDgmSocket *sock);
+string fetchServerData(char type, int ID, int num_packets,
+                       C150NastyDgmSocket *sock);
+void sendFile(FilePilot fp, const string &f_data, C150NastyDgmSocket *sock,
+              set<int> missing_packs = set<int>());
+vector<int> receiveE2E(C150NastyDgmSocket *sock);
+void confirmE2E(C150NastyDgmSocket *sock);
+void sendPacket(C150NastyDgmSocket *sock, const string &packet);
+bool readPacket(C150NastyDgmSocket *sock, string &incoming);
+
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                    Command line arguments and Global Variables
+//
+// The following are used as subscripts to argv, the command line arguments
+// If we want to change the command line syntax, doing this
+// symbolically makes it a bit easier.
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+
+const int SERVER_ARG = 1;     // server name is 1st arg
+const int NETWORK_NASTINESS_ARG = 2;        // network nastiness is 2nd arg
+const int FILE_NASTINESS_ARG = 3;        // file nastiness is 3rd arg
+const int SRC_ARG = 4;            // source directory is 4th arg
+const int OPTIONS_ARG = 5;        // optional flags start after the src dir
+const int TIMEOUT_MS = 300;       //ms for timeout
+extern int NETWORK_NASTINESS;
+extern int FILE_NASTINESS;
+char* PROG_NAME;
+const int MAX_SEND_TO_SERVER_TRIES = 20;
+// times files the server failed are sent again, the last time unchunked
+const int MAX_RESEND_ROUNDS = 3;
+int HASH_WORKERS = defaultWorkerCount(); // threads for directory hashing
+// the workers that hash the source dir, then read files ahead of sending
+ThreadPool *WORKERS = NULL;
+const char *CACHE_FILE = NULL;   // checksum cache, if one was asked for
+bool CHUNKING = false;           // send files as content-defined chunks
+bool COMPRESSING = false;        // compress data of files that shrink
+const char *TARGET_SUBDIR = "";  // where on the server to copy to
+size_t PREFETCH_BUDGET = 64 << 20; // bytes of files read ahead of sending
+// orders files may be sent in, besides any named in PRIORITY_FILES
+enum SendOrder { ORDER_DIRECTORY, ORDER_SMALLEST, ORDER_LARGEST };
+SendOrder SEND_ORDER = ORDER_DIRECTORY;
+vector<string> PRIORITY_FILES;   // files to send first, in order
+string SESSION_TAG;              // tags every packet of our session
+PacketPool PACKET_POOL;          // buffers data packets are built in
+
+
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                           main program
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+ 
+int main(int argc, char *argv[]) {    
+
+    GRADEME(argc, argv);
+
+    //
+    // Make sure command line looks right
+    //
+    
+    // Command line args not used
+    if (argc < 5) {
+        fprintf(stderr,"Correct syntax is: %s <srvrname>"
+                " <networknasty#> <filenasty#> <src> [-j <workers>]"
+                " [-c <cachefile>] [-k] [-z] [-t <subdir>] [-m <megabytes>]"
+                " [-o <order>] [-f <listfile>]\n",
+                argv[0]);
+        exit(1);
+    }
+
+    if ((strspn(argv[NETWORK_NASTINESS_ARG], "0123456789") !=
+        strlen(argv[NETWORK_NASTINESS_ARG])) ||
+        (strspn(argv[FILE_NASTINESS_ARG], "0123456789") !=
+         strlen(argv[FILE_NASTINESS_ARG]))) {
+         fprintf(stderr,"Nastiness %s is not numeric\n", argv[FILE_NASTINESS_ARG]);     
+         fprintf(stderr,"Correct syntax is: %s <srvrname>"
+                " <networknasty#> <filenasty#> <src>\n", argv[0]);
+         exit(4);
+     }
+     
+    
+    //
+    // Variable declarations
+    //
+    DIR *SRC;                   // Unix descriptor for open directory
+    NETWORK_NASTINESS = atoi(argv[NETWORK_NASTINESS_ARG]);
+    FILE_NASTINESS = atoi(argv[FILE_NASTINESS_ARG]);
+    PROG_NAME = argv[0];
+    parseOptions(argc, argv);
+    SESSION_TAG = makeSessionTag(newSessionId());
+    
+    checkDirectory(argv[SRC_ARG]);  //Make sure src exists
+
+    //
+    // Open the source directory
+    //
+    SRC = opendir(argv[SRC_ARG]);
+    *GRADING << "Opening Directory:" << argv[SRC_ARG] << endl;
+    if (SRC == NULL) {
+        fprintf(stderr,"Error opening source directory %s\n", argv[SRC_ARG]);
+        exit(8);
+    }
+
+    //
+    //  Set up debug message logging
+    //
+    setUpDebugLogging("filecopyclientdebug.txt",argc, argv);
+
+    //
+    //
+    //        Send / receive / print 
+    //
+    
+    try {
+
+        // Create the socket
+        c150debug->printf(C150APPLICATION,"Creating C150NastyDgmSocket");
+        c150debug->printf(C150APPLICATION,"Creating"
+                          " C150NastyDgmSocket(nastiness=%d)",
+			 NETWORK_NASTINESS);
+        C150NastyDgmSocket *sock = new C150NastyDgmSocket(NETWORK_NASTINESS);
+
+        // Tell the DGMSocket which server to talk to
+        sock -> setServerName(argv[SERVER_ARG]);  
+        
+        // Timeout of .3 seconds
+        sock -> turnOnTimeouts(TIMEOUT_MS);
+
+        *GRADING << "Prelim Setup Complete\n";
+
+        // Loop through source directory, create hashtable with filenames
+        // as keys and  individual file checksums as values
+        map<string, string> filehash;
+        ChecksumCache *cache = NULL;
+        if (CACHE_FILE != NULL)
+            cache = new ChecksumCache(CACHE_FILE);
+        WORKERS = new ThreadPool(HASH_WORKERS);
+        fillChecksumTable(filehash, SRC, argv[SRC_ARG], *WORKERS, cache);
+        closedir(SRC);
+        if (cache != NULL) {
+            cache->save();
+            delete cache;
+        }
+
+        // Open directory again because we loop through it in fillChecksumTable
+        SRC = opendir(argv[SRC_ARG]);
+        *GRADING << "Opening Directory again:" << argv[SRC_ARG] << endl;
+        if (SRC == NULL) {
+            fprintf(stderr,"Error opening source directory %s\n", argv[SRC_ARG]);
+            exit(8);
+        }
+        int num_files = filehash.size();
+
+        // Creates a total directory checksum value based on filenames and
+        // checksums together
+        string dir_checksum = getDirHash(filehash);
+
+        // From here on files are read on worker threads while we talk to the
+        // server. We hold the GRADING log except while waiting on them or
+        // on the network.
+        unique_lock<recursive_mutex> grading(GRADING_LOCK);
+
+        // Send directory pilot to server
+        string dir_answer = sendDirPilot(num_files, dir_checksum, sock, argv);
+
+        // A server with a chunk store tells a chunking client how many
+        // packets it takes to list what is in it
+        set<string> stored_chunks;
+        if (CHUNKING && dir_answer.length() > 5) {
+            string summary = fetchServerData('K', 0,
+                                             stoi(dir_answer.substr(5)),
+                                             sock);
+            for (size_t i = 0; i + CHUNK_SUMMARY_LEN <= summary.size();
+                 i += CHUNK_SUMMARY_LEN)
+                stored_chunks.insert(summary.substr(i, CHUNK_SUMMARY_LEN));
+            *GRADING << "Server chunk store holds " << stored_chunks.size()
+                     << " chunks\n";
+        }
+        
+        // Loop to send files one by one to server
+        vector<PrefetchFile> files;
+        SentChunks sent_chunks;
+        sendFiles(SRC, argv[SRC_ARG], sock, filehash, stored_chunks, files,
+                  sent_chunks);
+
+        // Wait for end-to-end check from server, and send again whatever
+        // files it failed. Chunking may be what failed them, so the last
+        // time round they go whole.
+        vector<int> failed = receiveE2E(sock);
+        for (int round = 1; round <= MAX_RESEND_ROUNDS && !failed.empty();
+             round++) {
+            bool chunking = CHUNKING && round < MAX_RESEND_ROUNDS;
+            resendFiles(argv[SRC_ARG], sock, files, failed,
+                        chunking ? &sent_chunks : NULL);
+            failed = receiveE2E(sock);
+        }
+        confirmE2E(sock);
+
+        *GRADING << "Closing dir\n";
+        closedir(SRC);
+        *GRADING << flush;
+        delete WORKERS;
+        delete sock;
+    }
+
+    
+    //
+    //  Handle networking errors: if an exception is caught, print it to
+    //  screen and exit. Mainly used to report timeouts.
+    //
+    catch (C150NetworkException& e) {
+        // Write to debug log
+        c150debug->printf(C150ALWAYSLOG,"Caught C150NetworkException: %s\n",
+                          e.formattedExplanation().c_str());
+        // In case we're logging to a file, write to the console too
+        cerr << argv[0] << ": caught C150NetworkException: "
+             << e.formattedExplanation() << endl;
+    }
+    
+    
+    return 0;
+}
+
+
+/*
+ * parseOptions
+ * Read the optional flags that follow the source directory on the command
+ * line, setting the corresponding globals. Exits on an unrecognized flag.
+ * Args:
+ * * argc, argv: command line arguments to the program
+ *
+ * Returns: None
+ */
+void parseOptions(int argc, char *argv[])
+{
+    for (int i = OPTIONS_ARG; i < argc; i++) {
+        string flag = argv[i];
+        if (flag == "-j" && i+1 < argc &&
+            strspn(argv[i+1], "0123456789") == strlen(argv[i+1])) {
+            HASH_WORKERS = atoi(argv[++i]);
+        }
+        else if (flag == "-c" && i+1 < argc) {
+            CACHE_FILE = argv[++i];
+        }
+        else if (flag == "-k") {
+            CHUNKING = true;
+        }
+        else if (flag == "-z") {
+            COMPRESSING = true;
+        }
+        else if (flag == "-t" && i+1 < argc) {
+            TARGET_SUBDIR = argv[++i];
+        }
+        else if (flag == "-m" && i+1 < argc &&
+                 strspn(argv[i+1], "0123456789") == strlen(argv[i+1])) {
+            PREFETCH_BUDGET = (size_t)atoi(argv[++i]) << 20;
+        }
+        else if (flag == "-o" && i+1 < argc) {
+            string order = argv[++i];
+            if (order == "smallest")
+                SEND_ORDER = ORDER_SMALLEST;
+            else if (order == "largest")
+                SEND_ORDER = ORDER_LARGEST;
+            else {
+                fprintf(stderr,"Unknown send order %s, expected smallest"
+                        " or largest\n", argv[i]);
+                exit(1);
+            }
+        }
+        else if (flag == "-f" && i+1 < argc) {
+            ifstream list(argv[++i]);
+            if (!list) {
+                fprintf(stderr,"Error opening priority list %s\n", argv[i]);
+                exit(8);
+            }
+            string name;
+            while (getline(list, name))
+                if (!name.empty())
+                    PRIORITY_FILES.push_back(name);
+        }
+        else {
+            fprintf(stderr,"Unrecognized option %s\n", argv[i]);
+            fprintf(stderr,"Correct syntax is: %s <srvrname>"
+                    " <networknasty#> <filenasty#> <src> [-j <workers>]"
+                    " [-c <cachefile>] [-k] [-z] [-t <subdir>] [-m <megabytes>]"
+                    " [-o <order>] [-f <listfile>]\n",
+                    argv[0]);
+            exit(1);
+        }
+    }
+}
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                     setUpDebugLogging
+//
+//        For COMP 150-IDS, a set of standards utilities
+//        are provided for logging timestamped debug messages.
+//        You can use them to write your own messages, but 
+//        more importantly, the communication libraries provided
+//        to you will write into the same logs.
+//
+//        As shown below, you can use the enableLogging
+//        method to choose which classes of messages will show up:
+//        You may want to turn on a lot for some debugging, then
+//        turn off some when it gets too noisy and your core code is
+//        working. You can also make up and use your own flags
+//        to create different classes of debug output within your
+//        application code
+//
+//        NEEDSWORK: should be factored into shared code w/pingserver
+//        NEEDSWORK: document arguments
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+ 
+void setUpDebugLogging(const char *logname, int argc, char *argv[]) {
+
+    //   
+    //           Choose where debug output should go
+    //
+    // The default is that debug output goes to cerr.
+    //
+    // Uncomment the following three lines to direct
+    // debug output to a file. Comment them
+    // to default to the console.
+    //
+    // Note: the new DebugStream and ofstream MUST live after we return
+    // from setUpDebugLogging, so we have to allocate
+    // them dynamically.
+    //
+    //
+    // Explanation: 
+    // 
+    //     The first line is ordinary C++ to open a file
+    //     as an output stream.
+    //
+    //     The second line wraps that will all the services
+    //     of a comp 150-IDS debug stream, and names that filestreamp.
+    //
+    //     The third line replaces the global variable c150debug
+    //     and sets it to point to the new debugstream. Since c150debug
+    //     is what all the c150 debug routines use to find the debug stream,
+    //     you've now effectively overridden the default.
+    //
+    ofstream *outstreamp = new ofstream(logname);
+    DebugStream *filestreamp = new DebugStream(outstreamp);
+    DebugStream::setDefaultLogger(filestreamp);
+
+    //
+    //  Put the program name and a timestamp on each line of the debug log.
+    //
+    c150debug->setPrefix(argv[0]);
+    c150debug->enableTimestamp(); 
+
+    //
+    // Ask to receive all classes of debug message
+    //
+    // See c150debug.h for other classes you can enable. To get more than
+    // one class, you can or (|) the flags together and pass the combined
+    // mask to c150debug -> enableLogging 
+    //
+    // By the way, the default is to disable all output except for
+    // messages written with the C150ALWAYSLOG flag. Those are typically
+    // used only for things like fatal errors. So, the default is
+    // for the system to run quietly without producing debug output.
+    //
+    c150debug->enableLogging(C150APPLICATION | C150NETWORKTRAFFIC | 
+                             C150NETWORKDELIVERY); 
+}
+
+
+/* 
+ * sendDirPilot
+ * Send directory pilot (number of files in directory, hash of directory) over
+ * a given socket.
+ * * Args:
+ *    num_files: the number of files in the directory
+ *    hash:      a string containing the checksum for the directory, generated
+ *               by getDirHash()
+ *    sock:      a socket already opened/configured, to be sent over
+ *    argv:      command line arguments to the program, used for error messages
+ *
+ * Returns: the server's answer, "DPOK", or "DPOK <# packets>" if the server
+ *          has a chunk store it can list for us
+ *    
+ */
+string sendDirPilot(int num_files, string hash, C150NastyDgmSocket *sock,
+                    char *argv[])
+{
+    bool resend = true;
+    string incoming;          // received message data
+    int num_tries = 0;
+    DirPilot pilot = DirPilot(num_files, hash,
+                              (CHUNKING ? ENCODING_CHUNKS : 0) |
+                              (COMPRESSING ? ENCODING_ZLIB : 0),
+                              TARGET_SUBDIR);
+    // 'Packetized' DirPilot struct
+    string dir_pilot_packet = makeDirPilot(pilot);
+    const char * c_style_msg = dir_pilot_packet.c_str();
+    
+    while (num_tries < MAX_SEND_TO_SERVER_TRIES) {
+
+        if (resend) {
+            if (num_tries > 0)
+                *GRADING << "Sending DP " << "for dir "
+                         << string(argv[SRC_ARG])
+                         << " attempt #" << num_tries+1 << endl;
+            // Send the message to the server
+            c150debug->printf(C150APPLICATION,
+                              "%s: Writing message: \"%s\"",
+                              PROG_NAME, c_style_msg);
+            sendPacket(sock, dir_pilot_packet);
+        }
+        // Read the response from the server
+        resend = !readPacket(sock, incoming);
+        if (resend) {
+            num_tries++;
+            continue;
+        }
+        // Check for acknowledgement from server
+        if (incoming.substr(0, 4) == "DPOK")
+            return incoming;
+        // Anything else is a late answer to something earlier, and our
+        // pilot may still be answered: keep listening
+    } //we timed out too many times
+
+    throw C150NetworkException("Confirmation from server timed out"
+                               " too many times for DirPilot");     
+}
+
+/*
+ * sendFiles
+ * Loop to send contents of source directory over a given socket
+ * Args:
+ * * SRC: DIR * of source directory, open for reading.
+ * * sourceDir: char *, name of the source directory
+ * * sock: A nasty socket pointer, used to communicate with the server
+ * * filehash: a map of {filename --> file SHA1} for the files of the source dir
+ * * stored_chunks: chunks in the server's chunk store, see makeChunkList
+ * * files: filled with the files sent, the nth having file_ID == n
+ * * sent_chunks: the chunks sent in full, if CHUNKING
+ *
+ * Returns: None
+ *
+ */
+void sendFiles(DIR* SRC, const char* sourceDir, C150NastyDgmSocket* sock,
+                 map<string, string> &filehash,
+                 const set<string> &stored_chunks,
+                 vector<PrefetchFile> &files, SentChunks &sent_chunks)
+{
+    struct dirent *sourceFile;  // Directory entry for source file
+    // The regular files of the source dir, in the order we send them once
+    // orderFiles has had its say
+    while ((sourceFile = readdir(SRC)) != NULL) {
+
+        if ( (strcmp(sourceFile->d_name, ".") == 0) ||
+             (strcmp(sourceFile->d_name, "..")  == 0 ) ) 
+            continue;          // never copy . or ..
+        
+        string filename = sourceFile->d_name;
+        string full_filename = makeFileName(sourceDir, filename);
+        
+        // check that is a regular file
+        if (!isFile(full_filename))
+            continue;                     
+        struct stat statbuf;
+        if (lstat(full_filename.c_str(), &statbuf) != 0) {
+            fprintf(stderr,"Error stating source file %s\n",
+                    full_filename.c_str());
+            exit(8);
+        }
+        files.push_back(PrefetchFile(filename, filehash[filename],
+                                     statbuf.st_size));
+    }
+    orderFiles(files);
+    // Files are read ahead while earlier ones are sent. One we read and the
+    // server turns out to have is wasted effort, but never network time.
+    FilePrefetcher prefetch(sourceDir, files, PREFETCH_BUDGET, *WORKERS,
+                            &GRADING_LOCK);
+
+    // Send each file's pilot, then its packets once we know the server has
+    // received the correct file pilot
+    for (int F_ID = 0; F_ID < (int)files.size(); F_ID++) {
+        string filename = files[F_ID].name;
+        size_t size = files[F_ID].size;
+        string hash_str = files[F_ID].checksum;
+        int num_packs = packetsNeeded(size);
+        
+        FilePilot fp = FilePilot(num_packs, F_ID, hash_str, filename);
+        string answer = sendFilePilot(fp, sock);
+
+        // If we reached this point, server has received FilePilot and is
+        // ready to receive packets, unless it told us it has the file
+        if (answer.substr(0, 4) == "FPHV") {
+            *GRADING << "File: " << fp.fname
+                     << " already on server, not sending\n";
+            prefetch.drop(F_ID);
+            continue;
+        }
+        // Data as read ahead, which should hash to what the directory did
+        string f_data;
+        if (!prefetch.take(F_ID, f_data)) {
+            // Changed since the directory was hashed. Send what fits the
+            // pilot; the server's check will report the file as failed.
+            *GRADING << "File: " << fp.fname
+                     << " changed since directory was hashed\n";
+            f_data.resize(size);
+        }
+        sendFileData(fp, answer, f_data, sock,
+                     CHUNKING ? &sent_chunks : NULL, stored_chunks);
+    }
+    *GRADING << "Finished sending files to client\n";
+}
+
+/*
+ * resendFiles
+ * Send again files the server failed its checks on, as its end-to-end
+ * answer listed them. Each is read afresh and piloted as if new, which
+ * makes the server take it up again.
+ * Args:
+ * * sourceDir: char *, name of the source directory
+ * * sock: A nasty socket pointer, used to communicate with the server
+ * * files: the files of the source dir, by file ID
+ * * failed: IDs of the files to send again
+ * * sent_chunks: the chunks sent in full so far, or NULL to send the files
+ *                unchunked. Those the failed files sent are forgotten
+ *                first, as the server never learned them. Chunks of the
+ *                server's chunk store are not used: a clash on their short
+ *                names may be what failed a file.
+ *
+ * Returns: None
+ */
+void resendFiles(const char* sourceDir, C150NastyDgmSocket *sock,
+                 const vector<PrefetchFile> &files, const vector<int> &failed,
+                 SentChunks *sent_chunks)
+{
+    for (size_t i = 0; sent_chunks != NULL && i < failed.size(); i++) {
+        vector<string> &names = sent_chunks->by_file[failed[i]];
+        for (size_t j = 0; j < names.size(); j++)
+            sent_chunks->names.erase(names[j]);
+        names.clear();
+    }
+    for (size_t i = 0; i < failed.size(); i++) {
+        int F_ID = failed[i];
+        if (F_ID < 0 || F_ID >= (int)files.size())
+            continue;
+        const PrefetchFile &file = files[F_ID];
+        *GRADING << "File: " << file.name << " sending again"
+                 << (CHUNKING && sent_chunks == NULL ? ", unchunked\n"
+                                                     : "\n");
+        FilePilot fp = FilePilot(packetsNeeded(file.size), F_ID,
+                                 file.checksum, file.name);
+        string answer = sendFilePilot(fp, sock);
+        if (answer.substr(0, 4) == "FPHV") {
+            *GRADING << "File: " << fp.fname
+                     << " already on server, not sending\n";
+            continue;
+        }
+        size_t size;
+        unsigned char hash[SHA1_LEN];
+        char *data = getKnownFileChecksum(sourceDir, file.name, file.checksum,
+                                          size, hash);
+        string f_data(data, size);
+        free(data);
+        if (string((const char *)hash, SHA1_LEN-1) != file.checksum) {
+            *GRADING << "File: " << fp.fname
+                     << " changed since directory was hashed\n";
+            f_data.resize(file.size);
+        }
+        sendFileData(fp, answer, f_data, sock, sent_chunks, set<string>());
+    }
+}
+
+/*
+ * sendFileData
+ * Send a file the server asked for in its answer to the file's pilot,
+ * encoded whichever way takes fewest packets
+ * Args:
+ * * fp: the file's FilePilot, as the server answered it
+ * * answer: the server's answer, FPOK, FPSG or FPRS
+ * * f_data: the file's contents, used up
+ * * sock: A nasty socket pointer, used to communicate with the server
+ * * sent_chunks: the chunks sent in full so far, or NULL if the file is
+ *                not to be chunked. The chunks this file sends in full are
+ *                added.
+ * * stored_chunks: chunks in the server's chunk store, see makeChunkList
+ *
+ * Returns: None
+ */
+void sendFileData(FilePilot fp, const string &answer, string &f_data,
+                  C150NastyDgmSocket *sock, SentChunks *sent_chunks,
+                  const set<string> &stored_chunks)
+{
+    int F_ID = fp.file_ID;
+    // The server learns the chunks this sends in full if the file is
+    // written, whichever way it is sent. If not, resendFiles takes them
+    // back.
+    string chunk_list;
+    if (sent_chunks != NULL)
+        chunk_list = makeChunkList(f_data, sent_chunks->names, stored_chunks,
+                                   sent_chunks->by_file[F_ID]);
+    int encoding = 0;
+    if (sent_chunks != NULL && answer.substr(0, 4) == "FPOK" &&
+        chunk_list.size() < f_data.size()) {
+        // Some of the file was sent before, just name those chunks
+        *GRADING << "File: " << fp.fname << " sending "
+                 << chunk_list.size() << " byte chunk list instead of "
+                 << f_data.size() << " bytes\n";
+        encoding = ENCODING_CHUNKS;
+        f_data.swap(chunk_list);
+    }
+    else if (answer.substr(0, 4) == "FPSG") {
+        // Server has an older copy: send only what differs from it
+        stringstream offer(answer.substr(4));
+        int offer_ID, num_sig_packets;
+        size_t block_size;
+        offer >> offer_ID >> num_sig_packets >> block_size;
+        string signatures = fetchServerData('G', F_ID, num_sig_packets,
+                                            sock);
+        string delta = makeDelta(f_data, signatures, block_size);
+        *GRADING << "File: " << fp.fname << " sending " << delta.size()
+                 << " byte delta instead of " << f_data.size()
+                 << " bytes\n";
+        encoding = ENCODING_DELTA;
+        f_data.swap(delta);
+    }
+    // A resumed file has to be sent the way the server saved it, otherwise
+    // leave out its runs of zeros
+    bool resuming = (answer.substr(0, 4) == "FPRS");
+    if (encoding == 0 && !resuming) {
+        string zero_runs = makeZeroRunList(f_data);
+        if (packetsNeeded(zero_runs.size()) < packetsNeeded(f_data.size())) {
+            *GRADING << "File: " << fp.fname << " sending "
+                     << zero_runs.size() << " bytes without its zero "
+                        "runs instead of " << f_data.size() << " bytes\n";
+            encoding = ENCODING_SPARSE;
+            f_data.swap(zero_runs);
+        }
+    }
+    // Compress whatever we are about to send if that saves packets
+    if (COMPRESSING && !resuming &&
+        packetsNeeded(f_data.size()) > 1 && worthCompressing(f_data)) {
+        string packed = compressData(f_data);
+        if (packetsNeeded(packed.size()) < packetsNeeded(f_data.size())) {
+            *GRADING << "File: " << fp.fname << " compressed "
+                     << f_data.size() << " bytes to " << packed.size()
+                     << endl;
+            encoding |= ENCODING_ZLIB;
+            f_data.swap(packed);
+        }
+    }
+    if (encoding != 0) {
+        fp = FilePilot(packetsNeeded(f_data.size()), F_ID, fp.hash,
+                       fp.fname, encoding);
+        sendFilePilot(fp, sock);
+    }
+    set<int> missing_packs;
+    if (resuming) {
+        // Server kept part of the file from an earlier attempt
+        missing_packs = unpackRangeList(answer.substr(answer.find(" ") + 1));
+        *GRADING << "File: " << fp.fname << " resuming, server "
+                    "first asks for " << missing_packs.size() << " of "
+                 << fp.num_packets << " packets\n";
+    }
+    sendFile(fp, f_data, sock, missing_packs);
+}
+
+/*
+ * orderFiles
+ * Put the files of the source dir in the order they are to be sent: those
+ * named in PRIORITY_FILES first, in the order named, then the rest by
+ * SEND_ORDER. Sending small files first gets the most of them to the
+ * server soonest, while a big one would hold up everything behind it.
+ * Files still go one at a time, so a big one sent early holds up the rest
+ * whatever the order; streaming it behind the small ones needs the client
+ * to keep several files in flight (see LIMITATIONS).
+ * Args:
+ * * files: the files, in the order the directory listed them
+ *
+ * Returns: None, the files are reordered in place
+ */
+void orderFiles(vector<PrefetchFile> &files)
+{
+    // Rank of each file named in the list, anything else comes after
+    map<string, size_t> rank;
+    for (size_t i = 0; i < PRIORITY_FILES.size(); i++)
+        rank.insert(make_pair(PRIORITY_FILES[i], i));
+    auto rankOf = [&rank](const PrefetchFile &file) {
+        auto found = rank.find(file.name);
+        return (found == rank.end()) ? PRIORITY_FILES.size()
+                                     : found->second;
+    };
+    stable_sort(files.begin(), files.end(),
+                [&rankOf](const PrefetchFile &a, const PrefetchFile &b) {
+        size_t rank_a = rankOf(a), rank_b = rankOf(b);
+        if (rank_a != rank_b)
+            return rank_a < rank_b;
+        if (SEND_ORDER == ORDER_SMALLEST)
+            return a.size < b.size;
+        if (SEND_ORDER == ORDER_LARGEST)
+            return a.size > b.size;
+        return false;
+    });
+}
+
+/*
+ * sendFilePilot
+ * Send a FilePilot until the server answers it.
+ * Args:
+ * * fp: the FilePilot to send
+ * * sock: nasty socket used for communication with server
+ *
+ * Returns: the server's answer: "FPOK<id>" to go ahead and send the data,
+ * "FPHV<id>" if it already has the file, or "FPSG<id> <# signature packets>
+ * <block size>" if it offers a delta against an older copy, or
+ * "FPRS<id> <missing packets>" if it saved part of the file on an earlier run.
+ * A pilot for encoded data (a delta, chunk list, zero run list or compressed
+ * data) is only ever answered with FPOK.
+ */
+string sendFilePilot(FilePilot fp, C150NastyDgmSocket *sock)
+{
+    bool resend = true;
+    string inc_str;           // received message data
+    int num_tries = 0;
+    string f_pilot = makeFilePilot(fp); //packetized
+    const char * c_style_msg = f_pilot.c_str();
+    bool is_encoded = (fp.encoding != 0);
+
+    //
+    // Attempt to send File Pilot to server
+    //
+    while (num_tries < MAX_SEND_TO_SERVER_TRIES) {
+        if (resend) {
+            if (num_tries > 0)
+                *GRADING << "Sending FP " << fp.file_ID
+                         << " attempt #" << num_tries+1 << endl;
+            // Send the message to the server
+            c150debug->printf(C150APPLICATION,
+                              "%s: Sending File Pilot: \"%s\"",
+                              PROG_NAME, c_style_msg);
+            sendPacket(sock, f_pilot);
+        }
+        // Read the response from the server
+        resend = !readPacket(sock, inc_str);
+        if (resend) {
+            num_tries++;
+            continue;
+        }
+
+        string kind = inc_str.substr(0, 4);
+        // Confirmation from server about specific File Pilot
+        if ((kind == "FPOK" || (!is_encoded && (kind == "FPHV" ||
+             kind == "FPSG" || kind == "FPRS"))) &&
+            (stoi(inc_str.substr(4)) == fp.file_ID))
+            return inc_str;
+        // A late answer to an earlier pilot, keep listening for ours
+    } //we timed out too many times
+    
+    throw C150NetworkException("Server is unresponsive, on FilePilot. "
+                               "Aborting"); 
+}
+
+/*
+ * fetchServerData
+ * Collect data the server offered us, asking for the packets we are still
+ * missing with "<type><ID> <packet #> <packet #>..." until we have them all.
+ * The server answers with packets of the same type: 'G' for the delta
+ * signatures of a file, 'K' for the list of its chunk store.
+ * Args:
+ * * type: request and packet type of the data
+ * * ID: ID of the file the data is for, 0 if not for a file
+ * * num_packets: number of packets the server offered
+ * * sock: nasty socket used for communication with server
+ *
+ * Returns: the data, put back together
+ */
+string fetchServerData(char type, int ID, int num_packets,
+                       C150NastyDgmSocket *sock)
+{
+    string incoming;          // received message data
+    vector<string> data_packets(num_packets);
+    set<int> missing;
+    for (int i = 0; i < num_packets; i++)
+        missing.insert(i);
+    int num_tries = 0;
+
+    while (!missing.empty()) {
+        if (num_tries == MAX_SEND_TO_SERVER_TRIES)
+            throw C150NetworkException("Server is unresponsive on "
+                                       "data request. Aborting");
+        // Ask for as many missing packets as fit in one message
+        string request = type + to_string(ID) + " ";
+        for (auto iter = missing.begin(); iter != missing.end(); iter++) {
+            if (request.length() + MAX_PACKNUM + 1 > 512 - SESSION_TAG_LEN)
+                break;
+            request += to_string(*iter) + " ";
+        }
+        sendPacket(sock, request);
+
+        // Take packets until the server goes quiet
+        bool got_any = false;
+        while (readPacket(sock, incoming)) {
+            if (incoming[0] != type)
+                continue;
+            FilePacket packet = unpackFilePacket(incoming);
+            if (packet.file_ID != ID ||
+                missing.erase(packet.packet_num) == 0)
+                continue;
+            data_packets[packet.packet_num] = packet.data;
+            got_any = true;
+        }
+        num_tries = got_any ? 0 : num_tries+1;
+    }
+
+    string data;
+    for (int i = 0; i < num_packets; i++)
+        data += data_packets[i];
+    return data;
+}
+
+/*
+ * sendFile
+ * Send contents of a file to server in a series of packetized FilePackets.
+ * Args: 
+ * * fp: FilePilot for the file being sent, contains metadata for the file
+ * * f_data: a string containing the contents of the file
+ * * sock: nasty socket used for communication with server
+ * * missing_packs: packets the server still needs, if it already has some;
+ *                  empty to send all of them
+ *
+ * Returns: None
+ */
+void sendFile(FilePilot fp, const string &f_data, C150NastyDgmSocket *sock,
+              set<int> missing_packs)
+{
+    *GRADING << "File: " << fp.fname << " beginning transmission\n";
+    string inc_str;           // received message data
+    int num_file_tries = 0;
+
+    // packet_ids that the server still needs from us. Unless the server
+    // said otherwise, send all packets at least once, so 'missing' contains
+    // all packet numbers to start
+    if (missing_packs.empty()) {
+        for (int i = 0; i < fp.num_packets; i++)
+            missing_packs.insert(i);
+    }
+   
+    do {
+        if (num_file_tries > 1)
+            *GRADING << "File: " << fp.fname
+                << " sending missing data packets transmission #"
+                << num_file_tries << endl;
+        // Number of times we tried to send this iteration of missing packets
+        int num_missing_tries = 0;
+        bool resend = true;
+        // Send all packets that the server tells us it needs
+        for (auto iter = missing_packs.begin(); iter != missing_packs.end(); iter++) {
+            if (*iter < 0 || *iter >= fp.num_packets)
+                continue;
+            // Build the packet once, straight from the file's data, in a
+            // buffer from the pool
+            size_t offset = (size_t)*iter * PACKET_SIZE;
+            size_t len = min((size_t)PACKET_SIZE, f_data.size() - offset);
+            PacketBuffer packet = PACKET_POOL.get();
+            size_t packet_len = writeFilePacket(packet.data(), SESSION_TAG,
+                                                *iter, fp.file_ID,
+                                                f_data.data() + offset, len);
+            c150debug->printf(C150APPLICATION,
+                              "%s: Sending File Data, msg: \"%s\"",
+                              PROG_NAME, packet.data());
+            // Send each packet 5 times, for redundancy's sake
+            for (int i = 0; i < 5; i++)
+                sock->write(packet.data(), packet_len);
+        }
+        if (num_file_tries > 1) {
+            *GRADING << "sent packets ";
+            for (auto iter = missing_packs.begin(); iter != missing_packs.end(); iter++) {
+                *GRADING << *iter << " ";
+            }
+            *GRADING << endl;
+        }
+
+        // Ask the server which packets it still needs, until it answers
+        string query = "Q" + to_string(fp.file_ID);
+        while (num_missing_tries < MAX_SEND_TO_SERVER_TRIES) {
+
+            if (resend)
+                sendPacket(sock, query);
+            resend = !readPacket(sock, inc_str);
+            if (resend) {
+                num_missing_tries++;
+                continue;
+            }
+            if ((inc_str.substr(0, 1) == "M") &&
+                (stoi(inc_str.substr(1, inc_str.find(" ")-1)) == fp.file_ID)) {
+                string missing = inc_str.substr(inc_str.find(" ") + 1);
+                missing_packs = unpackRangeList(missing);
+                break;
+            }
+            // An answer to an earlier query, ours is on its way
+        } //we timed out too many times
+        
+        if (num_missing_tries == MAX_SEND_TO_SERVER_TRIES)
+        {
+            throw C150NetworkException("Server is unresponsive on FilePacket. "
+                                       "Aborting"); 
+        }
+
+        num_file_tries++;
+ 
+    } while(!missing_packs.empty());
+
+    // We don't report 'waiting for E2E' here, because our E2E is
+    // directory-level
+    *GRADING << "File: " << fp.fname << " transmission complete\n";
+}
+
+/*
+ * receiveE2E
+ * Wait for server to send E2E check over the network, log response
+ *
+ * Args:
+ * * sock: nasty socket for server communication
+ *
+ * Returns: IDs of the files the server failed, as many as it listed, or
+ *          nothing if the check succeeded
+ */
+vector<int> receiveE2E(C150NastyDgmSocket *sock)
+{
+    vector<int> failed;
+    bool resend = true;
+    string inc_str;           // received message data
+    int num_tries = 0;
+    string E2EPilot("E2E Ready");
+        
+    while (num_tries < MAX_SEND_TO_SERVER_TRIES) {
+        // Send the message to the server
+        if (resend) {
+            c150debug->printf(C150APPLICATION,
+                              "%s: Sending E2E ready msg: \"%s\"",
+                              PROG_NAME, E2EPilot.c_str());
+            sendPacket(sock, E2EPilot);
+        }
+        resend = !readPacket(sock, inc_str);
+        if (resend) {
+            num_tries++;
+            continue;
+        }
+        // Check for success or failure
+        if (inc_str.substr(0, 4) == "E2ES") {
+            *GRADING << "Directory end-to-end check succeeded.\n";
+            break;
+        }
+        else if (inc_str.substr(0, 4) == "E2EF") {
+            stringstream answer(inc_str.substr(4));
+            string num_failed;
+            answer >> num_failed;
+            for (int ID; answer >> ID; )
+                failed.push_back(ID);
+            *GRADING << "Directory end-to-end check failed. "<< num_failed <<
+                " file(s) not copied successfully:\n";
+            for (size_t i = 0; i < failed.size(); i++)
+                *GRADING << " " << failed[i];
+            *GRADING << endl;
+            break;
+        }
+        // Something left over from the last file, keep listening
+    } //we timed out too many times
+
+    if (num_tries == MAX_SEND_TO_SERVER_TRIES)
+    {
+        *GRADING << "Did not receive E2E. Aborting...\n";
+        throw C150NetworkException("Did not receive E2E. Aborting..."); 
+    }
+    return failed;
+}
+
+/*
+ * confirmE2E
+ * Tell the server we have its last end-to-end answer and are done
+ *
+ * Args:
+ * * sock: nasty socket for server communication
+ *
+ * Returns: None
+ */
+void confirmE2E(C150NastyDgmSocket *sock)
+{
+    c150debug->printf(C150APPLICATION, "%s: Sending E2E confirmation",
+                      PROG_NAME);
+    // Blitz of messages to tell server we are done
+    for (int i = 0; i < 10; i++)
+        sendPacket(sock, "E2E received");
+}
+
+/*
+ * sendPacket
+ * Send a packet to the server, tagged with our session id so the server
+ * knows which of its clients it is from
+ * Args:
+ * * sock: nasty socket for server communication
+ * * packet: the packet, untagged
+ *
+ * Returns: None
+ */
+void sendPacket(C150NastyDgmSocket *sock, const string &packet)
+{
+    string tagged = SESSION_TAG + packet;
+    sock->write(tagged.c_str(), tagged.length()+1);
+}
+
+/*
+ * readPacket
+ * Wait for a packet of our session from the server. Packets tagged for
+ * another session (the server answers whoever wrote to it last, so we can
+ * be sent another client's answers) and empty ones are dropped on sight,
+ * without counting as an answer.
+ * Args:
+ * * sock: nasty socket for server communication
+ * * incoming: pass-by-reference string, set to the packet without its tag
+ *
+ * Returns: false if the read timed out
+ */
+bool readPacket(C150NastyDgmSocket *sock, string &incoming)
+{
+    char incoming_msg[512];   // received message data
+    while (true) {
+        ssize_t readlen;
+        {
+            // Let the file readers log while we wait
+            Unlocked unlocked(&GRADING_LOCK);
+            readlen = sock -> read(incoming_msg, sizeof(incoming_msg));
+        }
+        if (sock -> timedout())
+            return false;
+        if (readlen <= SESSION_TAG_LEN + 1 ||
+            memcmp(incoming_msg, SESSION_TAG.data(), SESSION_TAG_LEN) != 0) {
+            c150debug->printf(C150APPLICATION,"Dropping packet not of our"
+                              " session");
+            continue;
+        }
+        incoming.assign(incoming_msg + SESSION_TAG_LEN,
+                        readlen - SESSION_TAG_LEN - 1);
+        return true;
+    }
+}
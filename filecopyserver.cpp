@@ -1,794 +1,1998 @@
-// --------------------------------------------------------------
-//
-//                        filecopyserver.cpp
-//
-//        Authors: Lucas Campbell and Dylan Hoffmann
-//
-//
-//
-//        COMMAND LINE
-//
-//          fileserver <networknastiness> <filenastiness> <targetdir>
-//
-//
-//        OPERATION
-//
-//              Filecopy server will wait until receiving a directory
-//              pilot packet, set up the file environment, and then
-//              begin receiving file specific packets. As each packet
-//              will be numbered it will ignore any duplicates it
-//              receives and fill in the file data as packets arrive.
-//              Once the server has received all packets for all files, it
-//              performs a directory-level end-to-end check and sends the
-//              result back to the client.
-//
-//
-//        LIMITATIONS
-//
-//              Works with file nastiness level up to 4 and network nastiness
-//              level up to 4. Will continue indefinitely attempting to send
-//              E2E check if client aborts before sending confirmation.
-//
-//     
-// --------------------------------------------------------------
-
-#include "c150nastydgmsocket.h"
-#include "c150nastyfile.h"
-#include "c150debug.h"
-#include "utils.h"
-#include "protocol.h"
-#include <fstream>
-#include <set>
-#include <map>
-#include <vector>
-
-
-using namespace std;          // for C++ std library
-using namespace C150NETWORK;  // for all the comp150 utilities 
-
-// Forward declarations
-void setUpDebugLogging(const char *logname, int argc, char *argv[]);
-DirPilot receiveDirPilot(C150NastyDgmSocket *sock);
-void receiveFile(C150NastyDgmSocket *sock, string incoming,
-                 vector<string> &failed_e2es, map<string, string> &filehash);
-void receiveDataPackets(C150NastyDgmSocket *sock, FilePacket first_packet,
-                        FilePilot file_pilot, vector<string> &failed_e2es,
-                        map<string, string> &filehash);
-bool internalE2E(string file_data, FilePilot file_pilot,
-                 map<string, string> &filehash);
-void sendE2E(C150NastyDgmSocket *sock, vector<string> failed,
-             map<string, string> filehash, DirPilot dir_pilot);
-
-
-/********** Global Constants **********/
-const int NETWORK_NASTINESS_ARG = 1;
-const int FILE_NASTINESS_ARG = 2;
-const int TARGET_ARG = 3;
-extern int NETWORK_NASTINESS;
-extern int FILE_NASTINESS;
-// max number of attempts to write file to disk
-const int MAX_WRITE_TRIES = 5; 
-const int TIMEOUT_MS = 300;       //ms for timeout
-string TARGET_DIR;
-
-
-
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-//
-//                           main program
-//
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
- 
-int
-main(int argc, char *argv[])
-{
-    GRADEME(argc, argv);
-
-    //
-    // Check command line and parse arguments
-    //
-    if (argc != 4)  {
-        fprintf(stderr,"Correct syntax is: %s <network nastiness>"
-                        "<file nastiness> <target directory>\n", argv[0]);
-        exit(1);
-    }
-    if (strspn(argv[NETWORK_NASTINESS_ARG], "0123456789") != 
-        strlen(argv[NETWORK_NASTINESS_ARG])) {
-        fprintf(stderr,"Nastiness %s is not numeric\n",
-                argv[NETWORK_NASTINESS_ARG]);     
-        fprintf(stderr,"Correct syntax is: %s <network nastiness>"
-                        "<file nastiness> <target directory>\n", argv[0]);
-        exit(4);
-    }
-    if (strspn(argv[FILE_NASTINESS_ARG], "0123456789") !=
-        strlen(argv[FILE_NASTINESS_ARG])) {
-        fprintf(stderr,"Nastiness %s is not numeric\n",
-                argv[FILE_NASTINESS_ARG]);     
-        fprintf(stderr,"Correct syntax is: %s <network nastiness>"
-                        "<file nastiness> <target directory>\n", argv[0]);
-        exit(4);
-    }
-    //
-    // Variable declarations
-    //
-    ssize_t readlen;             // amount of data read from socket
-    char incoming_msg[512];   // received message data
-    DIR* TRG;
-    // map of filenames to checksums, as they exist written in target dir
-    map<string, string> filehash; 
-    // vector of filenames, to be reported to client as part of e2e check
-    vector<string> failed_e2es;
-    // convert command line args
-    NETWORK_NASTINESS = atoi(argv[NETWORK_NASTINESS_ARG]);   
-    FILE_NASTINESS = atoi(argv[FILE_NASTINESS_ARG]);   
-    TARGET_DIR = string(argv[TARGET_ARG]);
-       
-    //
-    //  Set up debug message logging
-    //
-    setUpDebugLogging("filecopyserverdebug.txt",argc, argv);
-
-    //
-    // Open the target directory
-    //
-    TRG = opendir(TARGET_DIR.c_str());
-    if (TRG == NULL) {
-        fprintf(stderr,"Error opening source directory %s\n",
-                TARGET_DIR.c_str());
-        exit(8);
-    }
-
-    //
-    // We set a debug output indent in the server only, not the client.
-    // That way, if we run both programs and merge the logs this way:
-    //
-    //    cat pingserverdebug.txt pingserverclient.txt | sort
-    //
-    // it will be easy to tell the server and client entries apart.
-    //
-    // Note that the above trick works because at the start of each
-    // log entry is a timestamp that sort will indeed arrange in 
-    // timestamp order, thus merging the logs by time across 
-    // server and client.
-    //
-    c150debug->setIndent("    ");       // if we merge client and server
-                                        // logs, server stuff will be indented
-
-    
-    //
-    // Create socket, loop receiving and responding
-    //
-    try {
-        *GRADING << "Creating C150NastyDgmSocket(nastiness=" <<
-            NETWORK_NASTINESS << ")" << endl;
-        c150debug->printf(C150APPLICATION,"Creating "
-                          "C150NastyDgmSocket(nastiness=%d)",
-                          NETWORK_NASTINESS);
-        C150NastyDgmSocket *sock = new C150NastyDgmSocket(NETWORK_NASTINESS);
-        *GRADING << "Ready to accept messages\n";
-        c150debug->printf(C150APPLICATION,"Ready to accept messages");
-
-        // Timeout of .3 seconds
-        sock -> turnOnTimeouts(TIMEOUT_MS);
-
-        // Wait until client sends a DirPilot
-        DirPilot dir_pilot = receiveDirPilot(sock);
-
-        int num_files = dir_pilot.num_files;
-        int received_files = 0;
-        
-        // Loop to receive the number of files indicated by DirPilot
-        while (received_files < num_files) {
-            // Read a message
-            readlen = sock -> read(incoming_msg, sizeof(incoming_msg));
-            if (readlen == 0) {
-                c150debug->printf(C150APPLICATION,"Read zero length message,"
-                                  " trying again");
-                continue;
-            }
-            incoming_msg[readlen] = '\0'; // make sure null terminated
-            string incoming(incoming_msg, readlen-1); // Convert to C++ string
-            c150debug->printf(C150APPLICATION,"Successfully read %d bytes."
-                              " Message=\"%s\"", readlen, incoming.c_str());
-            c150debug->printf(C150APPLICATION, "readlen:%lu inc size: %lu",
-                              readlen, incoming.size());
-            // Check for FilePilot
-            if (incoming[0] == 'P') {
-                int fID = stoi(incoming.substr(10, MAX_FILENUM));
-                // Don't receive file a second time
-                if (fID == received_files) {
-                    // Receive corresponding packets
-                    receiveFile(sock, incoming, failed_e2es, filehash);
-                    received_files++;
-                }
-            }
-            // Resend confirmation of DirPilot if client appears to need it
-            else if (incoming[0] == 'D') {
-                string response = "DPOK";
-                c150debug->printf(C150APPLICATION,"Responding with message=\"%s\"",
-                                  response.c_str());
-                sock -> write(response.c_str(), response.length()+1);
-            }
-            else
-                // Skip over FilePacket packets when in this outer loop
-                continue;
-        }
-        // Send E2E and wait for response
-        sendE2E(sock, failed_e2es, filehash, dir_pilot);
-
-        *GRADING << "Closing dir\n";
-        closedir(TRG);
-        *GRADING << flush;
-        delete sock;
-
-    }
-
-    catch (C150NetworkException& e) {
-        // Write to debug log
-        c150debug->printf(C150ALWAYSLOG,"Caught C150NetworkException: %s\n",
-                          e.formattedExplanation().c_str());
-        // In case we're logging to a file, write to the console too
-        cerr << argv[0] << ": caught C150NetworkException: "
-             << e.formattedExplanation() << endl;
-    }
-
-    // This only executes if there was an error caught above
-    return 4;
-}
-
-
-
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
-//
-//                     setUpDebugLogging
-//
-//        For COMP 150-IDS, a set of standards utilities
-//        are provided for logging timestamped debug messages.
-//        You can use them to write your own messages, but 
-//        more importantly, the communication libraries provided
-//        to you will write into the same logs.
-//
-//        As shown below, you can use the enableLogging
-//        method to choose which classes of messages will show up:
-//        You may want to turn on a lot for some debugging, then
-//        turn off some when it gets too noisy and your core code is
-//        working. You can also make up and use your own flags
-//        to create different classes of debug output within your
-//        application code
-//
-//        NEEDSWORK: should be factored and shared w/pingclient
-//        NEEDSWORK: document arguments
-//
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
- 
-void setUpDebugLogging(const char *logname, int argc, char *argv[]) {
-
-    //   
-    //           Choose where debug output should go
-    //
-    // The default is that debug output goes to cerr.
-    //
-    // Uncomment the following three lines to direct
-    // debug output to a file. Comment them to 
-    // default to the console
-    //  
-    // Note: the new DebugStream and ofstream MUST live after we return
-    // from setUpDebugLogging, so we have to allocate
-    // them dynamically.
-    //
-    //
-    // Explanation: 
-    // 
-    //     The first line is ordinary C++ to open a file
-    //     as an output stream.
-    //
-    //     The second line wraps that will all the services
-    //     of a comp 150-IDS debug stream, and names that filestreamp.
-    //
-    //     The third line replaces the global variable c150debug
-   //     and sets it to point to the new debugstream. Since c150debug
-    //     is what all the c150 debug routines use to find the debug stream,
-    //     you've now effectively overridden the default.
-    //
-    ofstream *outstreamp = new ofstream(logname);
-    DebugStream *filestreamp = new DebugStream(outstreamp);
-    DebugStream::setDefaultLogger(filestreamp);
-
-
-    //
-    //  Put the program name and a timestamp on each line of the debug log.
-    //
-    c150debug->setPrefix(argv[0]);
-    c150debug->enableTimestamp(); 
-
-    //
-    // Ask to receive all classes of debug message
-    //
-    // See c150debug.h for other classes you can enable. To get more than
-    // one class, you can or (|) the flags together and pass the combined
-    // mask to c150debug -> enableLogging 
-    //
-    // By the way, the default is to disable all output except for
-    // messages written with the C150ALWAYSLOG flag. Those are typically
-    // used only for things like fatal errors. So, the default is
-    // for the system to run quietly without producing debug output.
-    //
-    c150debug->enableLogging(C150APPLICATION | C150NETWORKTRAFFIC | 
-                             C150NETWORKDELIVERY); 
-}
-
-/*
- * receiveDirPilot
- * wait for a DirPilot packet from the server, return the information received
- *
- * Args:
- * * sock:  A C150NastyDgmSocket used to listen for messages
- *
- * Returns: DirPilot Struct
- */
-DirPilot receiveDirPilot(C150NastyDgmSocket *sock)
-{
-    *GRADING << "Waiting for DirPilot\n";
-    ssize_t readlen;             // amount of data read from socket
-    char incoming_msg[512];   // received message data
-
-    // Loop forever, because no point in moving on until receive DirPilot
-    while (true) {
-        readlen = sock -> read(incoming_msg, sizeof(incoming_msg));
-        if (readlen == 0) {
-            c150debug->printf(C150APPLICATION,"Read zero length message,"
-                              " trying again");
-            continue;
-        }
-        incoming_msg[readlen] = '\0'; // make sure null terminated
-        string incoming(incoming_msg, readlen-1); // Convert to C++ string
-        c150debug->printf(C150APPLICATION,"Successfully read %d bytes."
-                          " Message=\"%s\"", readlen, incoming.c_str());
-        // Loop until we get a DirPilot
-        if (incoming[0] != 'D')
-            continue;
-        DirPilot dir_pilot = unpackDirPilot(incoming);
-        //
-        // confirm to client that we received the DirPilot
-        //
-        string response = string("DPOK");
-        c150debug->printf(C150APPLICATION,"Responding with message=\"%s\"",
-                          response.c_str());
-        sock -> write(response.c_str(), response.length()+1);
-        *GRADING << "DirPilot received\n";
-        return dir_pilot;
-    }
-    
-}
-
-/*
- * receiveFile
- * Listens for FilePilot and the first corresponding data packet on a given
- * socket, before calling a function to receive the rest of the file. Secondary
- * function will receive the rest of the file and write contents to disk.
- *
- * Args:
- * * sock: Nasty socket for communication with client
- * * incoming: string with packetized FilePilot data
- * * failed_e2es: vector of filenames of failed files. Adjusted if current file
- *                fails
- * * filehash: map of {filename, checksum}, with according to how files are
- *             written in the target directory. Updated accordingly after
- *             current file is written.
- *
- *  Returns: None
- *
- */
-
-void receiveFile(C150NastyDgmSocket *sock, string incoming,
-                 vector<string> &failed_e2es, map<string, string> &filehash)
-{
-    ssize_t readlen;             // amount of data read from socket
-    char incoming_msg[512];   // received message data
-    FilePilot file_pilot = unpackFilePilot(incoming);
-    *GRADING << "Received File Pilot for " << file_pilot.fname << endl;
-
-    // Loop until we get a FilePacket
-    while (true) {
-        readlen = sock -> read(incoming_msg, sizeof(incoming_msg));
-        if (readlen == 0) {
-            c150debug->printf(C150APPLICATION,"Read zero length message,"
-                              " trying again");
-            continue;
-        }
-        incoming_msg[readlen] = '\0'; // make sure null terminated
-        string incoming(incoming_msg, readlen-1); // Convert to C++ string
-        c150debug->printf(C150APPLICATION,"Successfully read %d bytes."
-                          " Message=\"%s\"", readlen, incoming.c_str());
-        // If we receive the same FilePilot again, the client did not get our
-        // confirmation the first time so we re-send it
-        if (incoming[0] == 'P') {
-            FilePilot fp2 = unpackFilePilot(incoming);
-            if (fp2.file_ID == file_pilot.file_ID) {
-                string response = "FPOK" + to_string(fp2.file_ID);
-                c150debug->printf(C150APPLICATION,"Responding with message=\"%s\"",
-                                  response.c_str());
-                sock -> write(response.c_str(), response.length()+1);
-                continue;
-            }
-        }
-        // Make sure the File Packet is for the correct file
-        else if (incoming[0] == 'F') {
-            FilePacket first_packet = unpackFilePacket(incoming);
-            if (first_packet.file_ID == file_pilot.file_ID) {
-                // Receive/write rest of file
-                receiveDataPackets(sock, first_packet, file_pilot,
-                                   failed_e2es, filehash);
-                break;
-            }
-        }
-        else
-            continue;
-    }
-}
-
-/*
- * receiveDataPackets
- * Listens for data packets for a particular file on a given socket, 
- * writing the data to disk and making note if there was a failure to write
- * correctly.
- *
- * Args:
- * * sock: Nasty socket for communication with client
- * * first_packet: the first packet received with the same file_ID as the
- *                 current FilePilot
- * * file_pilot: FilePilot struct for the current file.
- * * failed_e2es: vector of filenames of failed files. Adjusted if current file
- *                fails
- * * filehash: map of {filename, checksum}, with according to how files are
- *             written in the target directory. Updated accordingly after
- *             current file is written.
- *
- *  Returns: None
- *
- */
-void receiveDataPackets(C150NastyDgmSocket *sock, FilePacket first_packet,
-                        FilePilot file_pilot, vector<string> &failed_e2es,
-                        map<string, string> &filehash)
-{
-    *GRADING << "File: " << file_pilot.fname << " starting to receive file\n";
-    ssize_t readlen;             // amount of data read from socket
-    bool timedout = false;
-    char incoming_msg[512];
-    int num_tries = 0;
-
-    // Buffer to be filled with data from client. Only fill most of the way, to
-    // account for possible incomplete final packet
-    int buffer_size = PACKET_SIZE*(file_pilot.num_packets-1);
-    string file_data(buffer_size, ' ');
-    set<int> packets;
-    // Create set with packet_IDs of the packets we need to receive
-    for (int i = 0; i < file_pilot.num_packets; i++) {
-        packets.insert(packets.end(), i);
-    }
-    // insert the first data packet we received, take it out of the set
-    int loc = first_packet.packet_num*PACKET_SIZE;
-    if (file_pilot.num_packets == 1) {
-        file_data = first_packet.data;
-    }
-    else  {
-        // replace spaces in buffer
-        file_data.replace(loc, first_packet.data.size(), first_packet.data);
-    }
-    packets.erase(first_packet.packet_num);
-
-    // Construct a 'missing' file IDs string for the client.
-    // This will create an 'empty' missing message if we received all the
-    // packets needed, which will tell the client to move on to the next file
-    string missing = "M" + to_string(file_pilot.file_ID) + " ";
-    for (auto iter  = packets.begin(); iter != packets.end(); iter++) {
-        missing += to_string(*iter);
-        if (next(iter) != packets.end())
-            missing += " ";
-        //Don't overfill buffer!
-        if (missing.length() + MAX_FILENUM + 1 > 512)
-            break;
-    }
-    // Loop until there are no more packets left to be received
-    do {
-        while (!timedout) {
-            readlen = sock -> read(incoming_msg, sizeof(incoming_msg));
-            timedout = sock -> timedout();
-            if (timedout) {
-                continue;
-            }
-            if (readlen == 0) {
-                c150debug->printf(C150APPLICATION,"Read zero length message,"
-                                  " trying again");
-                continue;
-            }
-            incoming_msg[readlen] = '\0'; // make sure null terminated
-            string incoming(incoming_msg, readlen-1); // Convert to C++ string
-            c150debug->printf(C150APPLICATION,"Successfully read %d bytes."
-                              " Message=\"%s\"", readlen, incoming.c_str());
-            // Check that we got a File Pilot
-            if (incoming[0] == 'F') { 
-                FilePacket packet = unpackFilePacket(incoming);
-                // Check for correct file_ID
-                if (packet.file_ID == file_pilot.file_ID) {
-                    // Check if we need this packet
-                    if (packets.find(packet.packet_num) == packets.end())
-                        continue;
-                    // Add data to buffer
-                    int loc = packet.packet_num*PACKET_SIZE;
-                    // If this is the last packet of the file, insert at the
-                    // end of the string buffer
-                    if (packet.packet_num == file_pilot.num_packets-1)
-                        file_data.insert(loc, packet.data);
-                    else
-                        file_data.replace(loc, packet.data.size(), packet.data);
-                    // remove packet # from set to mark that we recevied it
-                    packets.erase(packet.packet_num);
-                    // Re-create 'missing' string
-                    missing = "M" + to_string(file_pilot.file_ID) + " ";
-                    for (auto iter = packets.begin(); iter != packets.end(); iter++) {
-                        missing += to_string(*iter);
-                        if (next(iter) != packets.end())
-                            missing += " ";
-                        //Don't overfill buffer!
-                        if (missing.length() + MAX_FILENUM + 1 > 512)
-                            break;
-                    }
-                }
-            }
-        } //we timed out, so client is done sending packets (for now)
-        c150debug->printf(C150APPLICATION,"Responding with message=\"%s\"",
-                          missing.c_str());
-        if (num_tries > 0)
-            *GRADING << "File: " << file_pilot.fname <<
-                        " asking client to resend packets " << missing.front()
-                        << " through " << missing.back() << endl;
-
-        sock -> write(missing.c_str(), missing.length()+1);
-        // Reset timeout value after sending 'missing' message
-        timedout = false;
-        num_tries++;
-
-    } while (!packets.empty()); // we have received data for all packets in this file
-
-    // Wait for confirmation that client knows to move to the next file
-    missing = "M" + to_string(file_pilot.file_ID) + " "; //empty 'missing'
-    bool client_moved_on = false;
-    while (!client_moved_on) {
-        *GRADING << "Sending empty missing so client will move on\n";
-        readlen = sock -> read(incoming_msg, sizeof(incoming_msg));
-        timedout = sock -> timedout();
-        if (timedout) {
-            c150debug->printf(C150APPLICATION,"Responding with message=\"%s\"",
-                              missing.c_str());
-            sock -> write(missing.c_str(), missing.length()+1);
-            continue;
-        }
-        if (readlen == 0) {
-            c150debug->printf(C150APPLICATION,"Read zero length message,"
-                              " trying again");
-            c150debug->printf(C150APPLICATION,"Responding with message=\"%s\"",
-                              missing.c_str());
-            sock -> write(missing.c_str(), missing.length()+1);
-            continue;
-        }
-        incoming_msg[readlen] = '\0'; // make sure null terminated
-        string incoming(incoming_msg, readlen-1); // Convert to C++ string
-        c150debug->printf(C150APPLICATION,"Successfully read %d bytes."
-                          " Message=\"%s\"", readlen, incoming.c_str());
-        // Check that message is a FilePilot for the next file, or else a
-        // message that it's time for the E2E check
-        // If either, we can discard it because multiple copies/retries will come
-        // down the pipeline.
-        if (incoming[0] == 'P') {
-            FilePilot nextfp = unpackFilePilot(incoming);
-            if (nextfp.file_ID == file_pilot.file_ID + 1)
-                client_moved_on = true;
-        }
-        else if (incoming == "E2E Ready") {
-            client_moved_on = true;
-        }
-        else {
-            c150debug->printf(C150APPLICATION,"Responding with message=\"%s\"",
-                              missing.c_str());
-            sock -> write(missing.c_str(), missing.length()+1);
-        }
-    }
-
-    *GRADING << "File: " << file_pilot.fname << ", client move-on confirmed.\n"
-                "File: " << file_pilot.fname << " received, beginning "
-                "server-side internal check." << endl;
-
-    if (!internalE2E(file_data, file_pilot, filehash)) {
-        failed_e2es.push_back(to_string(file_pilot.file_ID));
-        *GRADING << "File: " << file_pilot.fname
-                             << " server-side internal check failed\n";
-    }
-    else {
-        *GRADING << "File: " << file_pilot.fname
-                             << " server-side internal check succeeded\n";
-    }
-}
-
-/*
- * internalE2E
- * Runs an internal check to see if the hash of a written file matches the hash
- * given to us by the client originally.
- *
- * Args:
- * * file_data: buffer of data to write to disk
- * * file_pilot: corresponding FilePilot    
- * * filehash: map of filenames to checksums, updated according to what is
- *             written to disk
- *
- *  Returns: Boolean indicating whether the hash of the written file equals
- *  what the client says it should
- */
-bool internalE2E(string file_data, FilePilot file_pilot,
-                map<string, string> &filehash)
-{
-    bool internal_e2e_succeeded = false;
-    void *fopenretval;
-    size_t len;
-    int num_tries = 0;
-    while (!internal_e2e_succeeded && (num_tries < MAX_WRITE_TRIES)) {
-
-        //
-        // Write the file using nastyfile interface
-        //
-        NASTYFILE outputFile(FILE_NASTINESS);
-        string TMPname = file_pilot.fname + ".TMP";
-        string full_TMPname = makeFileName(TARGET_DIR.c_str(), TMPname);
-
-        // do an fopen on the output file
-        fopenretval = outputFile.fopen(full_TMPname.c_str(), "wb");  
-
-        if (fopenretval == NULL) {
-          cerr << "Error opening output file " << full_TMPname << 
-                  " errno=" << strerror(errno) << endl;
-          exit(12);
-        }
-      
-        // Write the whole file
-        size_t num_bytes = file_data.size();
-        len = outputFile.fwrite(file_data.c_str(), 1, num_bytes);
-        if (len != num_bytes) {
-          *GRADING << "Error writing file " << full_TMPname << 
-                  "  errno=" << strerror(errno) << endl;
-          cerr << "Error writing file " << full_TMPname << 
-                  "  errno=" << strerror(errno) << endl;
-          num_tries++;
-          continue;
-
-        }
-        // Close after writing
-        if (outputFile.fclose() != 0) {
-          *GRADING << "Error closing file " << full_TMPname << 
-                  "  errno=" << strerror(errno) << endl;
-          cerr << "Error closing file " << full_TMPname << 
-                  "  errno=" << strerror(errno) << endl;
-          num_tries++;
-          continue;
-        }
-
-        *GRADING << "Wrote " << full_TMPname << 
-            ", size " << len << " bytes" << endl;
-
-        // check if getFileHash == what we expect from file_pilot
-        // if not, try writing/checking again.
-        size_t read_size;
-        unsigned char target_file_hash[SHA1_LEN];
-        char * free_me = getFileChecksum(TARGET_DIR.c_str(), TMPname,
-                                         read_size, target_file_hash);
-        //free malloc'd data
-        free(free_me);
-
-        if (read_size != num_bytes) {
-            *GRADING << "Error reading file " << file_pilot.fname << 
-                    " after writing to disk." << endl;
-            cerr << "Error reading file " << file_pilot.fname << 
-                    " after writing to disk." << endl;
-            num_tries++;
-            continue;
-        }
-
-        // Add checksum to table, regardless of whether it is correct.
-        // This will be used later on for a full E2E directory check
-        filehash[file_pilot.fname] =
-                        string((const char *)target_file_hash, SHA1_LEN-1);
-
-        unsigned char expected_hash[SHA1_LEN];
-        memcpy(expected_hash, file_pilot.hash.c_str(), SHA1_LEN);
-        // Compare hash of written file and hash from FilePilot
-        bool write_success = cmpChecksums(target_file_hash, expected_hash);
-        if (write_success) {
-            string total = makeFileName(TARGET_DIR.c_str(), file_pilot.fname);
-            int result = rename(full_TMPname.c_str(), total.c_str());
-            if (result != 0) {
-                string msg = "Error renaming file " + full_TMPname;
-                perror(msg.c_str());
-                *GRADING << msg << endl;
-            }
-            else 
-            // NEEDSWORK if we fail to rename the file, we will not report to
-            // the client that the e2e check was successful. However, the .TMP
-            // fille will techincally be correct.
-            internal_e2e_succeeded = true;
-        }
-        else {
-            num_tries++;
-            continue;
-        }
-    } // tried & failed too many times
-    return internal_e2e_succeeded;
-}
-
-/*
- * sendE2E
- * Get directory hash of the fully written target dir, and compare with
- * the value originally received from client. Report to client if we succeeded
- * or failed, and include the number of failed files if we failed.
- * Args:
- * * sock: socket connection with the client
- * * filehash: map of filename -> checksum of files as they are written in
- *             target directory
- * * dir_pilot: original directory pilot received from client. Contains number
- *              of files in source directory and the source directory hash
- *
- * Returns: None
- */
-void sendE2E(C150NastyDgmSocket *sock, vector<string> failed,
-             map<string, string> filehash, DirPilot dir_pilot)
-{
-    // Get Directory hash of the fully written 
-    string target_hash_str = getDirHash(filehash);
-    unsigned char target_dir_hash[SHA1_LEN];
-    memcpy(target_dir_hash, target_hash_str.c_str(), SHA1_LEN);
-
-    unsigned char source_dir_hash[SHA1_LEN];
-    memcpy(source_dir_hash, dir_pilot.hash.c_str(), SHA1_LEN);
-    // Compare dir hashes
-    bool success = cmpChecksums(target_dir_hash, source_dir_hash);
-
-    string response = "E2E";
-
-    if (success) {
-        *GRADING << "Server-side: End-to-end directory check successful\n";
-        response += "S";
-    }
-    else {
-        *GRADING << "Server-side: End-to-end directory check failed\n";
-        response += "F" + to_string(failed.size()) + " ";
-        for (auto iter = failed.begin(); iter != failed.end(); iter++)
-        {
-            response += *iter;
-            if (next(iter) != failed.end())
-                response += " ";
-        }
-    }
-        
-    bool e2e_received = false;
-    ssize_t readlen;
-    char incoming_msg[512];
-
-    // Loop until we receive confirmation from client that E2E was received
-    while(!e2e_received) {
-        *GRADING << "Sending E2E response to client\n";
-        c150debug->printf(C150APPLICATION,"Responding with e2e message=\"%s\"",
-                                      response.c_str());
-        // Send E2E message
-        sock->write(response.c_str(), response.length()+1);
-        readlen = sock -> read(incoming_msg, sizeof(incoming_msg));
-        if (readlen == 0) {
-            c150debug->printf(C150APPLICATION,"Read zero length message,"
-                              " trying again");
-            continue;
-        }
-        incoming_msg[readlen] = '\0'; // make sure null terminated
-        string incoming(incoming_msg, readlen-1); // Convert to C++ string
-        if (incoming == "E2E received")
-            e2e_received = true;
-        
-    }
-    *GRADING << "E2E confirmed by client\n";
-}
+// --------------------------------------------------------------
+//
+//                        filecopyserver.cpp
+//
+//        Authors: Lucas Campbell and Dylan Hoffmann
+//
+//
+//
+//        COMMAND LINE
+//
+//          fileserver <networknastiness> <filenastiness> <targetdir>
+//                     [-j <workers>] [-w <writers>] [-c <cachefile>]
+//                     [-s <chunkdir>] [-m <megabytes>] [-d]
+//
+//              -j: number of threads used to hash the files already in
+//                  the target directory (default: one per core)
+//              -w: number of threads that write and check received
+//                  files (default: 4)
+//              -c: file in which to keep the checksums of target files
+//                  between runs
+//              -s: directory in which to keep the chunks of files sent
+//                  by clients that chunk them, so later sessions need
+//                  not send them again
+//              -m: size the chunk store is kept to (default: 1024)
+//              -d: keep serving clients, rather than exiting once the
+//                  first one is done
+//
+//
+//        OPERATION
+//
+//              Filecopy server will wait until receiving a directory
+//              pilot packet, set up the file environment, and then
+//              begin receiving file specific packets. Each directory
+//              pilot starts a session, and every packet either way is
+//              tagged with its session id, so the transfers of many
+//              clients can be interleaved: every packet is answered as
+//              it arrives, from the state kept for its session. Packets
+//              of a session that has ended are dropped unread. A client
+//              may name a subdirectory of the target to copy into. The
+//              files of a session are tracked by ID, so they may be sent
+//              and finish in any order.
+//              Hashing the target, writing and checking each received
+//              file, journaling its packets and reading an older copy
+//              of it to offer a delta against are left to worker
+//              threads, so the network is never kept waiting on the
+//              disk: a client moves on to its next file while the last
+//              is written.
+//              Files already present
+//              in the target with the hash the client announces are not
+//              sent again, and neither are files whose contents the target
+//              holds under another name: those are copied locally. As
+//              each packet
+//              will be numbered it will ignore any duplicates it
+//              receives and fill in the file data as packets arrive.
+//              Packets of large files are also saved in the target as
+//              <file>.PART and <file>.JRNL, so a server restarted after
+//              a crash resumes those files instead of starting over.
+//              Once the server has received all packets for all files, it
+//              performs a directory-level end-to-end check and sends the
+//              result back to the client when it asks.
+//
+//
+//        LIMITATIONS
+//
+//              Works with file nastiness level up to 4 and network nastiness
+//              level up to 4. A session whose client has been quiet for
+//              a minute is dropped, though its partly received files
+//              stay journaled. There is a single socket: the comp150 library
+//              answers whoever sent the last packet read, so every
+//              answer is sent from the thread that read it before the
+//              next read, and all sessions are served by that thread.
+//              The library does not tell us who sent a packet either,
+//              so sessions are known by their tag alone, not by the
+//              client's address: anyone who guesses or overhears a
+//              session's tag can send packets into it, or end it.
+//
+//     
+// --------------------------------------------------------------
+
+#include "c150nastydgmsocket.h"
+#include "c150nastyfile.h"
+#include "c150debug.h"
+#include "utils.h"
+#include "protocol.h"
+#include "threadpool.h"
+#include "hashcache.h"
+#include "delta.h"
+#include "journal.h"
+#include "chunks.h"
+#include "compression.h"
+#include "sparse.h"
+#include "session.h"
+#include "ring.h"
+#include "packetpool.h"
+#include "shard.h"
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <set>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>         // for FICLONE
+
+
+using namespace std;          // for C++ std library
+using namespace C150NETWORK;  // for all the comp150 utilities 
+
+// Forward declarations
+void setUpDebugLogging(const char *logname, int argc, char *argv[]);
+void parseOptions(int argc, char *argv[]);
+void answerPacket(C150NastyDgmSocket *sock, ShardPacket &packet);
+void tendShard(Shard &shard, time_t &last_expired);
+void servePacket(Shard &shard, ShardPacket &packet);
+Session *startSession(uint64_t id, string incoming);
+void endSession(SessionTable &sessions, uint64_t id);
+void expireSessions(SessionTable &sessions);
+void queueDiskJob(Session &session, DiskJob job);
+void startDiskJob(Session &session);
+void finishDiskJobs(Shard &shard);
+void sendPacket(vector<Reply> &replies, const Session &session,
+                const string &packet);
+void handlePacket(vector<Reply> &replies, Session &session,
+                  string incoming);
+string dirPilotResponse(Session &session);
+string handleFilePilot(Session &session, string incoming);
+string startReceipt(Session &session, FilePilot file_pilot);
+void prepareReceipt(FilePreparation &prep, const string &target_dir,
+                    bool journaled, bool has_base);
+void fileDone(Session &session, FilePilot file_pilot);
+void startReassembly(FilePilot file_pilot, string &file_data,
+                     set<int> &packets);
+void sendRequestedPackets(vector<Reply> &replies, const Session &session,
+                          string request, int ID, const string &data);
+void handleFilePacket(Session &session, const char *incoming, size_t len);
+string handleQuery(Session &session, string incoming);
+void finishReceipt(Session &session, FileReceipt *receipt);
+void queueFileWrite(Session &session, FileReceipt *receipt,
+                    const unsigned char (&data_hash)[SHA1_LEN]);
+string makeMissing(int file_ID, const set<int> &packets);
+void saveToJournal(Session &session, FileReceipt *receipt);
+void discardJournal(Session &session, ReceiveJournal *journal);
+bool finishFile(const string &target_dir, ChunkIndex *chunks,
+                string &file_data, unsigned char (&data_hash)[SHA1_LEN],
+                FilePilot file_pilot, const string &base_data,
+                size_t block_size, string &written_hash);
+void hashInOrderPackets(ChecksumContext &received_hash, int &hashed_packets,
+                        const set<int> &packets, const string &file_data,
+                        int num_packets);
+bool writeVerifiedBlocks(NASTYFILE &outputFile, const string &file_data,
+                         string full_TMPname);
+bool internalE2E(const string &file_data, FilePilot file_pilot,
+                 const string &target_dir, string &written_hash);
+bool copyWithinTarget(FilePilot file_pilot, Session &session);
+bool copyFromSources(const string &target_dir, FilePilot file_pilot,
+                     const vector<string> &sources, string &written_hash);
+bool cloneFile(string src_path, string dst_path);
+string makeE2EResponse(Session &session);
+
+
+/********** Global Constants **********/
+const int NETWORK_NASTINESS_ARG = 1;
+const int FILE_NASTINESS_ARG = 2;
+const int TARGET_ARG = 3;
+const int OPTIONS_ARG = 4;        // optional flags start after the target
+extern int NETWORK_NASTINESS;
+extern int FILE_NASTINESS;
+// max number of attempts to write file to disk
+const int MAX_WRITE_TRIES = 5; 
+// size of the pieces a file is written and read back in by internalE2E
+const size_t VERIFY_BLOCK_SIZE = 64 * 1024;
+const int TIMEOUT_MS = 300;       //ms for timeout
+string TARGET_DIR;
+int HASH_WORKERS = defaultWorkerCount(); // threads for target dir hashing
+int DISK_WORKER_COUNT = 4;       // threads for writing received files
+ThreadPool *DISK_WORKERS = NULL;
+const char *CACHE_FILE = NULL;   // checksum cache, if one was asked for
+ChecksumCache *CACHE = NULL;
+const char *CHUNK_STORE_DIR = NULL;  // chunk store, if one was asked for
+uint64_t CHUNK_STORE_MB = 1024;      // size the chunk store is kept to
+ChunkStore *CHUNK_STORE = NULL;
+bool DAEMON = false;             // keep serving after the first client
+PacketPool PACKET_POOL;          // buffers packets are built in, before
+                                 // the shard holding them
+Shard SHARD;                     // the sessions we serve
+// whether any session has started, as we only serve one unless DAEMON
+bool SERVED = false;
+int LIVE_SESSIONS = 0;           // sessions in progress
+// seconds a client may go quiet before we give up on its session
+const int SESSION_IDLE_SECONDS = 60;
+// files of one session that may be waiting to be written before we stop
+// answering pilots for more, which bounds the memory they take
+const size_t MAX_QUEUED_FILES = 4;
+// files of one session that may be partly received, or getting ready to
+// be, at once, each holding a reassembly buffer
+const size_t MAX_OPEN_FILES = 8;
+
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                           main program
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+ 
+int
+main(int argc, char *argv[])
+{
+    GRADEME(argc, argv);
+
+    //
+    // Check command line and parse arguments
+    //
+    if (argc < 4)  {
+        fprintf(stderr,"Correct syntax is: %s <network nastiness>"
+                        "<file nastiness> <target directory>"
+                        " [-j <workers>] [-w <writers>] [-c <cachefile>]"
+                        " [-s <chunkdir>] [-m <megabytes>] [-d]\n",
+                        argv[0]);
+        exit(1);
+    }
+    if (strspn(argv[NETWORK_NASTINESS_ARG], "0123456789") != 
+        strlen(argv[NETWORK_NASTINESS_ARG])) {
+        fprintf(stderr,"Nastiness %s is not numeric\n",
+                argv[NETWORK_NASTINESS_ARG]);     
+        fprintf(stderr,"Correct syntax is: %s <network nastiness>"
+                        "<file nastiness> <target directory>\n", argv[0]);
+        exit(4);
+    }
+    if (strspn(argv[FILE_NASTINESS_ARG], "0123456789") !=
+        strlen(argv[FILE_NASTINESS_ARG])) {
+        fprintf(stderr,"Nastiness %s is not numeric\n",
+                argv[FILE_NASTINESS_ARG]);     
+        fprintf(stderr,"Correct syntax is: %s <network nastiness>"
+                        "<file nastiness> <target directory>\n", argv[0]);
+        exit(4);
+    }
+    //
+    // Variable declarations
+    //
+    ssize_t readlen;             // amount of data read from socket
+    ShardPacket packet;          // packet read, for the shard it is for
+    // convert command line args
+    NETWORK_NASTINESS = atoi(argv[NETWORK_NASTINESS_ARG]);   
+    FILE_NASTINESS = atoi(argv[FILE_NASTINESS_ARG]);   
+    TARGET_DIR = string(argv[TARGET_ARG]);
+    parseOptions(argc, argv);
+       
+    //
+    //  Set up debug message logging
+    //
+    setUpDebugLogging("filecopyserverdebug.txt",argc, argv);
+
+    //
+    // Make sure the target directory is there before taking clients
+    //
+    DIR *TRG = opendir(TARGET_DIR.c_str());
+    if (TRG == NULL) {
+        fprintf(stderr,"Error opening source directory %s\n",
+                TARGET_DIR.c_str());
+        exit(8);
+    }
+    closedir(TRG);
+    if (CACHE_FILE != NULL)
+        CACHE = new ChecksumCache(CACHE_FILE);
+    if (CHUNK_STORE_DIR != NULL) {
+        CHUNK_STORE = new ChunkStore(CHUNK_STORE_DIR,
+                                     CHUNK_STORE_MB * 1024 * 1024);
+        *GRADING << "Chunk store holds "
+                 << CHUNK_STORE->summary().size() / CHUNK_SUMMARY_LEN
+                 << " chunks\n";
+    }
+
+    //
+    // We set a debug output indent in the server only, not the client.
+    // That way, if we run both programs and merge the logs this way:
+    //
+    //    cat pingserverdebug.txt pingserverclient.txt | sort
+    //
+    // it will be easy to tell the server and client entries apart.
+    //
+    // Note that the above trick works because at the start of each
+    // log entry is a timestamp that sort will indeed arrange in 
+    // timestamp order, thus merging the logs by time across 
+    // server and client.
+    //
+    c150debug->setIndent("    ");       // if we merge client and server
+                                        // logs, server stuff will be indented
+
+    
+    //
+    // Create socket, loop receiving and responding
+    //
+    try {
+        *GRADING << "Creating C150NastyDgmSocket(nastiness=" <<
+            NETWORK_NASTINESS << ")" << endl;
+        c150debug->printf(C150APPLICATION,"Creating "
+                          "C150NastyDgmSocket(nastiness=%d)",
+                          NETWORK_NASTINESS);
+        C150NastyDgmSocket *sock = new C150NastyDgmSocket(NETWORK_NASTINESS);
+        *GRADING << "Ready to accept messages\n";
+        c150debug->printf(C150APPLICATION,"Ready to accept messages");
+
+        // Timeout of .3 seconds, so we notice when the last session ends
+        sock -> turnOnTimeouts(TIMEOUT_MS);
+        DISK_WORKERS = new ThreadPool(DISK_WORKER_COUNT);
+        time_t last_expired = 0;
+
+        //
+        // Every packet goes to the session it is tagged with, and every
+        // answer is sent before the next read, so it goes to the client
+        // that asked. Serve until the client is done, or forever if we
+        // are a daemon.
+        //
+        while (DAEMON || !SERVED || LIVE_SESSIONS > 0) {
+            readlen = sock -> read(packet.data, PACKET_BUFFER_SIZE-1);
+            // Bring in the disk work done between reads
+            tendShard(SHARD, last_expired);
+            if (sock -> timedout())
+                continue;
+            if (readlen == 0) {
+                lock_guard<recursive_mutex> guard(GRADING_LOCK);
+                c150debug->printf(C150APPLICATION,"Read zero length message,"
+                                  " trying again");
+                continue;
+            }
+            packet.data[readlen] = '\0'; // make sure null terminated
+            packet.len = readlen-1;      // without the null
+            if (!readSessionTag(packet.data, packet.len, packet.session_id) ||
+                packet.len == (size_t)SESSION_TAG_LEN)
+                continue;
+            answerPacket(sock, packet);
+        }
+
+        delete DISK_WORKERS;
+        *GRADING << flush;
+        delete sock;
+
+    }
+
+    catch (C150NetworkException& e) {
+        // Write to debug log
+        c150debug->printf(C150ALWAYSLOG,"Caught C150NetworkException: %s\n",
+                          e.formattedExplanation().c_str());
+        // In case we're logging to a file, write to the console too
+        cerr << argv[0] << ": caught C150NetworkException: "
+             << e.formattedExplanation() << endl;
+    }
+
+    // This only executes if there was an error caught above
+    return 4;
+}
+
+
+
+/*
+ * parseOptions
+ * Read the optional flags that follow the target directory on the command
+ * line, setting the corresponding globals. Exits on an unrecognized flag.
+ * Args:
+ * * argc, argv: command line arguments to the program
+ *
+ * Returns: None
+ */
+void parseOptions(int argc, char *argv[])
+{
+    for (int i = OPTIONS_ARG; i < argc; i++) {
+        string flag = argv[i];
+        if (flag == "-j" && i+1 < argc &&
+            strspn(argv[i+1], "0123456789") == strlen(argv[i+1])) {
+            HASH_WORKERS = atoi(argv[++i]);
+        }
+        else if (flag == "-w" && i+1 < argc &&
+                 strspn(argv[i+1], "0123456789") == strlen(argv[i+1])) {
+            DISK_WORKER_COUNT = atoi(argv[++i]);
+        }
+        else if (flag == "-c" && i+1 < argc) {
+            CACHE_FILE = argv[++i];
+        }
+        else if (flag == "-s" && i+1 < argc) {
+            CHUNK_STORE_DIR = argv[++i];
+        }
+        else if (flag == "-m" && i+1 < argc &&
+                 strspn(argv[i+1], "0123456789") == strlen(argv[i+1])) {
+            CHUNK_STORE_MB = atoll(argv[++i]);
+        }
+        else if (flag == "-d") {
+            DAEMON = true;
+        }
+        else {
+            fprintf(stderr,"Unrecognized option %s\n", argv[i]);
+            fprintf(stderr,"Correct syntax is: %s <network nastiness>"
+                            "<file nastiness> <target directory>"
+                            " [-j <workers>] [-w <writers>] [-c <cachefile>]"
+                            " [-s <chunkdir>] [-m <megabytes>] [-d]\n",
+                            argv[0]);
+            exit(1);
+        }
+    }
+}
+
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+//
+//                     setUpDebugLogging
+//
+//        For COMP 150-IDS, a set of standards utilities
+//        are provided for logging timestamped debug messages.
+//        You can use them to write your own messages, but 
+//        more importantly, the communication libraries provided
+//        to you will write into the same logs.
+//
+//        As shown below, you can use the enableLogging
+//        method to choose which classes of messages will show up:
+//        You may want to turn on a lot for some debugging, then
+//        turn off some when it gets too noisy and your core code is
+//        working. You can also make up and use your own flags
+//        to create different classes of debug output within your
+//        application code
+//
+//        NEEDSWORK: should be factored and shared w/pingclient
+//        NEEDSWORK: document arguments
+//
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - 
+ 
+void setUpDebugLogging(const char *logname, int argc, char *argv[]) {
+
+    //   
+    //           Choose where debug output should go
+    //
+    // The default is that debug output goes to cerr.
+    //
+    // Uncomment the following three lines to direct
+    // debug output to a file. Comment them to 
+    // default to the console
+    //  
+    // Note: the new DebugStream and ofstream MUST live after we return
+    // from setUpDebugLogging, so we have to allocate
+    // them dynamically.
+    //
+    //
+    // Explanation: 
+    // 
+    //     The first line is ordinary C++ to open a file
+    //     as an output stream.
+    //
+    //     The second line wraps that will all the services
+    //     of a comp 150-IDS debug stream, and names that filestreamp.
+    //
+    //     The third line replaces the global variable c150debug
+   //     and sets it to point to the new debugstream. Since c150debug
+    //     is what all the c150 debug routines use to find the debug stream,
+    //     you've now effectively overridden the default.
+    //
+    ofstream *outstreamp = new ofstream(logname);
+    DebugStream *filestreamp = new DebugStream(outstreamp);
+    DebugStream::setDefaultLogger(filestreamp);
+
+
+    //
+    //  Put the program name and a timestamp on each line of the debug log.
+    //
+    c150debug->setPrefix(argv[0]);
+    c150debug->enableTimestamp(); 
+
+    //
+    // Ask to receive all classes of debug message
+    //
+    // See c150debug.h for other classes you can enable. To get more than
+    // one class, you can or (|) the flags together and pass the combined
+    // mask to c150debug -> enableLogging 
+    //
+    // By the way, the default is to disable all output except for
+    // messages written with the C150ALWAYSLOG flag. Those are typically
+    // used only for things like fatal errors. So, the default is
+    // for the system to run quietly without producing debug output.
+    //
+    c150debug->enableLogging(C150APPLICATION | C150NETWORKTRAFFIC | 
+                             C150NETWORKDELIVERY); 
+}
+
+/*
+ * answerPacket
+ * Serve a packet and send whatever answers it, before the next read so
+ * they go to the client that sent it
+ *
+ * Args:
+ * * sock: Nasty socket the packet was read from
+ * * packet: the packet
+ *
+ * Returns: None
+ */
+void answerPacket(C150NastyDgmSocket *sock, ShardPacket &packet)
+{
+    servePacket(SHARD, packet);
+    for (size_t i = 0; i < SHARD.replies.size(); i++)
+        sock -> write(SHARD.replies[i].buffer.data(), SHARD.replies[i].len);
+    SHARD.replies.clear();
+}
+
+/*
+ * tendShard
+ * Bring in the disk work done for the shard's sessions, and about once a
+ * second end those that have gone quiet
+ *
+ * Args:
+ * * shard: the shard
+ * * last_expired: when sessions were last checked for expiry, updated
+ *
+ * Returns: None
+ */
+void tendShard(Shard &shard, time_t &last_expired)
+{
+    finishDiskJobs(shard);
+    if (time(NULL) != last_expired) {
+        lock_guard<recursive_mutex> guard(GRADING_LOCK);
+        expireSessions(shard.sessions);
+        last_expired = time(NULL);
+    }
+}
+
+/*
+ * servePacket
+ * Serve a packet of one of the shard's sessions, starting the session if
+ * the packet is a DirPilot. Answers are left in the shard's replies.
+ *
+ * Args:
+ * * shard: the shard
+ * * packet: the packet
+ *
+ * Returns: None
+ */
+void servePacket(Shard &shard, ShardPacket &packet)
+{
+    SessionTable &sessions = shard.sessions;
+    uint64_t session_id = packet.session_id;
+    const char *body = packet.data + SESSION_TAG_LEN;
+    size_t body_len = packet.len - SESSION_TAG_LEN;
+    auto found = sessions.live.find(session_id);
+
+    // Data, the bulk of what arrives, goes straight from the buffer into
+    // place, without waiting on anyone's logging
+    if (body[0] == 'F') {
+        if (found == sessions.live.end())
+            return;
+        Session &session = *found->second;
+        session.last_heard = time(NULL);
+        if (session.ready)
+            handleFilePacket(session, body, body_len);
+        return;
+    }
+
+    // Workers log only while we are not
+    lock_guard<recursive_mutex> guard(GRADING_LOCK);
+    c150debug->printf(C150APPLICATION,"Successfully read %d bytes."
+                      " Message=\"%s\"", (int)packet.len+1, packet.data);
+    // Packets of sessions we are done with are dropped before anything
+    // else is made of them
+    if (sessions.ended.count(session_id) != 0)
+        return;
+    if (found == sessions.live.end()) {
+        // Only a DirPilot starts a session, and unless we are a daemon
+        // only the first client's does
+        if (body[0] != 'D' || (!DAEMON && SERVED))
+            return;
+        Session *session = startSession(session_id, string(body, body_len));
+        if (session == NULL)
+            return;             // leave the way open for a better pilot
+        SERVED = true;
+        LIVE_SESSIONS++;
+        found = sessions.live.insert(make_pair(session_id, session)).first;
+    }
+    Session &session = *found->second;
+    session.last_heard = time(NULL);
+    // Nothing can be answered until we know what the target holds
+    if (!session.ready)
+        return;
+    string incoming(body, body_len);
+    // Client has our end-to-end answer, so we are done with it
+    if (incoming == "E2E received") {
+        if (!session.e2e_response.empty()) {
+            *GRADING << "E2E confirmed by client\n";
+            endSession(sessions, session_id);
+        }
+        return;
+    }
+    handlePacket(shard.replies, session, incoming);
+}
+
+/*
+ * startSession
+ * Set up a session for a client that sent us a DirPilot: work out where
+ * its files go and queue hashing what is already there, so files it would
+ * send unchanged can be skipped. The session is ready once that is done.
+ *
+ * Args:
+ * * id: session id the client tags its packets with
+ * * incoming: string with packetized DirPilot data
+ *
+ * Returns: the new session, or NULL if the target cannot be used
+ */
+Session *startSession(uint64_t id, string incoming)
+{
+    DirPilot dir_pilot = unpackDirPilot(incoming);
+    string target_dir = TARGET_DIR;
+    if (!dir_pilot.target.empty()) {
+        // Only a plain subdirectory name, nothing that climbs out of ours
+        if (dir_pilot.target.find('/') != string::npos ||
+            dir_pilot.target == "." || dir_pilot.target == "..") {
+            *GRADING << "Refusing target subdirectory " << dir_pilot.target
+                     << endl;
+            return NULL;
+        }
+        target_dir = makeFileName(TARGET_DIR, dir_pilot.target);
+        mkdir(target_dir.c_str(), 0755);  // fine if it is already there
+    }
+    DIR *TRG = opendir(target_dir.c_str());
+    if (TRG == NULL) {
+        fprintf(stderr,"Error opening target directory %s\n",
+                target_dir.c_str());
+        *GRADING << "Error opening target directory " << target_dir << endl;
+        return NULL;
+    }
+    *GRADING << "DirPilot received, starting session for " << target_dir
+             << endl;
+    closedir(TRG);
+    Session *session = new Session(id, target_dir, dir_pilot);
+
+    // Hashing a big target takes a while, let the client wait for it
+    auto existing = make_shared<map<string, string>>();
+    DiskJob hash_target;
+    hash_target.work = [existing, target_dir] {
+        DIR *TRG = opendir(target_dir.c_str());
+        if (TRG == NULL)
+            return;
+        fillChecksumTable(*existing, TRG, target_dir.c_str(), HASH_WORKERS,
+                          CACHE);
+        closedir(TRG);
+        if (CACHE != NULL)
+            CACHE->save();
+    };
+    hash_target.done = [existing](Session &session) {
+        session.existing.swap(*existing);
+        *GRADING << "Target directory holds " << session.existing.size()
+                 << " files before transfer\n";
+        for (auto iter = session.existing.begin();
+             iter != session.existing.end(); iter++)
+            session.by_hash.insert(make_pair(iter->second, iter->first));
+        session.ready = true;
+    };
+    queueDiskJob(*session, hash_target);
+
+    if (dir_pilot.encodings & ENCODING_CHUNKS) {
+        session->chunks = new ChunkIndex(target_dir, CHUNK_STORE);
+        if (CHUNK_STORE != NULL)
+            session->store_summary = CHUNK_STORE->summary();
+    }
+    return session;
+}
+
+/*
+ * endSession
+ * Forget a session, once its client is done or has gone away, keeping
+ * only a tombstone so its stragglers are dropped. A file it was partway
+ * through stays journaled, so a later session can resume it.
+ *
+ * Args:
+ * * sessions: the session table
+ * * id: the session to end
+ *
+ * Returns: None
+ */
+void endSession(SessionTable &sessions, uint64_t id)
+{
+    Session *session = sessions.live[id];
+    for (auto iter = session->receipts.begin();
+         iter != session->receipts.end(); iter++) {
+        delete iter->second->journal;
+        delete iter->second;
+    }
+    delete session->chunks;
+    delete session;
+    sessions.live.erase(id);
+    sessions.ended[id] = time(NULL);
+    // Nobody is using what we advertised any more, make room
+    if (--LIVE_SESSIONS == 0 && CHUNK_STORE != NULL)
+        CHUNK_STORE->trim();
+    *GRADING << flush;
+}
+
+/*
+ * expireSessions
+ * End the sessions whose client has not been heard from in
+ * SESSION_IDLE_SECONDS, once their disk work is done, and forget the
+ * tombstones of sessions that ended longer ago than that, as their
+ * clients have long since given up
+ *
+ * Args:
+ * * sessions: the session table
+ *
+ * Returns: None
+ */
+void expireSessions(SessionTable &sessions)
+{
+    time_t now = time(NULL);
+    for (auto iter = sessions.ended.begin(); iter != sessions.ended.end(); ) {
+        if (now - iter->second > SESSION_IDLE_SECONDS)
+            iter = sessions.ended.erase(iter);
+        else
+            iter++;
+    }
+    for (auto iter = sessions.live.begin(); iter != sessions.live.end(); ) {
+        uint64_t id = iter->first;
+        Session *session = iter->second;
+        iter++;
+        if (now - session->last_heard > SESSION_IDLE_SECONDS &&
+            session->disk_jobs.empty()) {
+            *GRADING << "Session for " << session->target_dir
+                     << " idle, dropping it\n";
+            endSession(sessions, id);
+        }
+    }
+}
+
+/*
+ * queueDiskJob
+ * Queue disk work for a session, starting it if nothing else of the
+ * session's is running
+ *
+ * Args:
+ * * session: the session the work is for
+ * * job: the work
+ *
+ * Returns: None
+ */
+void queueDiskJob(Session &session, DiskJob job)
+{
+    session.disk_jobs.push_back(job);
+    if (session.disk_jobs.size() == 1)
+        startDiskJob(session);
+}
+
+/*
+ * startDiskJob
+ * Hand the first disk job of a session to the workers, which report back
+ * through the shard's finished_jobs when it is done
+ *
+ * Args:
+ * * session: the session, with at least one job queued
+ *
+ * Returns: None
+ */
+void startDiskJob(Session &session)
+{
+    uint64_t id = session.id;
+    function<void()> work = session.disk_jobs.front().work;
+    DISK_WORKERS->submit([id, work] {
+        work();
+        while (!SHARD.finished_jobs.push(id))
+            this_thread::yield();
+    });
+}
+
+/*
+ * finishDiskJobs
+ * Bring the results of disk jobs the workers have finished into the
+ * sessions of the shard, and start each session's next job. Sessions are not
+ * ended while they have jobs, so each is still there.
+ *
+ * Args:
+ * * shard: the shard
+ *
+ * Returns: None
+ */
+void finishDiskJobs(Shard &shard)
+{
+    uint64_t finished[64];
+    size_t num_finished;
+    while ((num_finished = shard.finished_jobs.popBatch(finished, 64)) > 0) {
+        // Workers log only while we are not
+        lock_guard<recursive_mutex> guard(GRADING_LOCK);
+        for (size_t i = 0; i < num_finished; i++) {
+            Session &session = *shard.sessions.live[finished[i]];
+            session.disk_jobs.front().done(session);
+            session.disk_jobs.pop_front();
+            if (!session.disk_jobs.empty())
+                startDiskJob(session);
+        }
+    }
+}
+
+/*
+ * handlePacket
+ * Answer a packet other than data from the client of a session
+ *
+ * Args:
+ * * replies: where our answers are left to be sent
+ * * session: the client's session
+ * * incoming: the packet, without its session tag
+ *
+ * Returns: None
+ */
+void handlePacket(vector<Reply> &replies, Session &session,
+                  string incoming)
+{
+    string response;
+    // Client did not get our answer to its DirPilot
+    if (incoming[0] == 'D')
+        response = dirPilotResponse(session);
+    else if (incoming[0] == 'P')
+        response = handleFilePilot(session, incoming);
+    else if (incoming[0] == 'Q')
+        response = handleQuery(session, incoming);
+    // Client asking for delta signatures
+    else if (incoming[0] == 'G') {
+        auto found = session.receipts.find(atoi(incoming.c_str() + 1));
+        if (found != session.receipts.end() &&
+            !found->second->signatures.empty())
+            sendRequestedPackets(replies, session, incoming, found->first,
+                                 found->second->signatures);
+    }
+    // Client fetching the list of our chunk store
+    else if (incoming[0] == 'K')
+        sendRequestedPackets(replies, session, incoming, 0,
+                             session.store_summary);
+    else if (incoming == "E2E Ready")
+        response = makeE2EResponse(session);
+    if (response.empty())
+        return;
+    c150debug->printf(C150APPLICATION,"Responding with message=\"%s\"",
+                      response.c_str());
+    sendPacket(replies, session, response);
+}
+
+/*
+ * sendPacket
+ * Send a packet to the client of a session, tagged so the client can tell
+ * it from answers meant for other clients
+ *
+ * Args:
+ * * replies: where the packet is left to be sent
+ * * session: the client's session
+ * * packet: the packet, untagged
+ *
+ * Returns: None
+ */
+void sendPacket(vector<Reply> &replies, const Session &session,
+                const string &packet)
+{
+    PacketBuffer buffer = PACKET_POOL.get();
+    size_t len = min(packet.length(),
+                     PACKET_BUFFER_SIZE - SESSION_TAG_LEN - 1);
+    memcpy(buffer.data(), session.tag.data(), SESSION_TAG_LEN);
+    memcpy(buffer.data() + SESSION_TAG_LEN, packet.data(), len);
+    buffer.data()[SESSION_TAG_LEN + len] = '\0';
+    replies.push_back(Reply(move(buffer), SESSION_TAG_LEN + len + 1));
+}
+
+/*
+ * dirPilotResponse
+ * Args:
+ * * session: session started by the DirPilot
+ *
+ * Returns: our answer to it: "DPOK", followed by the number of packets the
+ *          list of our chunk store takes if the client chunks files and
+ *          there is anything in the store
+ */
+string dirPilotResponse(Session &session)
+{
+    string response = "DPOK";
+    if (!session.store_summary.empty())
+        response += " " +
+                    to_string(packetsNeeded(session.store_summary.size()));
+    return response;
+}
+
+/*
+ * handleFilePilot
+ * Answer a FilePilot. Files may be sent in any order, and several at
+ * once: a pilot for a file not yet started starts it, and one for a file
+ * being received is a repeat because the client did not get our answer,
+ * or a switch to another encoding. While MAX_OPEN_FILES files are partly
+ * received no more are started, nor while MAX_QUEUED_FILES wait to be
+ * written.
+ *
+ * A pilot for a file that failed our checks, which the client sends again
+ * once our end-to-end answer has told it so, takes the file up afresh.
+ *
+ * Files already present in the target with the hash the client announces
+ * are not sent again, and neither are files whose contents the target
+ * holds under another name: those are copied locally. Either way the
+ * pilot is answered with "FPHV<file_ID>". Otherwise see startReceipt.
+ *
+ * If we offered the client a delta (FPSG), it may take it up with a second
+ * pilot for the file with ENCODING_DELTA set, which we answer with FPOK.
+ * Likewise a client that chunks files may follow our FPOK with a second
+ * pilot with ENCODING_CHUNKS set, which we also answer with FPOK. A file
+ * with long runs of zeros may be sent again with ENCODING_SPARSE the same
+ * way. Any of these second pilots may add ENCODING_ZLIB, or a pilot with
+ * just ENCODING_ZLIB may follow FPOK or FPSG, if the client compresses
+ * what it sends.
+ *
+ * Args:
+ * * session: the client's session
+ * * incoming: string with packetized FilePilot data
+ *
+ * Returns: our answer, or an empty string if the pilot needs none
+ */
+string handleFilePilot(Session &session, string incoming)
+{
+    FilePilot file_pilot = unpackFilePilot(incoming);
+    int fID = file_pilot.file_ID;
+    // Still waiting on the disk workers to get ready for it
+    if (session.preparing.count(fID) > 0)
+        return "";
+    auto receiving = session.receipts.find(fID);
+    if (receiving != session.receipts.end()) {
+        FileReceipt *receipt = receiving->second;
+        // Once data has arrived the client knows our answer
+        if (receipt->started)
+            return "";
+        // The client took up our delta offer, or is sending a chunk list,
+        // or is leaving out the file's zero runs, any of which may be
+        // compressed, or is just compressing it
+        int base = file_pilot.encoding & ~ENCODING_ZLIB;
+        bool delta = (base == ENCODING_DELTA &&
+                      !receipt->signatures.empty());
+        bool chunks = (base == ENCODING_CHUNKS && session.chunks != NULL &&
+                       receipt->recovered == 0);
+        bool packed = ((base == 0 || base == ENCODING_SPARSE) &&
+                       file_pilot.encoding != 0 && receipt->recovered == 0);
+        if ((delta || chunks || packed) &&
+            receipt->file_pilot.encoding == 0) {
+            receipt->file_pilot = file_pilot;
+            startReassembly(file_pilot, receipt->file_data,
+                            receipt->packets);
+            // The journal was for the plain file
+            if (receipt->journal != NULL) {
+                discardJournal(session, receipt->journal);
+                receipt->journal = NULL;
+            }
+            receipt->response = "FPOK" + to_string(fID);
+        }
+        return receipt->response;
+    }
+    // Client sending again a file we failed, forget we ever had it
+    auto failed = find(session.failed_e2es.begin(), session.failed_e2es.end(),
+                       to_string(fID));
+    if (failed != session.failed_e2es.end()) {
+        *GRADING << "File: " << file_pilot.fname
+                 << " being sent again after failing\n";
+        session.failed_e2es.erase(failed);
+        session.received_files.erase(fID);
+        session.have_files.erase(fID);
+        session.e2e_response.clear();
+    }
+    // Client missed our answer for a file it can skip
+    if (session.received_files.count(fID) > 0) {
+        if (session.have_files.count(fID) > 0)
+            return "FPHV" + to_string(fID);
+        return "";
+    }
+    if (fID < 0 || fID >= session.dir_pilot.num_files)
+        return "";
+    // Let the disk catch up, and the files we have started finish, before
+    // taking on more
+    if (session.writing.size() >= MAX_QUEUED_FILES ||
+        session.receipts.size() + session.preparing.size() >= MAX_OPEN_FILES)
+        return "";
+
+    auto found = session.existing.find(file_pilot.fname);
+    if (found != session.existing.end() && found->second == file_pilot.hash) {
+        // Target already has this exact file, tell the client not to
+        // send it
+        *GRADING << "File: " << file_pilot.fname
+                 << " already in target, skipping\n";
+        session.filehash[file_pilot.fname] = file_pilot.hash;
+        session.have_files.insert(fID);
+        fileDone(session, file_pilot);
+        session.received_files.insert(fID);
+        return "FPHV" + to_string(fID);
+    }
+    // Same contents under another name, copy it here
+    if (copyWithinTarget(file_pilot, session)) {
+        session.have_files.insert(fID);
+        session.received_files.insert(fID);
+        return "FPHV" + to_string(fID);
+    }
+    return startReceipt(session, file_pilot);
+}
+
+/*
+ * startReceipt
+ * Get ready to receive a file the client has to send us.
+ *
+ * If the target already holds a different version of the file, the client
+ * is offered a delta: we answer the pilot with
+ * "FPSG<file_ID> <number of signature packets> <block size>" instead of
+ * FPOK, and send signature packets as the client asks for them with
+ * "G<file_ID> <packet #> <packet #>...".
+ *
+ * If an earlier run of the server journaled part of this version of the
+ * file, we pick up from there instead: the pilot is answered with
+ * "FPRS<file_ID> <missing packets>" and the client sends only those. If the
+ * journal holds the whole file it is finished right away and the pilot is
+ * answered with FPHV, as for a file the target already had.
+ *
+ * Looking for a journal and reading the older version are left to the
+ * disk workers (see prepareReceipt). Until they are done the pilot goes
+ * unanswered, and the client sends it again.
+ *
+ * Args:
+ * * session: the client's session
+ * * file_pilot: FilePilot of the file
+ *
+ * Returns: our answer to the pilot, or an empty string if it has to wait
+ */
+string startReceipt(Session &session, FilePilot file_pilot)
+{
+    *GRADING << "Received File Pilot for " << file_pilot.fname << endl;
+    FileReceipt *receipt = new FileReceipt(file_pilot);
+    startReassembly(file_pilot, receipt->file_data, receipt->packets);
+    int fID = file_pilot.file_ID;
+
+    bool journaled = (file_pilot.encoding == 0 &&
+                      file_pilot.num_packets >= JOURNAL_MIN_PACKETS);
+    bool has_base = (file_pilot.encoding == 0 &&
+                     session.existing.count(file_pilot.fname) > 0);
+    if (!journaled && !has_base) {
+        receipt->response = "FPOK" + to_string(fID);
+        session.receipts[fID] = receipt;
+        return receipt->response;
+    }
+
+    auto prep = make_shared<FilePreparation>(receipt);
+    string target_dir = session.target_dir;
+    DiskJob job;
+    job.work = [prep, target_dir, journaled, has_base] {
+        prepareReceipt(*prep, target_dir, journaled, has_base);
+    };
+    job.done = [prep, fID](Session &session) {
+        session.preparing.erase(fID);
+        if (prep->complete) {
+            session.have_files.insert(fID);
+            queueFileWrite(session, prep->receipt, prep->data_hash);
+        }
+        else
+            session.receipts[fID] = prep->receipt;
+    };
+    session.preparing.insert(fID);
+    queueDiskJob(session, job);
+    return "";
+}
+
+/*
+ * prepareReceipt
+ * The disk work of startReceipt: recover what an earlier run journaled of
+ * the file, and failing that read the target's older copy of it and make
+ * the signatures of a delta against it, then set the answer to the pilot.
+ * Run by a disk worker.
+ *
+ * Args:
+ * * prep: the file, its receipt filled in and its answer set. complete is
+ *         set if the journal held all of it.
+ * * target_dir: directory the file is received into
+ * * journaled: whether the file is big enough to be journaled
+ * * has_base: whether the target had a version of the file when hashed
+ *
+ * Returns: None
+ */
+void prepareReceipt(FilePreparation &prep, const string &target_dir,
+                    bool journaled, bool has_base)
+{
+    FileReceipt *receipt = prep.receipt;
+    FilePilot file_pilot = receipt->file_pilot;
+    string fID = to_string(file_pilot.file_ID);
+
+    // Pick up whatever an earlier run saved of this version of the file
+    if (journaled) {
+        receipt->journal = new ReceiveJournal(target_dir, file_pilot);
+        receipt->recovered = receipt->journal->recover(receipt->file_data,
+                                                       receipt->packets);
+    }
+    if (receipt->recovered > 0 && receipt->packets.empty()) {
+        computeChecksum((const unsigned char *)receipt->file_data.data(),
+                        receipt->file_data.size(), prep.data_hash);
+        if (string((const char *)prep.data_hash, SHA1_LEN-1) ==
+            file_pilot.hash.substr(0, SHA1_LEN-1)) {
+            lock_guard<recursive_mutex> guard(GRADING_LOCK);
+            *GRADING << "File: " << file_pilot.fname
+                     << " completed by an earlier run, finishing from "
+                        "journal\n";
+            prep.complete = true;
+            receipt->response = "FPHV" + fID;
+            return;
+        }
+        // Saved data adds up to the wrong file, start over
+        receipt->journal->discard();
+        delete receipt->journal;
+        receipt->journal = new ReceiveJournal(target_dir, file_pilot);
+        startReassembly(file_pilot, receipt->file_data, receipt->packets);
+        receipt->recovered = receipt->journal->recover(receipt->file_data,
+                                                       receipt->packets);
+    }
+    if (receipt->recovered > 0) {
+        lock_guard<recursive_mutex> guard(GRADING_LOCK);
+        *GRADING << "File: " << file_pilot.fname << " resuming with "
+                 << receipt->recovered << " of " << file_pilot.num_packets
+                 << " packets saved by an earlier run\n";
+    }
+
+    // An older version of the file big enough to be worth diffing against
+    if (has_base && receipt->recovered == 0) {
+        size_t base_size;
+        char *base = trustedFileRead(target_dir, file_pilot.fname,
+                                     base_size);
+        if (base_size >= DELTA_MIN_SIZE) {
+            receipt->base_data.assign(base, base_size);
+            receipt->block_size = chooseDeltaBlockSize(base_size);
+            receipt->signatures = makeSignatures(receipt->base_data,
+                                                 receipt->block_size);
+            lock_guard<recursive_mutex> guard(GRADING_LOCK);
+            *GRADING << "File: " << file_pilot.fname << " offering delta "
+                     "against existing copy, block size "
+                     << receipt->block_size << endl;
+        }
+        free(base);
+    }
+    receipt->response = "FPOK" + fID;
+    if (!receipt->signatures.empty()) {
+        int num_sig_packets = packetsNeeded(receipt->signatures.size());
+        receipt->response = "FPSG" + fID + " " + to_string(num_sig_packets) +
+                            " " + to_string(receipt->block_size);
+    }
+    else if (receipt->recovered > 0) {
+        receipt->response = "FPRS" + fID + " ";
+        receipt->response += makeRangeList(receipt->packets,
+                                           511 - SESSION_TAG_LEN -
+                                           receipt->response.length());
+    }
+}
+
+/*
+ * fileDone
+ * Record a file of a session as being in the target, so later files with
+ * the same contents can copy it
+ *
+ * Args:
+ * * session: the client's session
+ * * file_pilot: FilePilot of the file just finished
+ *
+ * Returns: None
+ */
+void fileDone(Session &session, FilePilot file_pilot)
+{
+    auto written = session.filehash.find(file_pilot.fname);
+    if (written != session.filehash.end() &&
+        written->second == file_pilot.hash)
+        session.by_hash.insert(make_pair(file_pilot.hash, file_pilot.fname));
+}
+
+/*
+ * startReassembly
+ * Set up an empty reassembly buffer for a file.
+ *
+ * Args:
+ * * file_pilot: FilePilot for the file
+ * * file_data: set to a buffer for all but the last packet, which may be
+ *              short and is inserted at the end when it arrives
+ * * packets: set to every packet number of the file
+ *
+ *  Returns: None
+ */
+void startReassembly(FilePilot file_pilot, string &file_data,
+                     set<int> &packets)
+{
+    file_data.assign((size_t)PACKET_SIZE*(file_pilot.num_packets-1), ' ');
+    packets.clear();
+    for (int i = 0; i < file_pilot.num_packets; i++)
+        packets.insert(packets.end(), i);
+}
+
+/*
+ * sendRequestedPackets
+ * Answer a client's request for data we offered it, sending each packet it
+ * lists with the same type as the request: 'G' for delta signatures, 'K'
+ * for the list of our chunk store.
+ *
+ * Args:
+ * * replies: where the packets are left to be sent
+ * * session: session of the client asking
+ * * request: "<type><ID> <packet #> <packet #>..."
+ * * ID: ID of the file we are currently receiving, 0 if not for a file
+ * * data: all of the data offered
+ *
+ *  Returns: None
+ */
+void sendRequestedPackets(vector<Reply> &replies, const Session &session,
+                          string request, int ID, const string &data)
+{
+    char *end;
+    if (strtol(request.c_str() + 1, &end, 10) != ID || *end != ' ')
+        return;
+    size_t space = end - request.c_str();
+    stringstream in(request.substr(space + 1));
+    int num_packets = packetsNeeded(data.size());
+    for (auto iter = istream_iterator<int, char>{in};
+         iter != istream_iterator<int, char>{}; iter++) {
+        if (*iter < 0 || *iter >= num_packets)
+            continue;
+        size_t offset = (size_t)*iter * PACKET_SIZE;
+        size_t len = min((size_t)PACKET_SIZE, data.size() - offset);
+        PacketBuffer packet = PACKET_POOL.get();
+        size_t packet_len = writeFilePacket(packet.data(), session.tag, *iter,
+                                            ID, data.data() + offset, len,
+                                            request[0]);
+        replies.push_back(Reply(move(packet), packet_len));
+    }
+}
+
+/*
+ * handleFilePacket
+ * Put a data packet of the file being received into its place, finishing
+ * the file if it was the last one missing
+ *
+ * Args:
+ * * session: the client's session
+ * * incoming: the FilePacket, untagged, in the buffer it was read into
+ * * len: its length
+ *
+ * Returns: None
+ */
+void handleFilePacket(Session &session, const char *incoming, size_t len)
+{
+    int packet_num, file_ID;
+    size_t data_start = readFilePacketHeader(incoming, len, packet_num,
+                                             file_ID);
+    if (data_start == 0)
+        return;
+    // Check that we are receiving the file, and need this packet
+    auto found = session.receipts.find(file_ID);
+    if (found == session.receipts.end())
+        return;
+    FileReceipt *receipt = found->second;
+    if (receipt->packets.count(packet_num) == 0)
+        return;
+    const char *data = incoming + data_start;
+    size_t data_len = len - data_start;
+    if (!receipt->started) {
+        lock_guard<recursive_mutex> guard(GRADING_LOCK);
+        *GRADING << "File: " << receipt->file_pilot.fname
+                 << " starting to receive file\n";
+        receipt->started = true;
+    }
+    // Add data to buffer. If this is the last packet of the file, insert
+    // at the end of the string buffer
+    size_t loc = (size_t)packet_num*PACKET_SIZE;
+    if (packet_num == receipt->file_pilot.num_packets-1)
+        receipt->file_data.insert(loc, data, data_len);
+    else
+        receipt->file_data.replace(loc, data_len, data, data_len);
+    // remove packet # from set to mark that we recevied it
+    receipt->packets.erase(packet_num);
+    hashInOrderPackets(receipt->received_hash, receipt->hashed_packets,
+                       receipt->packets, receipt->file_data,
+                       receipt->file_pilot.num_packets);
+    receipt->unsaved.push_back(packet_num);
+    if (receipt->unsaved.size() >= (size_t)JOURNAL_FLUSH_PACKETS)
+        saveToJournal(session, receipt);
+    if (receipt->packets.empty())
+        finishReceipt(session, receipt);
+}
+
+/*
+ * handleQuery
+ * Answer a client asking "Q<file_ID>" which packets of a file we still
+ * need, as it does after each burst of packets it sends
+ *
+ * Args:
+ * * session: the client's session
+ * * incoming: the query
+ *
+ * Returns: a 'missing' message for the file, empty once we have all of it
+ *          to tell the client to move on, or an empty string if the query
+ *          is garbled or for a file we have not started
+ */
+string handleQuery(Session &session, string incoming)
+{
+    // A garbled query gets no answer; the client will ask again
+    char *end;
+    int fID = strtol(incoming.c_str() + 1, &end, 10);
+    if (end == incoming.c_str() + 1 || *end != '\0')
+        return "";
+    auto found = session.receipts.find(fID);
+    if (found != session.receipts.end()) {
+        FileReceipt *receipt = found->second;
+        // The client is waiting on us, a good time to save what it sent
+        saveToJournal(session, receipt);
+        if (receipt->started)
+            *GRADING << "File: " << receipt->file_pilot.fname
+                     << " asking client to resend "
+                     << receipt->packets.size() << " packets\n";
+        return makeMissing(fID, receipt->packets);
+    }
+    if (session.received_files.count(fID) > 0)
+        return makeMissing(fID, set<int>());
+    return "";
+}
+
+/*
+ * finishReceipt
+ * Queue a file being received to be checked and written, now that every
+ * packet is in
+ *
+ * Args:
+ * * session: the client's session
+ * * receipt: the file's receipt
+ *
+ * Returns: None
+ */
+void finishReceipt(Session &session, FileReceipt *receipt)
+{
+    {
+        lock_guard<recursive_mutex> guard(GRADING_LOCK);
+        *GRADING << "File: " << receipt->file_pilot.fname << " received, "
+                    "beginning server-side internal check." << endl;
+    }
+
+    // Every packet is in, so the hash of what came over the network is
+    // complete. If it is already wrong, no number of disk writes will fix it.
+    unsigned char data_hash[SHA1_LEN];
+    receipt->received_hash.final(data_hash);
+    session.receipts.erase(receipt->file_pilot.file_ID);
+    queueFileWrite(session, receipt, data_hash);
+}
+
+/*
+ * queueFileWrite
+ * Hand a fully received file to the disk workers to be decoded, written
+ * and checked, and move the session on to its next file meanwhile. The
+ * outcome is recorded in the session once the write is done.
+ *
+ * Args:
+ * * session: the client's session
+ * * receipt: the file's receipt, no longer the session's
+ * * data_hash: hash of the file's data as received
+ *
+ * Returns: None
+ */
+void queueFileWrite(Session &session, FileReceipt *receipt,
+                    const unsigned char (&data_hash)[SHA1_LEN])
+{
+    auto write = make_shared<FileWrite>(receipt);
+    memcpy(write->data_hash, data_hash, SHA1_LEN);
+    FilePilot file_pilot = receipt->file_pilot;
+    string target_dir = session.target_dir;
+    ChunkIndex *chunks = session.chunks;
+
+    DiskJob job;
+    job.work = [write, target_dir, chunks] {
+        FileReceipt *receipt = write->receipt;
+        write->ok = finishFile(target_dir, chunks, receipt->file_data,
+                               write->data_hash, receipt->file_pilot,
+                               receipt->base_data, receipt->block_size,
+                               write->written_hash);
+        if (receipt->journal != NULL) {
+            receipt->journal->discard();
+            delete receipt->journal;
+        }
+        delete receipt;
+    };
+    job.done = [write, file_pilot](Session &session) {
+        if (!write->written_hash.empty())
+            session.filehash[file_pilot.fname] = write->written_hash;
+        if (!write->ok)
+            session.failed_e2es.push_back(to_string(file_pilot.file_ID));
+        session.writing.erase(file_pilot.fname);
+        fileDone(session, file_pilot);
+    };
+    session.writing.insert(file_pilot.fname);
+    queueDiskJob(session, job);
+    session.received_files.insert(file_pilot.file_ID);
+}
+
+/*
+ * makeMissing
+ * Construct a 'missing' message telling the client which packets of a file
+ * to (re)send: "M<file_ID> <packet list>", as long as fits in one message.
+ * An empty list tells the client we have all of the file.
+ *
+ * Args:
+ * * file_ID: ID of the file being received
+ * * packets: packet numbers still missing
+ *
+ *  Returns: the message
+ */
+string makeMissing(int file_ID, const set<int> &packets)
+{
+    string missing = "M" + to_string(file_ID) + " ";
+    //Don't overfill buffer!
+    return missing + makeRangeList(packets, 511 - SESSION_TAG_LEN -
+                                            missing.length());
+}
+
+/*
+ * saveToJournal
+ * Have the disk workers save the packets received since the last save to
+ * the file's journal, if it has one. Their data is copied out for the
+ * workers, as the reassembly buffer keeps changing while they write.
+ *
+ * Args:
+ * * session: the client's session
+ * * receipt: the file's receipt, its unsaved packets emptied
+ *
+ *  Returns: None
+ */
+void saveToJournal(Session &session, FileReceipt *receipt)
+{
+    if (receipt->journal != NULL && !receipt->unsaved.empty()) {
+        auto packet_nums = make_shared<vector<int>>();
+        packet_nums->swap(receipt->unsaved);
+        auto data = make_shared<string>();
+        int last = receipt->file_pilot.num_packets-1;
+        for (auto iter = packet_nums->begin(); iter != packet_nums->end();
+             iter++) {
+            size_t loc = (size_t)*iter*PACKET_SIZE;
+            size_t len = (*iter == last) ? receipt->file_data.size() - loc :
+                                           PACKET_SIZE;
+            data->append(receipt->file_data, loc, len);
+        }
+        ReceiveJournal *journal = receipt->journal;
+        DiskJob job;
+        job.work = [journal, packet_nums, data] {
+            journal->record(*packet_nums, *data);
+        };
+        job.done = [](Session &) {};
+        queueDiskJob(session, job);
+    }
+    receipt->unsaved.clear();
+}
+
+/*
+ * discardJournal
+ * Have the disk workers throw a journal away, once whatever they are
+ * saving to it is saved
+ *
+ * Args:
+ * * session: the client's session
+ * * journal: the journal, no longer any receipt's
+ *
+ *  Returns: None
+ */
+void discardJournal(Session &session, ReceiveJournal *journal)
+{
+    DiskJob job;
+    job.work = [journal] {
+        journal->discard();
+        delete journal;
+    };
+    job.done = [](Session &) {};
+    queueDiskJob(session, job);
+}
+
+/*
+ * finishFile
+ * Check a fully received file against the hash in its pilot and write it
+ * to the target. Run by a disk worker.
+ *
+ * Args:
+ * * target_dir: directory to write the file to
+ * * chunks: where chunks of files received this session are, if the
+ *           client chunks files, or NULL
+ * * file_data: every packet of the file, decoded in place if encoded
+ * * data_hash: hash of file_data as received, replaced by the hash of the
+ *              decoded file if encoded
+ * * file_pilot: FilePilot for the file
+ * * base_data: for a delta encoded file, our existing copy it applies to
+ * * block_size: for a delta encoded file, the block size of the signatures
+ * * written_hash: pass-by-reference string, set to the hash of what the
+ *                 target now holds under the file's name, for the
+ *                 directory end-to-end check. Left empty if we never got
+ *                 as far as reading it back.
+ *
+ *  Returns: true if the file passed the server-side internal check
+ */
+bool finishFile(const string &target_dir, ChunkIndex *chunks,
+                string &file_data, unsigned char (&data_hash)[SHA1_LEN],
+                FilePilot file_pilot, const string &base_data,
+                size_t block_size, string &written_hash)
+{
+    // Compressed data is unpacked first. A delta only becomes the file once
+    // applied to our old copy, and a chunk list once its chunks are gathered
+    string problems;
+    if (file_pilot.encoding & ENCODING_ZLIB) {
+        string packed;
+        packed.swap(file_data);
+        if (!decompressData(packed, file_data))
+            problems += "File: " + file_pilot.fname +
+                        " could not be decompressed\n";
+    }
+    if (file_pilot.encoding & ENCODING_DELTA) {
+        string delta;
+        delta.swap(file_data);
+        if (!applyDelta(base_data, delta, block_size, file_data))
+            problems += "File: " + file_pilot.fname +
+                        " malformed delta\n";
+    }
+    else if (file_pilot.encoding & ENCODING_CHUNKS) {
+        string chunk_list;
+        chunk_list.swap(file_data);
+        if (chunks == NULL || !applyChunkList(chunk_list, *chunks, file_data))
+            problems += "File: " + file_pilot.fname +
+                        " chunk list could not be assembled\n";
+    }
+    else if (file_pilot.encoding & ENCODING_SPARSE) {
+        string zero_runs;
+        zero_runs.swap(file_data);
+        if (!applyZeroRunList(zero_runs, file_data))
+            problems += "File: " + file_pilot.fname +
+                        " malformed zero run list\n";
+    }
+    if (!problems.empty()) {
+        lock_guard<recursive_mutex> guard(GRADING_LOCK);
+        *GRADING << problems;
+    }
+    if (file_pilot.encoding != 0)
+        computeChecksum((const unsigned char *)file_data.data(),
+                        file_data.size(), data_hash);
+    unsigned char expected_hash[SHA1_LEN];
+    memcpy(expected_hash, file_pilot.hash.c_str(), SHA1_LEN);
+    if (!cmpChecksums(data_hash, expected_hash)) {
+        written_hash = string((const char *)data_hash, SHA1_LEN-1);
+        lock_guard<recursive_mutex> guard(GRADING_LOCK);
+        *GRADING << "File: " << file_pilot.fname
+                 << " received data does not match client hash, "
+                    "server-side internal check failed\n";
+        return false;
+    }
+    if (!internalE2E(file_data, file_pilot, target_dir, written_hash)) {
+        lock_guard<recursive_mutex> guard(GRADING_LOCK);
+        *GRADING << "File: " << file_pilot.fname
+                             << " server-side internal check failed\n";
+        return false;
+    }
+    {
+        lock_guard<recursive_mutex> guard(GRADING_LOCK);
+        *GRADING << "File: " << file_pilot.fname
+                             << " server-side internal check succeeded\n";
+    }
+    // Later files may be sent as chunks of this one
+    if (chunks != NULL)
+        chunks->addFile(file_pilot.fname, file_data);
+    return true;
+}
+
+/*
+ * hashInOrderPackets
+ * Feed any packets that now extend the contiguous received prefix of the file
+ * into the running hash of the received data.
+ *
+ * Args:
+ * * received_hash: running hash of packets [0, hashed_packets)
+ * * hashed_packets: number of leading packets already hashed, advanced past
+ *                   every packet no longer in 'packets'
+ * * packets: packet numbers still missing
+ * * file_data: reassembly buffer for the file
+ * * num_packets: total number of packets in the file
+ *
+ *  Returns: None
+ */
+void hashInOrderPackets(ChecksumContext &received_hash, int &hashed_packets,
+                        const set<int> &packets, const string &file_data,
+                        int num_packets)
+{
+    while (hashed_packets < num_packets &&
+           packets.find(hashed_packets) == packets.end()) {
+        size_t loc = (size_t)hashed_packets*PACKET_SIZE;
+        // The last packet runs to the end of the buffer, which only reaches
+        // its final size once that packet has been inserted
+        size_t len = (hashed_packets == num_packets-1) ?
+                     file_data.size() - loc : PACKET_SIZE;
+        received_hash.update((const unsigned char *)file_data.data() + loc,
+                             len);
+        hashed_packets++;
+    }
+}
+
+/*
+ * writeVerifiedBlocks
+ * Write a buffer to an open file one block at a time, reading each block back
+ * right after writing it. A block that does not read back the same is
+ * rewritten on its own, so one bad write costs one block rather than the
+ * whole file. The file is first extended to its full size, which leaves it
+ * all hole, and blocks of zeros are only read back, so they stay holes
+ * unless that fails.
+ *
+ * Args:
+ * * outputFile: nasty file opened for update ("w+b")
+ * * file_data: buffer of data to write to disk
+ * * full_TMPname: path of the file, for log messages
+ *
+ *  Returns: false if some block could not be written correctly in
+ *  MAX_WRITE_TRIES attempts or a file operation failed, true otherwise
+ */
+bool writeVerifiedBlocks(NASTYFILE &outputFile, const string &file_data,
+                         string full_TMPname)
+{
+    size_t num_bytes = file_data.size();
+    char *readback = (char *)malloc(VERIFY_BLOCK_SIZE);
+    bool all_blocks_ok = true;
+    bool extended = (truncate(full_TMPname.c_str(), num_bytes) == 0);
+
+    for (size_t offset = 0; offset < num_bytes && all_blocks_ok;
+         offset += VERIFY_BLOCK_SIZE) {
+        size_t block_len = min(VERIFY_BLOCK_SIZE, num_bytes - offset);
+        const char *block = file_data.data() + offset;
+        bool block_ok = false;
+        int block_tries = 0;
+        while (!block_ok && block_tries < MAX_WRITE_TRIES) {
+            if (block_tries > 0) {
+                lock_guard<recursive_mutex> guard(GRADING_LOCK);
+                *GRADING << "File: " << full_TMPname << " rewriting block at "
+                         << offset << ", attempt #" << block_tries+1 << endl;
+            }
+            // Leave a hole the first time round
+            bool hole = (extended && block_tries == 0 &&
+                         isAllZero(block, block_len));
+            block_tries++;
+            if (!hole && (outputFile.fseek(offset, SEEK_SET) != 0 ||
+                outputFile.fwrite(block, 1, block_len) != block_len)) {
+                cerr << "Error writing file " << full_TMPname <<
+                        "  errno=" << strerror(errno) << endl;
+                continue;
+            }
+            // Read the block straight back and compare with what we meant
+            // to write
+            if (outputFile.fseek(offset, SEEK_SET) != 0 ||
+                outputFile.fread(readback, 1, block_len) != block_len)
+                continue;
+            block_ok = (memcmp(readback, block, block_len) == 0);
+        }
+        all_blocks_ok = block_ok;
+    }
+    free(readback);
+    return all_blocks_ok;
+}
+
+/*
+ * internalE2E
+ * Runs an internal check to see if the hash of a written file matches the hash
+ * given to us by the client originally. The file is written and verified
+ * block by block, then read back once as a whole to confirm it.
+ *
+ * Args:
+ * * file_data: buffer of data to write to disk
+ * * file_pilot: corresponding FilePilot    
+ * * target_dir: directory to write the file to
+ * * written_hash: pass-by-reference string, set to the hash of what is
+ *                 written to disk
+ *
+ *  Returns: Boolean indicating whether the hash of the written file equals
+ *  what the client says it should
+ */
+bool internalE2E(const string &file_data, FilePilot file_pilot,
+                 const string &target_dir, string &written_hash)
+{
+    bool internal_e2e_succeeded = false;
+    void *fopenretval;
+    size_t len;
+    int num_tries = 0;
+    while (!internal_e2e_succeeded && (num_tries < MAX_WRITE_TRIES)) {
+
+        //
+        // Write the file using nastyfile interface
+        //
+        NASTYFILE outputFile(FILE_NASTINESS);
+        string TMPname = file_pilot.fname + ".TMP";
+        string full_TMPname = makeFileName(target_dir, TMPname);
+
+        // do an fopen on the output file, for both writing and reading back
+        fopenretval = outputFile.fopen(full_TMPname.c_str(), "w+b");  
+
+        // Only this file fails: we run on a disk worker, with other
+        // sessions still being served
+        if (fopenretval == NULL) {
+          lock_guard<recursive_mutex> guard(GRADING_LOCK);
+          *GRADING << "Error opening output file " << full_TMPname <<
+                  "  errno=" << strerror(errno) << endl;
+          cerr << "Error opening output file " << full_TMPname <<
+                  " errno=" << strerror(errno) << endl;
+          return false;
+        }
+      
+        // Write the whole file
+        size_t num_bytes = file_data.size();
+        if (!writeVerifiedBlocks(outputFile, file_data, full_TMPname)) {
+          lock_guard<recursive_mutex> guard(GRADING_LOCK);
+          *GRADING << "Error writing file " << full_TMPname << 
+                  "  errno=" << strerror(errno) << endl;
+          cerr << "Error writing file " << full_TMPname << 
+                  "  errno=" << strerror(errno) << endl;
+          outputFile.fclose();
+          num_tries++;
+          continue;
+
+        }
+        len = num_bytes;
+        // Close after writing
+        if (outputFile.fclose() != 0) {
+          lock_guard<recursive_mutex> guard(GRADING_LOCK);
+          *GRADING << "Error closing file " << full_TMPname << 
+                  "  errno=" << strerror(errno) << endl;
+          cerr << "Error closing file " << full_TMPname << 
+                  "  errno=" << strerror(errno) << endl;
+          num_tries++;
+          continue;
+        }
+
+        {
+            lock_guard<recursive_mutex> guard(GRADING_LOCK);
+            *GRADING << "Wrote " << full_TMPname << 
+                ", size " << len << " bytes" << endl;
+        }
+
+        // The received data was already checked against the client's hash, so
+        // a single read back is enough to tell whether the write was good.
+        // If not, try writing/checking again.
+        size_t read_size;
+        unsigned char target_file_hash[SHA1_LEN];
+        bool read_ok = readFileChecksum(target_dir, TMPname,
+                                        read_size, target_file_hash);
+
+        if (!read_ok || read_size != num_bytes) {
+            lock_guard<recursive_mutex> guard(GRADING_LOCK);
+            *GRADING << "Error reading file " << file_pilot.fname << 
+                    " after writing to disk." << endl;
+            cerr << "Error reading file " << file_pilot.fname << 
+                    " after writing to disk." << endl;
+            num_tries++;
+            continue;
+        }
+
+        // Add checksum to table, regardless of whether it is correct.
+        // This will be used later on for a full E2E directory check
+        written_hash = string((const char *)target_file_hash, SHA1_LEN-1);
+
+        unsigned char expected_hash[SHA1_LEN];
+        memcpy(expected_hash, file_pilot.hash.c_str(), SHA1_LEN);
+        // Compare hash of written file and hash from FilePilot
+        bool write_success = cmpChecksums(target_file_hash, expected_hash);
+        if (write_success) {
+            string total = makeFileName(target_dir, file_pilot.fname);
+            int result = rename(full_TMPname.c_str(), total.c_str());
+            if (result != 0) {
+                string msg = "Error renaming file " + full_TMPname;
+                perror(msg.c_str());
+                lock_guard<recursive_mutex> guard(GRADING_LOCK);
+                *GRADING << msg << endl;
+            }
+            else 
+            // NEEDSWORK if we fail to rename the file, we will not report to
+            // the client that the e2e check was successful. However, the .TMP
+            // fille will techincally be correct.
+            internal_e2e_succeeded = true;
+        }
+        else {
+            num_tries++;
+            continue;
+        }
+    } // tried & failed too many times
+    return internal_e2e_succeeded;
+}
+
+/*
+ * copyWithinTarget
+ * Satisfy a FilePilot from a file the target already holds with the same
+ * contents under a different name. The copy is made by the disk workers,
+ * so the client can move on to its next file meanwhile; see copyFromSources.
+ *
+ * Args:
+ * * file_pilot: FilePilot for the file the client wants to send
+ * * session: the client's session. Its failed_e2es and filehash are
+ *            updated with the outcome once the copy is done.
+ *
+ *  Returns: true if the file will be taken care of locally, false if the
+ *  client has to send it
+ */
+bool copyWithinTarget(FilePilot file_pilot, Session &session)
+{
+    // Leave out files that are about to change, or already have since we
+    // indexed them, so that a copy we promise can be made
+    vector<string> sources;
+    auto candidates = session.by_hash.equal_range(file_pilot.hash);
+    for (auto iter = candidates.first; iter != candidates.second; iter++) {
+        const string &source = iter->second;
+        auto written = session.filehash.find(source);
+        if (source == file_pilot.fname || session.writing.count(source) > 0 ||
+            (written != session.filehash.end() &&
+             written->second != file_pilot.hash))
+            continue;
+        sources.push_back(source);
+    }
+    if (sources.empty())
+        return false;
+
+    auto write = make_shared<FileWrite>((FileReceipt *)NULL);
+    string target_dir = session.target_dir;
+    DiskJob job;
+    job.work = [write, target_dir, file_pilot, sources] {
+        write->ok = copyFromSources(target_dir, file_pilot, sources,
+                                    write->written_hash);
+    };
+    job.done = [write, file_pilot](Session &session) {
+        if (!write->written_hash.empty())
+            session.filehash[file_pilot.fname] = write->written_hash;
+        if (!write->ok)
+            session.failed_e2es.push_back(to_string(file_pilot.file_ID));
+        session.writing.erase(file_pilot.fname);
+        fileDone(session, file_pilot);
+    };
+    session.writing.insert(file_pilot.fname);
+    queueDiskJob(session, job);
+    return true;
+}
+
+/*
+ * copyFromSources
+ * Make a file of the target a copy of another with the same contents. The
+ * copy is cloned if the filesystem can share the data, and otherwise
+ * written out like a received file. Runs on a disk worker.
+ *
+ * Args:
+ * * target_dir: the target directory
+ * * file_pilot: FilePilot of the file to make
+ * * sources: files of the target that had its contents when the copy was
+ *            queued. Each is read and checked before use, and skipped if it
+ *            has changed since.
+ * * written_hash: set to the hash of what ended up in the target, if
+ *                 anything did
+ *
+ *  Returns: true if the copy was made and passed the internal check
+ */
+bool copyFromSources(const string &target_dir, FilePilot file_pilot,
+                     const vector<string> &sources, string &written_hash)
+{
+    for (size_t s = 0; s < sources.size(); s++) {
+        const string &source = sources[s];
+        string TMPname = file_pilot.fname + ".TMP";
+        string full_TMPname = makeFileName(target_dir, TMPname);
+        string full_name = makeFileName(target_dir, file_pilot.fname);
+
+        // Cheapest is to share the data blocks outright
+        if (cloneFile(makeFileName(target_dir, source), full_TMPname)) {
+            size_t size;
+            unsigned char hash[SHA1_LEN];
+            if (readFileChecksum(target_dir, TMPname, size, hash) &&
+                string((const char *)hash, SHA1_LEN-1) == file_pilot.hash &&
+                rename(full_TMPname.c_str(), full_name.c_str()) == 0) {
+                written_hash = file_pilot.hash;
+                lock_guard<recursive_mutex> guard(GRADING_LOCK);
+                *GRADING << "File: " << file_pilot.fname << " cloned from "
+                         << source << ", not receiving\n";
+                return true;
+            }
+            remove(full_TMPname.c_str());
+        }
+
+        // Otherwise read the source until we get a copy with the right
+        // hash; one that never matches has changed since we indexed it
+        char *file_data = NULL;
+        size_t size = 0;
+        for (int i = 0; i < MAX_WRITE_TRIES && file_data == NULL; i++) {
+            file_data = singleFileRead(target_dir, source, size);
+            if (file_data == NULL)
+                break;
+            unsigned char hash[SHA1_LEN];
+            computeChecksum((const unsigned char *)file_data, size, hash);
+            if (string((const char *)hash, SHA1_LEN-1) != file_pilot.hash) {
+                free(file_data);
+                file_data = NULL;
+            }
+        }
+        if (file_data == NULL)
+            continue;
+        {
+            lock_guard<recursive_mutex> guard(GRADING_LOCK);
+            *GRADING << "File: " << file_pilot.fname << " copying from "
+                     << source << ", not receiving\n";
+        }
+        bool copied = internalE2E(string(file_data, size), file_pilot,
+                                  target_dir, written_hash);
+        free(file_data);
+        lock_guard<recursive_mutex> guard(GRADING_LOCK);
+        *GRADING << "File: " << file_pilot.fname << " server-side internal"
+                 << (copied ? " check succeeded\n" : " check failed\n");
+        return copied;
+    }
+    // We told the client we had the file, so it will not send it now
+    lock_guard<recursive_mutex> guard(GRADING_LOCK);
+    *GRADING << "File: " << file_pilot.fname << " changed in the target "
+                "before it could be copied, server-side internal check "
+                "failed\n";
+    return false;
+}
+
+/*
+ * cloneFile
+ * Make dst_path a copy of src_path that shares its data blocks, on
+ * filesystems that support it (btrfs, xfs, ...)
+ *
+ * Args:
+ * * src_path: full path of the file to copy
+ * * dst_path: full path of the copy, replaced if it exists
+ *
+ *  Returns: true if the clone was made
+ */
+bool cloneFile(string src_path, string dst_path)
+{
+#ifdef FICLONE
+    int src = open(src_path.c_str(), O_RDONLY);
+    if (src < 0)
+        return false;
+    int dst = open(dst_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool cloned = (dst >= 0 && ioctl(dst, FICLONE, src) == 0);
+    if (dst >= 0)
+        close(dst);
+    close(src);
+    if (!cloned)
+        remove(dst_path.c_str());
+    return cloned;
+#else
+    return false;
+#endif
+}
+
+/*
+ * makeE2EResponse
+ * Once every file is in, get directory hash of the fully written target
+ * dir, and compare with the value originally received from client. The
+ * answer says if we succeeded or failed, and includes the number of failed
+ * files and as many of their IDs as fit if we failed. The client keeps
+ * asking ("E2E Ready") until it has it. It then either sends the failed
+ * files again, after which it asks anew, or confirms with "E2E received".
+ * The answer is kept until a failed file is sent again.
+ * Args:
+ * * session: the client's session
+ *
+ * Returns: the answer, or an empty string if files are still to come or
+ *          to be written
+ */
+string makeE2EResponse(Session &session)
+{
+    if ((int)session.received_files.size() < session.dir_pilot.num_files ||
+        !session.disk_jobs.empty())
+        return "";
+    *GRADING << "Sending E2E response to client\n";
+    if (!session.e2e_response.empty())
+        return session.e2e_response;
+
+    // Get Directory hash of the fully written 
+    string target_hash_str = getDirHash(session.filehash);
+    unsigned char target_dir_hash[SHA1_LEN];
+    memcpy(target_dir_hash, target_hash_str.c_str(), SHA1_LEN);
+
+    unsigned char source_dir_hash[SHA1_LEN];
+    memcpy(source_dir_hash, session.dir_pilot.hash.c_str(), SHA1_LEN);
+    // Compare dir hashes
+    bool success = cmpChecksums(target_dir_hash, source_dir_hash);
+
+    string response = "E2E";
+    const vector<string> &failed = session.failed_e2es;
+
+    if (success) {
+        *GRADING << "Server-side: End-to-end directory check successful\n";
+        response += "S";
+    }
+    else {
+        *GRADING << "Server-side: End-to-end directory check failed\n";
+        response += "F" + to_string(failed.size());
+        // Whole IDs only, the client asks again for the rest once it has
+        // sent these
+        for (auto iter = failed.begin(); iter != failed.end(); iter++)
+        {
+            if (response.length() + 1 + iter->length() >
+                (size_t)(511 - SESSION_TAG_LEN))
+                break;
+            response += " " + *iter;
+        }
+    }
+    session.e2e_response = response;
+    return response;
+}
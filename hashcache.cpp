@@ -0,0 +1,174 @@
+/*
+ * hashcache.cpp: Implements the persistent cache of verified file checksums
+ * Written by: Dylan Hoffmann and Lucas Campbell
+ *
+ * The cache file is laid out as:
+ *   "FCHC" | version (4 bytes) | entry count (8 bytes) |
+ *   entries: dev, ino, size, mtime_ns (8 bytes each) + SHA1 (20 bytes) |
+ *   SHA1 of everything before it (20 bytes)
+ * Integers are in host byte order; the cache never leaves the machine.
+ */
+
+#include "hashcache.h"
+#include "utils.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+const char CACHE_MAGIC[] = "FCHC";
+const uint32_t CACHE_VERSION = 1;
+const size_t CACHE_HEADER_SIZE = 4 + sizeof(uint32_t) + sizeof(uint64_t);
+const size_t CACHE_ENTRY_SIZE = 4*sizeof(uint64_t) + (SHA1_LEN-1);
+
+bool ChecksumCache::CacheKey::operator<(const CacheKey &other) const
+{
+    if (dev != other.dev)
+        return dev < other.dev;
+    if (ino != other.ino)
+        return ino < other.ino;
+    if (size != other.size)
+        return size < other.size;
+    return mtime_ns < other.mtime_ns;
+}
+
+ChecksumCache::ChecksumCache(string path) : path(path), dirty(false)
+{
+    load();
+}
+
+ChecksumCache::CacheKey ChecksumCache::makeKey(const struct stat &statbuf)
+{
+    CacheKey key;
+    key.dev = statbuf.st_dev;
+    key.ino = statbuf.st_ino;
+    key.size = statbuf.st_size;
+    key.mtime_ns = (uint64_t)statbuf.st_mtim.tv_sec * 1000000000 +
+                   statbuf.st_mtim.tv_nsec;
+    return key;
+}
+
+bool ChecksumCache::lookup(const struct stat &statbuf, string &hash)
+{
+    lock_guard<mutex> guard(lock);
+    auto found = entries.find(makeKey(statbuf));
+    if (found == entries.end())
+        return false;
+    found->second.used = true;
+    hash = found->second.hash;
+    return true;
+}
+
+void ChecksumCache::store(const struct stat &statbuf, string hash)
+{
+    lock_guard<mutex> guard(lock);
+    CacheEntry entry;
+    entry.hash = hash;
+    entry.used = true;
+    entries[makeKey(statbuf)] = entry;
+    dirty = true;
+}
+
+/*
+ * load
+ * Fill the table from the cache file. Anything that does not look exactly
+ * like a cache we wrote leaves the table empty.
+ */
+void ChecksumCache::load()
+{
+    FILE *cache_file = fopen(path.c_str(), "rb");
+    if (cache_file == NULL)
+        return;
+    vector<char> contents;
+    char buffer[8192];
+    size_t len;
+    while ((len = fread(buffer, 1, sizeof(buffer), cache_file)) > 0)
+        contents.insert(contents.end(), buffer, buffer + len);
+    fclose(cache_file);
+
+    if (contents.size() < CACHE_HEADER_SIZE + (SHA1_LEN-1) ||
+        memcmp(contents.data(), CACHE_MAGIC, 4) != 0)
+        return;
+    uint32_t version;
+    uint64_t count;
+    memcpy(&version, contents.data() + 4, sizeof(version));
+    memcpy(&count, contents.data() + 4 + sizeof(version), sizeof(count));
+    size_t body_size = CACHE_HEADER_SIZE + count*CACHE_ENTRY_SIZE;
+    if (version != CACHE_VERSION ||
+        contents.size() != body_size + (SHA1_LEN-1))
+        return;
+
+    // Make sure the file is exactly what we wrote
+    unsigned char hash[SHA1_LEN];
+    computeChecksum((const unsigned char *)contents.data(), body_size, hash);
+    if (memcmp(hash, contents.data() + body_size, SHA1_LEN-1) != 0)
+        return;
+
+    const char *entry = contents.data() + CACHE_HEADER_SIZE;
+    for (uint64_t i = 0; i < count; i++, entry += CACHE_ENTRY_SIZE) {
+        CacheKey key;
+        memcpy(&key.dev, entry, sizeof(uint64_t));
+        memcpy(&key.ino, entry + 8, sizeof(uint64_t));
+        memcpy(&key.size, entry + 16, sizeof(uint64_t));
+        memcpy(&key.mtime_ns, entry + 24, sizeof(uint64_t));
+        CacheEntry value;
+        value.hash = string(entry + 32, SHA1_LEN-1);
+        value.used = false;
+        entries[key] = value;
+    }
+}
+
+bool ChecksumCache::save()
+{
+    lock_guard<mutex> guard(lock);
+    // Build the new contents from the entries used this run
+    string contents(CACHE_MAGIC, 4);
+    uint64_t count = 0;
+    contents.append((const char *)&CACHE_VERSION, sizeof(CACHE_VERSION));
+    contents.append((const char *)&count, sizeof(count));
+    for (auto iter = entries.begin(); iter != entries.end(); iter++) {
+        if (!iter->second.used)
+            continue;
+        contents.append((const char *)&iter->first.dev, sizeof(uint64_t));
+        contents.append((const char *)&iter->first.ino, sizeof(uint64_t));
+        contents.append((const char *)&iter->first.size, sizeof(uint64_t));
+        contents.append((const char *)&iter->first.mtime_ns,
+                        sizeof(uint64_t));
+        contents.append(iter->second.hash);
+        count++;
+    }
+    if (!dirty && count == entries.size())
+        return true; // nothing to write
+    contents.replace(4 + sizeof(CACHE_VERSION), sizeof(count),
+                     (const char *)&count, sizeof(count));
+    unsigned char hash[SHA1_LEN];
+    computeChecksum((const unsigned char *)contents.data(), contents.size(),
+                    hash);
+    contents.append((const char *)hash, SHA1_LEN-1);
+
+    // Write to the side and rename, so a crash never leaves half a cache
+    string tmp_path = path + ".TMP";
+    FILE *cache_file = fopen(tmp_path.c_str(), "wb");
+    if (cache_file == NULL) {
+        perror(("Error opening checksum cache " + tmp_path).c_str());
+        return false;
+    }
+    bool ok = (fwrite(contents.data(), 1, contents.size(), cache_file) ==
+               contents.size());
+    ok = (fclose(cache_file) == 0) && ok;
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+        perror(("Error writing checksum cache " + path).c_str());
+        remove(tmp_path.c_str());
+        return false;
+    }
+    // Entries nobody asked about this run are gone from the file now
+    for (auto iter = entries.begin(); iter != entries.end(); ) {
+        if (iter->second.used)
+            iter++;
+        else
+            iter = entries.erase(iter);
+    }
+    dirty = false;
+    return true;
+}
@@ -0,0 +1,83 @@
+/*
+ * hashcache.h: Interface for a persistent cache of verified file checksums
+ * Written By Dylan Hoffmann & Lucas Campbell
+ */
+#ifndef HASHCACHE_H
+#define HASHCACHE_H
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/*
+ * ChecksumCache
+ * Maps a file's identity and version -- (device, inode, size, modification
+ * time in ns) -- to the SHA1 it was last verified to have, and keeps that
+ * map in a compact binary file between runs. Any change to a file changes
+ * its size or mtime, so a stale entry is simply never matched.
+ * Constructor args:
+ * * string path: cache file to load from and save to. A missing, truncated
+ *                or corrupt file is treated as an empty cache.
+ * Additional info: safe to use from several threads at once. The cache file
+ * is our own metadata rather than a file being copied, so it is read and
+ * written with plain stdio and protected by a trailing SHA1 of its contents.
+ */
+class ChecksumCache {
+public:
+    ChecksumCache(std::string path);
+
+    /*
+     * lookup
+     * Args:
+     * * statbuf: result of lstat on the file
+     * * hash: pass-by-reference string, set to the cached 20 byte SHA1
+     *
+     * Returns: true if the cache holds a hash for this version of the file
+     */
+    bool lookup(const struct stat &statbuf, std::string &hash);
+
+    /*
+     * store
+     * Record the verified hash of a file
+     * Args:
+     * * statbuf: result of lstat on the file, taken before it was read
+     * * hash: 20 byte SHA1 of the file's contents
+     *
+     * Returns: None
+     */
+    void store(const struct stat &statbuf, std::string hash);
+
+    /*
+     * save
+     * Write the cache back to its file if anything changed. Only entries
+     * looked up or stored during this run are kept, so files that have been
+     * deleted or rewritten drop out.
+     *
+     * Returns: false if the cache file could not be written
+     */
+    bool save();
+
+private:
+    struct CacheKey {
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t size;
+        uint64_t mtime_ns;
+        bool operator<(const CacheKey &other) const;
+    };
+    struct CacheEntry {
+        std::string hash;
+        bool used;      // looked up or stored during this run
+    };
+    static CacheKey makeKey(const struct stat &statbuf);
+    void load();
+
+    std::string path;
+    std::map<CacheKey, CacheEntry> entries;
+    std::mutex lock;
+    bool dirty;
+};
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * journal.cpp: Implements the server's persistent record of partly received
+ *              files
+ * Written by: Dylan Hoffmann and Lucas Campbell
+ *
+ * The .JRNL file is laid out as:
+ *   "FCJR" | version | packet count | encoding (4 bytes each) | SHA1 of the
+ *   file (20 bytes) |
+ *   records: packet number, data length (4 bytes each) + first 8 bytes of
+ *   the SHA1 of the packet's data
+ * Integers are little-endian, as in packet payloads.
+ */
+
+#include "journal.h"
+#include "utils.h"
+#include "c150nastyfile.h"
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+using namespace C150NETWORK;
+
+extern int FILE_NASTINESS;
+
+const char JOURNAL_MAGIC[] = "FCJR";
+const uint32_t JOURNAL_VERSION = 1;
+const size_t JOURNAL_CHECK_LEN = 8;
+const size_t JOURNAL_RECORD_SIZE = 2*4 + JOURNAL_CHECK_LEN;
+
+ReceiveJournal::ReceiveJournal(string dir, FilePilot file_pilot) :
+    part_name(makeFileName(dir, file_pilot.fname + ".PART")),
+    journal_name(makeFileName(dir, file_pilot.fname + ".JRNL")),
+    file_pilot(file_pilot), usable(true)
+{
+}
+
+string ReceiveJournal::makeHeader()
+{
+    string header(JOURNAL_MAGIC, 4);
+    appendUint32(header, JOURNAL_VERSION);
+    appendUint32(header, file_pilot.num_packets);
+    appendUint32(header, file_pilot.encoding);
+    header += file_pilot.hash.substr(0, SHA1_LEN-1);
+    return header;
+}
+
+/*
+ * startJournal
+ * Throw away whatever was saved before and start an empty journal for this
+ * version of the file
+ *
+ * Returns: false if the journal could not be created
+ */
+bool ReceiveJournal::startJournal()
+{
+    remove(part_name.c_str());
+    FILE *journal = fopen(journal_name.c_str(), "wb");
+    if (journal == NULL) {
+        perror(("Error creating journal " + journal_name).c_str());
+        usable = false;
+        return false;
+    }
+    string header = makeHeader();
+    usable = (fwrite(header.data(), 1, header.size(), journal) ==
+              header.size());
+    usable = (fclose(journal) == 0) && usable;
+    return usable;
+}
+
+int ReceiveJournal::recover(string &file_data, set<int> &packets)
+{
+    FILE *journal = fopen(journal_name.c_str(), "rb");
+    if (journal == NULL) {
+        startJournal();
+        return 0;
+    }
+    string contents;
+    char buffer[8192];
+    size_t len;
+    while ((len = fread(buffer, 1, sizeof(buffer), journal)) > 0)
+        contents.append(buffer, len);
+    fclose(journal);
+
+    string header = makeHeader();
+    if (contents.compare(0, header.size(), header) != 0) {
+        // Left by a different version of the file, or not ours at all
+        startJournal();
+        return 0;
+    }
+
+    NASTYFILE partFile(FILE_NASTINESS);
+    if (partFile.fopen(part_name.c_str(), "rb") == NULL)
+        return 0;
+    int num_packets = file_pilot.num_packets;
+    int recovered = 0;
+    char data[PACKET_SIZE];
+    // A record cut short by a crash is simply not counted
+    for (size_t pos = header.size();
+         pos + JOURNAL_RECORD_SIZE <= contents.size();
+         pos += JOURNAL_RECORD_SIZE) {
+        int packet_num = readUint32(contents.data() + pos);
+        size_t data_len = readUint32(contents.data() + pos + 4);
+        bool is_last = (packet_num == num_packets-1);
+        if (packets.count(packet_num) == 0 || data_len > PACKET_SIZE ||
+            (!is_last && data_len != PACKET_SIZE))
+            continue;
+        size_t loc = (size_t)packet_num*PACKET_SIZE;
+        if (partFile.fseek(loc, SEEK_SET) != 0 ||
+            partFile.fread(data, 1, data_len) != data_len)
+            continue;
+        // Only trust data that still matches what we saved
+        unsigned char hash[SHA1_LEN];
+        computeChecksum((const unsigned char *)data, data_len, hash);
+        if (memcmp(hash, contents.data() + pos + 8, JOURNAL_CHECK_LEN) != 0)
+            continue;
+        if (is_last)
+            file_data.insert(loc, data, data_len);
+        else
+            file_data.replace(loc, data_len, data, data_len);
+        packets.erase(packet_num);
+        recovered++;
+    }
+    partFile.fclose();
+    return recovered;
+}
+
+void ReceiveJournal::record(const vector<int> &packet_nums,
+                            const string &data)
+{
+    if (!usable || packet_nums.empty())
+        return;
+    int num_packets = file_pilot.num_packets;
+    // Only the file's last packet may be short, so it has what is left over
+    size_t last_len = data.size() - (packet_nums.size()-1)*PACKET_SIZE;
+
+    // Data first, so a record never describes data that was not written
+    NASTYFILE partFile(FILE_NASTINESS);
+    if (partFile.fopen(part_name.c_str(), "r+b") == NULL &&
+        partFile.fopen(part_name.c_str(), "w+b") == NULL) {
+        perror(("Error opening partial file " + part_name).c_str());
+        usable = false;
+        return;
+    }
+    string records;
+    size_t offset = 0;
+    for (auto iter = packet_nums.begin(); iter != packet_nums.end(); iter++) {
+        size_t loc = (size_t)*iter*PACKET_SIZE;
+        size_t data_len = (*iter == num_packets-1) ? last_len : PACKET_SIZE;
+        const char *packet = data.data() + offset;
+        offset += data_len;
+        if (partFile.fseek(loc, SEEK_SET) != 0 ||
+            partFile.fwrite(packet, 1, data_len) != data_len)
+            continue;
+        unsigned char hash[SHA1_LEN];
+        computeChecksum((const unsigned char *)packet, data_len, hash);
+        appendUint32(records, *iter);
+        appendUint32(records, data_len);
+        records.append((const char *)hash, JOURNAL_CHECK_LEN);
+    }
+    if (partFile.fclose() != 0) {
+        usable = false;
+        return;
+    }
+
+    FILE *journal = fopen(journal_name.c_str(), "ab");
+    if (journal == NULL) {
+        usable = false;
+        return;
+    }
+    usable = (fwrite(records.data(), 1, records.size(), journal) ==
+              records.size());
+    usable = (fclose(journal) == 0) && usable;
+}
+
+void ReceiveJournal::discard()
+{
+    remove(part_name.c_str());
+    remove(journal_name.c_str());
+    usable = false;
+}
@@ -0,0 +1,88 @@
+/*
+ * journal.h: Interface for the server's persistent record of partly
+ *            received files
+ * Written By Dylan Hoffmann & Lucas Campbell
+ */
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "protocol.h"
+#include <string>
+#include <set>
+#include <vector>
+
+// Smallest file (in packets) worth journaling. Anything shorter is resent
+// whole in less time than the journal takes to write.
+const int JOURNAL_MIN_PACKETS = 64;
+// Most packets received before they are saved, so a long first burst is
+// not all lost if the server dies partway through it
+const int JOURNAL_FLUSH_PACKETS = 256;
+
+/*
+ * ReceiveJournal
+ * Keeps the packets received so far for one file on disk, so that a server
+ * restarted after a crash can pick the file up where it left off instead of
+ * asking for all of it again. Packet data goes to "<file>.PART" in the
+ * target directory at its place in the file; "<file>.JRNL" starts with the
+ * file's hash, packet count and encoding, followed by one record (packet
+ * number, length, truncated SHA1) for each packet saved.
+ * Constructor args:
+ * * string dir: target directory
+ * * FilePilot file_pilot: pilot of the file being received. A journal left
+ *                         for a different version of the file is thrown
+ *                         away.
+ * Additional info: the journal is only ever appended to, and each packet is
+ * checked against its record when recovered, so a crash at any point (or a
+ * nasty write to the .PART file) costs at most the packets it touched.
+ */
+class ReceiveJournal {
+public:
+    ReceiveJournal(std::string dir, FilePilot file_pilot);
+
+    /*
+     * recover
+     * Fill in the packets an earlier run saved for this file
+     * Args:
+     * * file_data: reassembly buffer for the file, PACKET_SIZE*(packets-1)
+     *              bytes long. Recovered packets are copied into place, the
+     *              last one appended.
+     * * packets: packet numbers still missing; recovered ones are removed
+     *
+     * Returns: number of packets recovered
+     */
+    int recover(std::string &file_data, std::set<int> &packets);
+
+    /*
+     * record
+     * Save newly received packets. Run by a disk worker, so it is handed
+     * a copy of their data rather than the reassembly buffer, which keeps
+     * changing as packets arrive.
+     * Args:
+     * * packet_nums: numbers of the packets to save
+     * * data: their data, one after another in the same order, each
+     *         PACKET_SIZE bytes but the file's last packet
+     *
+     * Returns: None. A journal that cannot be written just stops saving.
+     */
+    void record(const std::vector<int> &packet_nums,
+                const std::string &data);
+
+    /*
+     * discard
+     * Remove the journal and partial file, once the file is complete
+     *
+     * Returns: None
+     */
+    void discard();
+
+private:
+    std::string makeHeader();
+    bool startJournal();
+
+    std::string part_name;      // full path of the .PART data file
+    std::string journal_name;   // full path of the .JRNL record file
+    FilePilot file_pilot;
+    bool usable;                // false once a write has failed
+};
+
+#endif
@@ -0,0 +1,86 @@
+/*
+ * packetpool.cpp: Implements a pool of reusable packet buffers
+ * Written by: Dylan Hoffmann and Lucas Campbell
+ */
+
+#include "packetpool.h"
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+PacketBuffer::PacketBuffer(PacketBuffer &&other) :
+    pool(other.pool), buffer(other.buffer)
+{
+    other.pool = NULL;
+    other.buffer = NULL;
+}
+
+PacketBuffer &PacketBuffer::operator=(PacketBuffer &&other)
+{
+    if (this != &other) {
+        release();
+        pool = other.pool;
+        buffer = other.buffer;
+        other.pool = NULL;
+        other.buffer = NULL;
+    }
+    return *this;
+}
+
+PacketBuffer::~PacketBuffer()
+{
+    release();
+}
+
+void PacketBuffer::release()
+{
+    if (buffer != NULL)
+        pool->put(buffer);
+    pool = NULL;
+    buffer = NULL;
+}
+
+PacketPool::PacketPool(size_t slab_buffers) :
+    slab_buffers(slab_buffers > 0 ? slab_buffers : 1)
+{
+    addSlab();
+}
+
+PacketPool::~PacketPool()
+{
+    for (size_t i = 0; i < slabs.size(); i++)
+        free(slabs[i]);
+}
+
+PacketBuffer PacketPool::get()
+{
+    lock_guard<mutex> guard(lock);
+    if (free_buffers.empty())
+        addSlab();
+    char *buffer = free_buffers.back();
+    free_buffers.pop_back();
+    return PacketBuffer(this, buffer);
+}
+
+void PacketPool::put(char *buffer)
+{
+    lock_guard<mutex> guard(lock);
+    free_buffers.push_back(buffer);
+}
+
+/*
+ * addSlab
+ * Allocate another slab and put its buffers on the free list. Called with
+ * the lock held, or from the constructor.
+ */
+void PacketPool::addSlab()
+{
+    char *slab = (char *)malloc(slab_buffers * PACKET_BUFFER_SIZE);
+    if (slab == NULL)
+        throw bad_alloc();
+    slabs.push_back(slab);
+    free_buffers.reserve(slabs.size() * slab_buffers);
+    for (size_t i = 0; i < slab_buffers; i++)
+        free_buffers.push_back(slab + i * PACKET_BUFFER_SIZE);
+}
@@ -0,0 +1,84 @@
+/*
+ * packetpool.h: Interface for a pool of reusable packet buffers
+ * Written By Dylan Hoffmann & Lucas Campbell
+ *
+ * Every datagram we send or receive fits in PACKET_BUFFER_SIZE bytes, so
+ * rather than build each one in freshly allocated strings, packets are
+ * built and read in buffers carved out of a few large slabs, which go back
+ * to the pool when done with. The data path allocates nothing per packet,
+ * and a server that runs for weeks does not fragment its heap with them.
+ */
+#ifndef PACKETPOOL_H
+#define PACKETPOOL_H
+
+#include "protocol.h"
+#include <vector>
+#include <mutex>
+
+class PacketPool;
+
+/*
+ * PacketBuffer
+ * Handle on one PACKET_BUFFER_SIZE byte buffer of a PacketPool, which goes
+ * back to the pool when the handle is destroyed. Handles can be moved but
+ * not copied; a default constructed one holds no buffer.
+ */
+class PacketBuffer {
+public:
+    PacketBuffer() : pool(NULL), buffer(NULL) {}
+    PacketBuffer(PacketBuffer &&other);
+    PacketBuffer &operator=(PacketBuffer &&other);
+    ~PacketBuffer();
+
+    char *data() { return buffer; }
+    const char *data() const { return buffer; }
+
+private:
+    friend class PacketPool;
+    PacketBuffer(PacketPool *p, char *b) : pool(p), buffer(b) {}
+    void release();
+
+    PacketPool *pool;
+    char *buffer;
+
+    PacketBuffer(const PacketBuffer &) = delete;
+    PacketBuffer &operator=(const PacketBuffer &) = delete;
+};
+
+/*
+ * PacketPool
+ * Packet buffers, allocated a slab at a time and reused
+ * Constructor args:
+ * * size_t slab_buffers: number of buffers in each slab. The pool starts
+ *                        with one slab and adds another whenever every
+ *                        buffer is in use, so it grows to the most packets
+ *                        ever held at once and no further.
+ * Additional info: may be used from several threads at once. Every handle
+ * must be gone before the pool is destroyed.
+ */
+class PacketPool {
+public:
+    PacketPool(size_t slab_buffers = 256);
+    ~PacketPool();
+
+    /*
+     * get
+     * Returns: a handle on a free buffer
+     */
+    PacketBuffer get();
+
+private:
+    friend class PacketBuffer;
+    void put(char *buffer);
+    void addSlab();
+
+    size_t slab_buffers;
+    std::vector<char *> slabs;
+    std::vector<char *> free_buffers;
+    std::mutex lock;
+
+    PacketPool(const PacketPool &) = delete;
+    PacketPool &operator=(const PacketPool &) = delete;
+};
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * pilottest.cpp: Drives a running fileserver with files piloted out of
+ *                order and several open at once, as a client that moves on
+ *                while files are outstanding would
+ * Written by: Dylan Hoffmann and Lucas Campbell
+ *
+ * Usage: pilottest <server> <srcdir>
+ *
+ * The source directory needs more than MAX_OPEN_FILES files of differing
+ * contents, and the server's target directory should start empty. Files are
+ * piloted highest ID first, MAX_OPEN_FILES at a time, and their packets
+ * sent interleaved before any of them is asked after. While the server has
+ * MAX_OPEN_FILES files open it must leave the next pilot unanswered, and
+ * take it once they are done. pilottest exits 0 if the server's end-to-end
+ * check passes and all of that held, 1 otherwise.
+ */
+
+#include "protocol.h"
+#include "utils.h"
+#include "c150nastydgmsocket.h"
+#include "c150grading.h"
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+using namespace std;
+using namespace C150NETWORK;
+
+// The server's limit on files received at once (see filecopyserver.cpp)
+const size_t MAX_OPEN_FILES = 8;
+const int TIMEOUT_MS = 300;
+// tries for an answer, enough to wait out the server's disk queue
+const int MAX_TRIES = 40;
+// tries for the pilot the server should hold off
+const int HELD_PILOT_TRIES = 3;
+
+string SESSION_TAG;              // tags every packet of our session
+
+void sendPacket(C150NastyDgmSocket *sock, const string &packet)
+{
+    string tagged = SESSION_TAG + packet;
+    sock->write(tagged.c_str(), tagged.length()+1);
+}
+
+// False if the read timed out; packets of other sessions are dropped
+bool readPacket(C150NastyDgmSocket *sock, string &incoming)
+{
+    char incoming_msg[PACKET_BUFFER_SIZE];
+    while (true) {
+        ssize_t readlen = sock->read(incoming_msg, sizeof(incoming_msg));
+        if (sock->timedout())
+            return false;
+        if (readlen <= SESSION_TAG_LEN + 1 ||
+            memcmp(incoming_msg, SESSION_TAG.data(), SESSION_TAG_LEN) != 0)
+            continue;
+        incoming.assign(incoming_msg + SESSION_TAG_LEN,
+                        readlen - SESSION_TAG_LEN - 1);
+        return true;
+    }
+}
+
+/*
+ * Send 'packet' until an answer starting with 'prefix' comes back, at most
+ * 'tries' times
+ * Returns: the answer, or an empty string if none came
+ */
+string ask(C150NastyDgmSocket *sock, const string &packet,
+           const string &prefix, int tries)
+{
+    string incoming;
+    for (int i = 0; i < tries; i++) {
+        sendPacket(sock, packet);
+        while (readPacket(sock, incoming))
+            if (incoming.compare(0, prefix.length(), prefix) == 0)
+                return incoming;
+    }
+    return "";
+}
+
+void sendPackets(C150NastyDgmSocket *sock, int ID, const string &data,
+                 const set<int> &packets)
+{
+    char buffer[PACKET_BUFFER_SIZE];
+    for (auto iter = packets.begin(); iter != packets.end(); iter++) {
+        size_t offset = (size_t)*iter * PACKET_SIZE;
+        size_t len = min((size_t)PACKET_SIZE, data.size() - offset);
+        size_t packet_len = writeFilePacket(buffer, SESSION_TAG, *iter, ID,
+                                            data.data() + offset, len);
+        sock->write(buffer, packet_len);
+    }
+}
+
+/*
+ * Pilot a file
+ * Returns: the server's answer, or an empty string if it gave none
+ */
+string pilotFile(C150NastyDgmSocket *sock, int ID, const string &name,
+                 const string &hash, const string &data, int tries)
+{
+    string pilot = makeFilePilot(FilePilot(packetsNeeded(data.size()), ID,
+                                           hash, name));
+    // Answers to pilots are "FP" and a code, then the file ID
+    string incoming;
+    for (int i = 0; i < tries; i++) {
+        sendPacket(sock, pilot);
+        while (readPacket(sock, incoming))
+            if (incoming.compare(0, 2, "FP") == 0 &&
+                incoming.substr(4) == to_string(ID))
+                return incoming;
+    }
+    return "";
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "Correct syntax is: %s <server> <srcdir>\n", argv[0]);
+        exit(1);
+    }
+    GRADEME(argc, argv);
+
+    DIR *SRC = opendir(argv[2]);
+    if (SRC == NULL) {
+        fprintf(stderr, "Error opening source directory %s\n", argv[2]);
+        exit(1);
+    }
+    map<string, string> filehash;
+    fillChecksumTable(filehash, SRC, argv[2], 1, NULL);
+    closedir(SRC);
+    if (filehash.size() <= MAX_OPEN_FILES) {
+        fprintf(stderr, "%s needs more than %d files\n", argv[2],
+                (int)MAX_OPEN_FILES);
+        exit(1);
+    }
+
+    // File IDs go by name
+    vector<string> names;
+    vector<string> contents;
+    for (auto iter = filehash.begin(); iter != filehash.end(); iter++) {
+        ifstream in(makeFileName(argv[2], iter->first).c_str(),
+                    ios::binary);
+        stringstream data;
+        data << in.rdbuf();
+        names.push_back(iter->first);
+        contents.push_back(data.str());
+    }
+    int num_files = names.size();
+
+    C150NastyDgmSocket *sock = new C150NastyDgmSocket(0);
+    sock->setServerName(argv[1]);
+    sock->turnOnTimeouts(TIMEOUT_MS);
+    SESSION_TAG = makeSessionTag(newSessionId());
+
+    string dir_pilot = makeDirPilot(DirPilot(num_files, getDirHash(filehash)));
+    if (ask(sock, dir_pilot, "DPOK", MAX_TRIES).empty()) {
+        printf("No answer to directory pilot\n");
+        return 1;
+    }
+
+    bool ok = true;
+    bool held_pilot = false;   // whether the server held off a pilot yet
+    int next = num_files - 1;
+    while (next >= 0 && ok) {
+        // Pilot files, highest ID first, until the server has its fill
+        vector<int> open;
+        while (next >= 0 && open.size() < MAX_OPEN_FILES) {
+            string answer = pilotFile(sock, next, names[next],
+                                      filehash[names[next]], contents[next],
+                                      MAX_TRIES);
+            if (answer.compare(0, 4, "FPOK") == 0) {
+                open.push_back(next);
+            } else if (answer.compare(0, 4, "FPHV") != 0) {
+                printf("File %d: pilot answered \"%s\", is the target "
+                       "empty?\n", next, answer.c_str());
+                return 1;
+            }
+            next--;
+        }
+        printf("Piloted files down to %d, %d open\n", next + 1,
+               (int)open.size());
+        if (open.size() == MAX_OPEN_FILES && next >= 0 && !held_pilot) {
+            // With that many open, the server should take no more for now
+            if (!pilotFile(sock, next, names[next], filehash[names[next]],
+                           contents[next], HELD_PILOT_TRIES).empty()) {
+                printf("File %d: server took it with %d files open\n",
+                       next, (int)open.size());
+                ok = false;
+            }
+            held_pilot = true;
+        }
+
+        // Send the open files' packets interleaved
+        int most_packets = 0;
+        for (size_t i = 0; i < open.size(); i++)
+            most_packets = max(most_packets,
+                               packetsNeeded(contents[open[i]].size()));
+        for (int p = 0; p < most_packets; p++) {
+            for (size_t i = 0; i < open.size(); i++) {
+                if (p < packetsNeeded(contents[open[i]].size()))
+                    sendPackets(sock, open[i], contents[open[i]],
+                                set<int>({p}));
+            }
+        }
+
+        // Then ask after them, last piloted first, sending what is missing
+        for (auto id = open.rbegin(); id != open.rend(); id++) {
+            string prefix = "M" + to_string(*id) + " ";
+            while (true) {
+                string answer = ask(sock, "Q" + to_string(*id), prefix,
+                                    MAX_TRIES);
+                if (answer.empty()) {
+                    printf("File %d: no answer to query\n", *id);
+                    return 1;
+                }
+                set<int> missing = unpackRangeList(answer.substr(
+                                                       prefix.length()));
+                if (missing.empty())
+                    break;
+                sendPackets(sock, *id, contents[*id], missing);
+            }
+        }
+    }
+    if (!held_pilot) {
+        printf("Never had %d files open at once\n", (int)MAX_OPEN_FILES);
+        ok = false;
+    }
+
+    string answer = ask(sock, "E2E Ready", "E2E", MAX_TRIES);
+    for (int i = 0; i < 10; i++)
+        sendPacket(sock, "E2E received");
+    if (answer.compare(0, 4, "E2ES") != 0) {
+        printf("End-to-end check answered \"%s\"\n", answer.c_str());
+        ok = false;
+    }
+    printf("%s\n", ok ? "PASSED" : "FAILED");
+    delete sock;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+/*
+ * prefetch.cpp: Implements reading a directory's files ahead of the one
+ *               being sent
+ * Written by: Dylan Hoffmann and Lucas Campbell
+ */
+
+#include "prefetch.h"
+#include "utils.h"
+#include <cstdlib>
+
+using namespace std;
+
+FilePrefetcher::FilePrefetcher(const string &dir,
+                               const vector<PrefetchFile> &files,
+                               size_t budget, ThreadPool &pool,
+                               recursive_mutex *held_lock) :
+    dir(dir), files(files), slots(files.size()), budget(budget), held(0),
+    next(0), stopping(false), held_lock(held_lock), pool(pool)
+{
+    lock_guard<mutex> guard(lock);
+    startReads();
+}
+
+FilePrefetcher::~FilePrefetcher()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    // Reads already started have to finish, and may need the held lock
+    Unlocked unlocked(held_lock);
+    pool.wait();
+}
+
+bool FilePrefetcher::take(size_t i, string &data)
+{
+    {
+        Unlocked unlocked(held_lock);
+        unique_lock<mutex> guard(lock);
+        file_read.wait(guard, [this, i] { return slots[i].state == READ; });
+    }
+    lock_guard<mutex> guard(lock);
+    Slot &slot = slots[i];
+    data.swap(slot.data);
+    string().swap(slot.data);
+    slot.state = DONE;
+    held -= files[i].size;
+    startReads();
+    return slot.matched;
+}
+
+void FilePrefetcher::drop(size_t i)
+{
+    lock_guard<mutex> guard(lock);
+    Slot &slot = slots[i];
+    // A file still being read is let go of when its read finishes
+    if (slot.state == READ) {
+        string().swap(slot.data);
+        held -= files[i].size;
+    }
+    slot.state = DONE;
+    startReads();
+}
+
+/*
+ * startReads
+ * Start reading files, in order, for as long as the budget allows. Called
+ * with the lock held.
+ */
+void FilePrefetcher::startReads()
+{
+    while (!stopping && next < files.size()) {
+        if (slots[next].state == DONE) {
+            next++;       // dropped before we got to it
+            continue;
+        }
+        if (held > 0 && held + files[next].size > budget)
+            return;
+        size_t i = next++;
+        slots[i].state = READING;
+        held += files[i].size;
+        pool.submit([this, i] { read(i); });
+    }
+}
+
+/*
+ * read
+ * Read one file, on a worker, and leave it for take
+ */
+void FilePrefetcher::read(size_t i)
+{
+    size_t size;
+    unsigned char hash[SHA1_LEN];
+    char *data = getKnownFileChecksum(dir, files[i].name, files[i].checksum,
+                                      size, hash);
+    bool matched =
+        (string((const char *)hash, SHA1_LEN-1) == files[i].checksum);
+    string contents(data, size);
+    free(data);
+
+    lock_guard<mutex> guard(lock);
+    Slot &slot = slots[i];
+    if (slot.state == DONE) {
+        held -= files[i].size;       // dropped while we read it
+    }
+    else {
+        slot.data.swap(contents);
+        slot.matched = matched;
+        slot.state = READ;
+        file_read.notify_all();
+    }
+    startReads();
+}
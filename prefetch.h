@@ -0,0 +1,110 @@
+/*
+ * prefetch.h: Interface for reading a directory's files ahead of the one
+ *             being sent
+ * Written By Dylan Hoffmann & Lucas Campbell
+ *
+ * Reading a file off a nasty disk and sending it over a nasty network each
+ * take a while, and done one after the other the network sits idle during
+ * every read and the disk during every wait for the server. The client
+ * instead reads the next few files on worker threads while the current one
+ * is on the wire, holding no more of them in memory than a budget allows.
+ */
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include "threadpool.h"
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ * PrefetchFile
+ * A file to be read ahead
+ * Fields:
+ * * name: file name, within the prefetcher's directory
+ * * checksum: what the file hashed to when the directory was hashed
+ * * size: its size then, counted against the budget while it is held
+ */
+struct PrefetchFile {
+    std::string name;
+    std::string checksum;
+    size_t size;
+    PrefetchFile(std::string n, std::string c, size_t s) :
+        name(n), checksum(c), size(s) {}
+};
+
+/*
+ * FilePrefetcher
+ * Reads a list of files, in order, on worker threads, for the caller to
+ * take or drop in the same order
+ * Constructor args:
+ * * dir: directory the files are in
+ * * files: the files, in the order they will be taken
+ * * budget: bytes of file data that may be read ahead of the caller. A file
+ *           bigger than the budget is still read, on its own.
+ * * pool: the pool to read on, shared with whatever else the caller runs
+ *         there. It is waited on when the prefetcher is destroyed.
+ * * held_lock: a lock the caller holds, once, whenever it calls take or
+ *              destroys the prefetcher, and which reads may need (such as
+ *              GRADING_LOCK). It is let go of while waiting on reads. NULL
+ *              if there is none.
+ */
+class FilePrefetcher {
+public:
+    FilePrefetcher(const std::string &dir,
+                   const std::vector<PrefetchFile> &files, size_t budget,
+                   ThreadPool &pool, std::recursive_mutex *held_lock);
+    ~FilePrefetcher();
+
+    /*
+     * take
+     * Wait for a file to be read and hand over its contents
+     * Args:
+     * * i: index of the file in the list
+     * * data: filled with the file's contents
+     *
+     * Returns: true if they hash to the file's checksum, false if the file
+     *          changed since the directory was hashed
+     */
+    bool take(size_t i, std::string &data);
+
+    /*
+     * drop
+     * Say a file will not be taken, so it is not read if it has not been yet
+     * Args:
+     * * i: index of the file in the list
+     *
+     * Returns: None
+     */
+    void drop(size_t i);
+
+private:
+    enum SlotState { WAITING, READING, READ, DONE };
+    struct Slot {
+        SlotState state;
+        std::string data;
+        bool matched;
+        Slot() : state(WAITING), matched(false) {}
+    };
+
+    void startReads();
+    void read(size_t i);
+
+    std::string dir;
+    std::vector<PrefetchFile> files;
+    std::vector<Slot> slots;
+    size_t budget;
+    size_t held;       // bytes of files being read or read and not taken
+    size_t next;       // first file not yet started
+    bool stopping;
+    std::recursive_mutex *held_lock;
+    std::mutex lock;
+    std::condition_variable file_read;
+    ThreadPool &pool;
+
+    FilePrefetcher(const FilePrefetcher &) = delete;
+    FilePrefetcher &operator=(const FilePrefetcher &) = delete;
+};
+
+#endif
@@ -8,16 +8,22 @@
 #include <string>
 #include <cstdlib>
 #include <fstream>
+#include <sstream>
 #include <stdio.h>
 #include <iostream>
+#include <random>
+#include <cstring>
+#include <cctype>
+#include <climits>
 
 using namespace std;
 
 /*
  * Our UDP File Pilot packet is in the following format
- * "T ####### PPPPPPP HHHHHHHHHHHHHHHHHHHH FFFFFFF....."
+ * "TE####### PPPPPPP HHHHHHHHHHHHHHHHHHHH FFFFFFF....."
  * Where:
  * T is the packet type indicator for a file Pilot packet
+ * E is a space for plain data, otherwise a hex digit of ENCODING_* flags
  * # is the number of packets for the file == (file-size // 480) +1
  * P is the file ID
  * H is the SHA1 hash of the file
@@ -42,6 +48,8 @@ string makeFilePilot(FilePilot pilot_packet)
     // Pack File Name
     pack += pilot_packet.fname;
     pack[0] = 'P';
+    if (pilot_packet.encoding != 0)
+        pack[1] = "0123456789abcdef"[pilot_packet.encoding & 0xf];
     return pack;
 }
 
@@ -61,18 +69,24 @@ FilePilot unpackFilePilot(string packet)
     // Get file name
     string fname = packet.substr(39);
 
-    return FilePilot(num_packets, file_ID, hash, fname);      
+    // Get encoding flags
+    int encoding = 0;
+    if (packet[1] != ' ')
+        encoding = stoi(packet.substr(1, 1), NULL, 16);
+
+    return FilePilot(num_packets, file_ID, hash, fname, encoding);      
 
 }
 
 /*
  * Our UDP Directory Pilot packet is in the following format
- * "T ####### HHHHHHHHHHHHHHHHHHHH T..."
+ * "TE####### HHHHHHHHHHHHHHHHHHHH T..."
  * Where:
  * T is the packet type indicator for a Directory pilot packet
+ * E is a space, or a hex digit of the ENCODING_* flags the client may use
  * # is the number of files in the directory
  * H is the SHA1 hash of the directory
- * T... is a variable length field for the Target path (up to 465 bytes long)
+ * T... is the target subdirectory, if any, after a space (up to 450 bytes)
  */
 string makeDirPilot(DirPilot pilot_packet)
 {
@@ -84,6 +98,11 @@ string makeDirPilot(DirPilot pilot_packet)
     pack += " ";
     // Pack Dir Hash
     pack += pilot_packet.hash;
+    // Pack Target subdirectory
+    if (!pilot_packet.target.empty())
+        pack += " " + pilot_packet.target;
+    if (pilot_packet.encodings != 0)
+        pack[1] = "0123456789abcdef"[pilot_packet.encodings & 0xf];
     return pack;
 }
 
@@ -93,9 +112,19 @@ DirPilot unpackDirPilot(string packet)
     int num_files = stoi(packet.substr(2, MAX_FILENUM));
 
     // Get hash value for the directory
-    string hash = packet.substr(10);
+    string hash = packet.substr(10, SHA1_LEN-1);
+
+    // Get target subdirectory
+    string target;
+    if (packet.length() > 10 + SHA1_LEN)
+        target = packet.substr(10 + SHA1_LEN);
+
+    // Get encoding flags
+    int encodings = 0;
+    if (packet[1] != ' ')
+        encodings = stoi(packet.substr(1, 1), NULL, 16);
 
-    return DirPilot(num_files, hash);
+    return DirPilot(num_files, hash, encodings, target);
 }
 
 
@@ -103,14 +132,17 @@ DirPilot unpackDirPilot(string packet)
  * Our UDP File Data packet is in the following format
  * "T ####### PPPPPPP D....."
  * Where:
- * T is the packet type indicator for a File data packet
+ * T is the packet type indicator for a File data packet ('F'), or for data
+ *   the server sends on request: delta signatures ('G') or the list of
+ *   its chunk store ('K')
  * # is the packets number of this packet
  * P is the file ID
  * D... is a variable length field for the file data (up to 480 bytes long)
  */
-string makeFilePacket(FilePacket packet)
+string makeFilePacket(FilePacket packet, char type)
 {
     string pack = "F "; // Packet Type Indicator for FileData
+    pack[0] = type;
     // Pack Packet Number
     string num = to_string(packet.packet_num);
     int zeros = MAX_PACKNUM - num.length();
@@ -139,3 +171,166 @@ FilePacket unpackFilePacket(std::string packet)
 
     return FilePacket(packet_num, file_ID, data);
 }
+
+/*
+ * writeDigits
+ * Write 'value' as 'width' zero-padded decimal digits at 'field'
+ */
+static void writeDigits(char *field, int value, int width)
+{
+    for (int i = width-1; i >= 0; i--) {
+        field[i] = '0' + value % 10;
+        value /= 10;
+    }
+}
+
+/*
+ * readDigits
+ * Read 'width' decimal digits at 'field' into 'value'
+ * Returns: false if they are not all digits
+ */
+static bool readDigits(const char *field, int width, int &value)
+{
+    value = 0;
+    for (int i = 0; i < width; i++) {
+        if (field[i] < '0' || field[i] > '9')
+            return false;
+        value = value * 10 + (field[i] - '0');
+    }
+    return true;
+}
+
+// Offset of the data in a data packet, after "T ####### PPPPPPP "
+const size_t FILE_PACKET_HEADER_LEN = 2 + MAX_PACKNUM + 1 + MAX_FILENUM + 1;
+
+size_t writeFilePacket(char *buffer, const string &tag, int packet_num,
+                       int file_ID, const char *data, size_t len, char type)
+{
+    char *pack = buffer;
+    memcpy(pack, tag.data(), tag.length());
+    pack += tag.length();
+    pack[0] = type;
+    pack[1] = ' ';
+    writeDigits(pack + 2, packet_num, MAX_PACKNUM);
+    pack[2 + MAX_PACKNUM] = ' ';
+    writeDigits(pack + 3 + MAX_PACKNUM, file_ID, MAX_FILENUM);
+    pack[FILE_PACKET_HEADER_LEN - 1] = ' ';
+    memcpy(pack + FILE_PACKET_HEADER_LEN, data, len);
+    pack[FILE_PACKET_HEADER_LEN + len] = '\0';
+    return tag.length() + FILE_PACKET_HEADER_LEN + len + 1;
+}
+
+size_t readFilePacketHeader(const char *packet, size_t len, int &packet_num,
+                            int &file_ID)
+{
+    if (len < FILE_PACKET_HEADER_LEN ||
+        !readDigits(packet + 2, MAX_PACKNUM, packet_num) ||
+        !readDigits(packet + 3 + MAX_PACKNUM, MAX_FILENUM, file_ID))
+        return 0;
+    return FILE_PACKET_HEADER_LEN;
+}
+
+int packetsNeeded(size_t size)
+{
+    int num_packets = size / PACKET_SIZE;
+    if (size % PACKET_SIZE != 0 || num_packets == 0)
+        num_packets++;
+    return num_packets;
+}
+
+string makeRangeList(const set<int> &packets, size_t max_len)
+{
+    string list;
+    auto iter = packets.begin();
+    while (iter != packets.end()) {
+        // Extend the range as far as the packet numbers stay consecutive
+        int first = *iter;
+        int last = first;
+        for (iter++; iter != packets.end() && *iter == last+1; iter++)
+            last++;
+        string entry = to_string(first);
+        if (last != first)
+            entry += "-" + to_string(last);
+        size_t needed = entry.length() + (list.empty() ? 0 : 1);
+        if (list.length() + needed > max_len)
+            break;
+        if (!list.empty())
+            list += " ";
+        list += entry;
+    }
+    return list;
+}
+
+set<int> unpackRangeList(string list)
+{
+    set<int> packets;
+    stringstream in(list);
+    string entry;
+    while (in >> entry) {
+        // A garbled entry is skipped rather than trusted
+        const char *start = entry.c_str();
+        char *end;
+        if (!isdigit(start[0]))
+            continue;
+        long first = strtol(start, &end, 10);
+        long last = first;
+        if (*end == '-' && isdigit(end[1]))
+            last = strtol(end + 1, &end, 10);
+        if (*end != '\0' || last < first || last > INT_MAX)
+            continue;
+        for (long i = first; i <= last; i++)
+            packets.insert(packets.end(), i);
+    }
+    return packets;
+}
+
+/*
+ * Session tags are '#' followed by the 64 bit session id, six bits at a
+ * time, least significant first, in the base 64 digits below
+ */
+static const char SESSION_DIGITS[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+uint64_t newSessionId()
+{
+    random_device source;
+    return ((uint64_t)source() << 32) | source();
+}
+
+string makeSessionTag(uint64_t session_id)
+{
+    string tag = "#";
+    for (int i = 1; i < SESSION_TAG_LEN; i++) {
+        tag += SESSION_DIGITS[session_id & 0x3f];
+        session_id >>= 6;
+    }
+    return tag;
+}
+
+bool readSessionTag(const char *packet, size_t len, uint64_t &session_id)
+{
+    if (len < (size_t)SESSION_TAG_LEN || packet[0] != '#')
+        return false;
+    session_id = 0;
+    for (int i = SESSION_TAG_LEN-1; i > 0; i--) {
+        const char *digit = strchr(SESSION_DIGITS, packet[i]);
+        if (packet[i] == '\0' || digit == NULL)
+            return false;
+        session_id = (session_id << 6) | (digit - SESSION_DIGITS);
+    }
+    return true;
+}
+
+void appendUint32(string &buffer, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        buffer += (char)((value >> (8*i)) & 0xff);
+}
+
+uint32_t readUint32(const char *field)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++)
+        value |= (uint32_t)(unsigned char)field[i] << (8*i);
+    return value;
+}
@@ -6,6 +6,8 @@
 #define PROTOCOL_H
 
 #include<string>
+#include<set>
+#include<stdint.h>
 
 // number of digits allowed for number of files
 const int MAX_FILENUM = 7; 
@@ -15,6 +17,24 @@ const int MAX_PACKNUM = 7;
 const int FILE_PILOT_FIELDS = 5;
 // Size of data field in packet
 const int PACKET_SIZE = 480;
+// Largest datagram either side sends, including its terminating null
+const size_t PACKET_BUFFER_SIZE = 512;
+// Length of the tag naming its session at the front of every packet, from
+// client or server: '#' and the session id in base 64 digits
+const int SESSION_TAG_LEN = 12;
+
+// Encodings of the data sent for a file, carried as flags in its FilePilot.
+// With no flags set the packets carry the file contents as they are.
+// delta against the server's existing copy of the file (see delta.h)
+const int ENCODING_DELTA = 1;
+// list of content-defined chunks, new ones sent along and ones already sent
+// this session referred to by hash (see chunks.h)
+const int ENCODING_CHUNKS = 2;
+// zlib stream of what would otherwise be sent, so it may be combined with
+// any of the others (see compression.h)
+const int ENCODING_ZLIB = 4;
+// the file with its runs of zeros sent by length (see sparse.h)
+const int ENCODING_SPARSE = 8;
 
 
 /*
@@ -25,14 +45,18 @@ const int PACKET_SIZE = 480;
  * * int file_ID: numerical id of this file (incrememntal)
  * * string hash: SHA1 hash of file contents
  * * string fname: name of the file
+ * * int encoding: ENCODING_* flags describing how the packets for this file
+ *                 encode its contents. The hash is always of the decoded
+ *                 file.
  */  
 struct FilePilot {
     int num_packets;
     int file_ID;
     std::string hash;
     std::string fname;
-    FilePilot(int p, int i, std::string h, std::string f) :
-        num_packets(p), file_ID(i), hash(h), fname(f) {}
+    int encoding;
+    FilePilot(int p, int i, std::string h, std::string f, int e = 0) :
+        num_packets(p), file_ID(i), hash(h), fname(f), encoding(e) {}
 };
 
 /*
@@ -55,12 +79,18 @@ FilePilot unpackFilePilot(std::string packet);
  * Constructor args:
  * * int num_files: # files in this directory
  * * string hash: SHA1 hash of the directory
+ * * int encodings: ENCODING_* flags the client may use for files in this
+ *                  directory, so the server can prepare for them
+ * * string target: subdirectory of the server's target directory to copy
+ *                  into, or empty for the target directory itself
  */  
 struct DirPilot {
     int num_files;
     std::string hash;
-    DirPilot(int n, std::string h) :
-        num_files(n), hash(h) {}
+    int encodings;
+    std::string target;
+    DirPilot(int n, std::string h, int e = 0, std::string t = "") :
+        num_files(n), hash(h), encodings(e), target(t) {}
 };
 
 /*
@@ -97,10 +127,12 @@ struct FilePacket {
 };
 
 /*
- * Args: a struct containing info for a single data packet
+ * Args: a struct containing info for a single data packet, and the packet
+ *       type indicator to use: 'F' for file data, 'G' for the server's delta
+ *       signatures of a file, 'K' for the list of its chunk store
  * Returns: a string - packet with metadata of the pilot packet
  * */
-std::string makeFilePacket(FilePacket packet);
+std::string makeFilePacket(FilePacket packet, char type = 'F');
 
 /*
  * Args: a string containing pilot packet metadata
@@ -108,5 +140,80 @@ std::string makeFilePacket(FilePacket packet);
  * */
 FilePacket unpackFilePacket(std::string packet);
 
+/*
+ * Like makeFilePacket, for the data path: the packet is built straight into
+ * a buffer rather than in strings.
+ * Args: a buffer of PACKET_BUFFER_SIZE bytes, the session tag to start the
+ *       packet with, the packet's fields, with its data as 'len' bytes at
+ *       'data' (at most PACKET_SIZE), and its type indicator
+ * Returns: the length of the packet, including the null it ends with
+ * */
+size_t writeFilePacket(char *buffer, const std::string &tag, int packet_num,
+                       int file_ID, const char *data, size_t len,
+                       char type = 'F');
+
+/*
+ * Like unpackFilePacket, for the data path: the data is left where it is.
+ * Args: an untagged data packet as received and its length without the
+ *       null, and pass-by-reference packet number and file ID
+ * Returns: the offset of the packet's data, or 0 if the header is malformed
+ * */
+size_t readFilePacketHeader(const char *packet, size_t len, int &packet_num,
+                            int &file_ID);
+
+
+///////////////////
+/*
+ * Args: number of bytes of data to be sent
+ * Returns: number of packets needed to carry them. Always at least one, so
+ *          that empty files still have a (short) final packet.
+ * */
+int packetsNeeded(size_t size);
+
+/*
+ * Lists of packet numbers, as sent in 'missing' messages: space separated
+ * entries that are either a single number or an inclusive range "a-b".
+ * */
+/*
+ * Args: set of packet numbers, and the most characters the list may take
+ * Returns: the list, covering as many of the packets (lowest first) as fit
+ * */
+std::string makeRangeList(const std::set<int> &packets, size_t max_len);
+
+/*
+ * Args: a string containing a list made by makeRangeList
+ * Returns: the set of packet numbers it covers. Entries that are not a
+ *          number or a range of them are left out.
+ * */
+std::set<int> unpackRangeList(std::string list);
+
+/*
+ * Args: none
+ * Returns: a new random session id, for a client to tag its session with
+ * */
+uint64_t newSessionId();
+
+/*
+ * Args: a session id
+ * Returns: the SESSION_TAG_LEN character tag that starts each packet of the
+ *          session
+ * */
+std::string makeSessionTag(uint64_t session_id);
+
+/*
+ * Args: a packet as received and its length, and a pass-by-reference
+ *       session id
+ * Returns: false if the packet does not start with a session tag, otherwise
+ *          true with session_id set from it
+ * */
+bool readSessionTag(const char *packet, size_t len, uint64_t &session_id);
+
+/*
+ * Helpers for binary fields inside packet payloads. Integers are written
+ * as 4 little-endian bytes.
+ * */
+void appendUint32(std::string &buffer, uint32_t value);
+uint32_t readUint32(const char *field);
+
 
 #endif
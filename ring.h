@@ -0,0 +1,191 @@
+/*
+ * ring.h: Bounded lock-free queues for handing items between threads
+ * Written By Dylan Hoffmann & Lucas Campbell
+ *
+ * Both rings preallocate every slot up front, so passing an item never
+ * allocates, and keep what the producers and the consumer write on
+ * separate cache lines, so neither side keeps stealing the line the other
+ * is working on. Items are moved in and out in batches where possible, to
+ * pay for the atomic operations once per batch rather than once per item.
+ */
+#ifndef RING_H
+#define RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <stdint.h>
+
+// Size of a cache line on the machines we run on
+const size_t CACHE_LINE = 64;
+
+/*
+ * SpscRing
+ * Queue from exactly one producer thread to exactly one consumer thread
+ * Template args:
+ * * T: type of the slots, copied in and out
+ * * N: number of slots, a power of two
+ * Additional info: push and pushBatch may only be called by the producer,
+ * pop and popBatch only by the consumer.
+ */
+template <typename T, size_t N>
+class SpscRing {
+public:
+    SpscRing() : head(0), known_tail(0), tail(0), known_head(0) {}
+
+    /*
+     * pushBatch
+     * Add as many of 'count' items as there is room for, in order
+     * Returns: the number of items added, 0 if the ring is full
+     */
+    size_t pushBatch(const T *items, size_t count)
+    {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        // Only look at the consumer's index when we seem to be out of room
+        if (N - (pos - known_head) < count)
+            known_head = head.load(std::memory_order_acquire);
+        size_t room = N - (pos - known_head);
+        size_t n = (count < room) ? count : room;
+        for (size_t i = 0; i < n; i++)
+            slots[(pos + i) & (N-1)] = items[i];
+        tail.store(pos + n, std::memory_order_release);
+        return n;
+    }
+
+    /*
+     * popBatch
+     * Take up to 'max' items, oldest first
+     * Returns: the number of items taken, 0 if the ring is empty
+     */
+    size_t popBatch(T *items, size_t max)
+    {
+        size_t pos = head.load(std::memory_order_relaxed);
+        if (known_tail - pos < max)
+            known_tail = tail.load(std::memory_order_acquire);
+        size_t ready = known_tail - pos;
+        size_t n = (max < ready) ? max : ready;
+        for (size_t i = 0; i < n; i++)
+            items[i] = slots[(pos + i) & (N-1)];
+        head.store(pos + n, std::memory_order_release);
+        return n;
+    }
+
+    bool push(const T &item) { return pushBatch(&item, 1) == 1; }
+    bool pop(T &item) { return popBatch(&item, 1) == 1; }
+
+private:
+    static_assert(N > 0 && (N & (N-1)) == 0, "ring size must be a power of two");
+
+    // Consumer's side: where it takes from, and its last look at the tail
+    alignas(CACHE_LINE) std::atomic<size_t> head;
+    size_t known_tail;
+    // Producer's side: where it adds at, and its last look at the head
+    alignas(CACHE_LINE) std::atomic<size_t> tail;
+    size_t known_head;
+    alignas(CACHE_LINE) T slots[N];
+
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+};
+
+/*
+ * MpscRing
+ * Queue from any number of producer threads to exactly one consumer thread.
+ * Each slot carries a sequence number saying whose turn it is: a producer
+ * claims slots by advancing the shared tail, fills them and then publishes
+ * each one by bumping its sequence, so the consumer never sees a slot that
+ * is still being filled.
+ * Template args:
+ * * T: type of the slots, copied in and out
+ * * N: number of slots, a power of two
+ * Additional info: pop and popBatch may only be called by the consumer.
+ */
+template <typename T, size_t N>
+class MpscRing {
+public:
+    MpscRing() : head(0), tail(0)
+    {
+        for (size_t i = 0; i < N; i++)
+            slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    /*
+     * pushBatch
+     * Add as many of 'count' items as there is room for, in order. Items
+     * pushed by one call are never interleaved with another producer's.
+     * Returns: the number of items added, 0 if the ring is full
+     */
+    size_t pushBatch(const T *items, size_t count)
+    {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        while (count > 0) {
+            intptr_t lag = (intptr_t)(seqAt(pos) - pos);
+            if (lag < 0)
+                return 0;    // the consumer has not got to this slot yet
+            if (lag > 0) {
+                pos = tail.load(std::memory_order_relaxed);
+                continue;    // another producer got here first
+            }
+            // Slots are freed in order, so if the last one we want is free
+            // all of them are
+            size_t n = count;
+            while (n > 1 && seqAt(pos + n - 1) != pos + n - 1)
+                n--;
+            if (tail.compare_exchange_weak(pos, pos + n,
+                                           std::memory_order_relaxed)) {
+                for (size_t i = 0; i < n; i++) {
+                    Slot &slot = slots[(pos + i) & (N-1)];
+                    slot.item = items[i];
+                    slot.seq.store(pos + i + 1, std::memory_order_release);
+                }
+                return n;
+            }
+        }
+        return 0;
+    }
+
+    /*
+     * popBatch
+     * Take up to 'max' items, oldest first. Stops early at a slot that has
+     * been claimed but not yet filled.
+     * Returns: the number of items taken, 0 if there are none ready
+     */
+    size_t popBatch(T *items, size_t max)
+    {
+        size_t n = 0;
+        for (; n < max; n++) {
+            Slot &slot = slots[(head + n) & (N-1)];
+            if (slot.seq.load(std::memory_order_acquire) != head + n + 1)
+                break;
+            items[n] = slot.item;
+            // Free the slot for the producer one lap later
+            slot.seq.store(head + n + N, std::memory_order_release);
+        }
+        head += n;
+        return n;
+    }
+
+    bool push(const T &item) { return pushBatch(&item, 1) == 1; }
+    bool pop(T &item) { return popBatch(&item, 1) == 1; }
+
+private:
+    static_assert(N > 0 && (N & (N-1)) == 0, "ring size must be a power of two");
+
+    struct Slot {
+        std::atomic<size_t> seq;
+        T item;
+    };
+    size_t seqAt(size_t pos)
+    {
+        return slots[pos & (N-1)].seq.load(std::memory_order_acquire);
+    }
+
+    // Only the consumer uses the head, so it need not be atomic
+    alignas(CACHE_LINE) size_t head;
+    alignas(CACHE_LINE) std::atomic<size_t> tail;
+    alignas(CACHE_LINE) Slot slots[N];
+
+    MpscRing(const MpscRing &) = delete;
+    MpscRing &operator=(const MpscRing &) = delete;
+};
+
+#endif
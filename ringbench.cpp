@@ -0,0 +1,221 @@
+/*
+ * ringbench.cpp: Measures how many packets a second the rings in ring.h
+ *                pass between threads, against a mutex-protected queue
+ * Written by: Dylan Hoffmann and Lucas Campbell
+ *
+ * Usage: ringbench [<packets>]
+ *
+ * Each packet carries the number of the producer that made it and its
+ * place in that producer's sequence. The consumer checks that every
+ * producer's packets come out complete and in the order they went in, and
+ * ringbench exits 1 if any did not.
+ */
+
+#include "ring.h"
+#include "protocol.h"
+#include <iostream>
+#include <queue>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+
+using namespace std;
+
+// A packet as read off the socket
+struct BenchPacket {
+    size_t len;
+    char data[512];
+};
+
+const size_t RING_SLOTS = 1024;
+const size_t BATCH = 32;
+const int PRODUCERS = 4;
+
+/*
+ * fillPacket
+ * Make packet number 'seq' of producer 'producer' look like a data packet,
+ * so copying it costs what copying a real one does
+ */
+static void fillPacket(BenchPacket &packet, size_t producer, size_t seq)
+{
+    packet.len = PACKET_SIZE;
+    memset(packet.data, 'a' + seq % 26, PACKET_SIZE);
+    memcpy(packet.data, &producer, sizeof(producer));
+    memcpy(packet.data + sizeof(producer), &seq, sizeof(seq));
+}
+
+/*
+ * OrderCheck
+ * Follows the packets a consumer takes out, one expected sequence number
+ * per producer
+ */
+struct OrderCheck {
+    vector<size_t> next;
+    bool in_order;
+
+    OrderCheck(size_t producers) : next(producers, 0), in_order(true) {}
+
+    // Take note of one packet, which must be the next of its producer
+    void see(const BenchPacket &packet)
+    {
+        size_t producer, seq;
+        memcpy(&producer, packet.data, sizeof(producer));
+        memcpy(&seq, packet.data + sizeof(producer), sizeof(seq));
+        if (producer >= next.size() || seq != next[producer])
+            in_order = false;
+        else
+            next[producer]++;
+    }
+
+    // True if each producer's 'share' packets all came out, in order
+    bool complete(size_t share) const
+    {
+        for (size_t p = 0; p < next.size(); p++)
+            if (next[p] != share)
+                return false;
+        return in_order;
+    }
+};
+
+/*
+ * report
+ * Print the rate at which 'packets' packets went through in 'seconds', and
+ * whether the consumer saw every producer's packets in order
+ *
+ * Returns: true if it did
+ */
+static bool report(const char *name, size_t packets, double seconds,
+                   bool in_order)
+{
+    cout << name << ": " << (size_t)(packets / seconds) << " packets/sec"
+         << (in_order ? "" : "  (OUT OF ORDER)") << endl;
+    return in_order;
+}
+
+/*
+ * consumeBatches
+ * Pop from a ring until 'packets' packets have come out, checking each
+ * producer's come out in order
+ *
+ * Returns: true if the 'producers' producers' packets all came out in order
+ */
+template <typename Ring>
+static bool consumeBatches(Ring &ring, size_t packets, size_t producers)
+{
+    vector<BenchPacket> batch(BATCH);
+    OrderCheck check(producers);
+    size_t received = 0;
+    while (received < packets) {
+        size_t n = ring.popBatch(batch.data(), BATCH);
+        for (size_t i = 0; i < n; i++)
+            check.see(batch[i]);
+        received += n;
+        if (n == 0)
+            this_thread::yield();
+    }
+    return check.complete(packets / producers);
+}
+
+/*
+ * produceBatches
+ * Push packets [0, count) of producer 'producer' into a ring in batches
+ */
+template <typename Ring>
+static void produceBatches(Ring &ring, size_t producer, size_t count)
+{
+    vector<BenchPacket> batch(BATCH);
+    size_t sent = 0;
+    while (sent < count) {
+        size_t n = min(BATCH, count - sent);
+        for (size_t i = 0; i < n; i++)
+            fillPacket(batch[i], producer, sent + i);
+        size_t pushed = 0;
+        while (pushed < n) {
+            size_t k = ring.pushBatch(batch.data() + pushed, n - pushed);
+            if (k == 0)
+                this_thread::yield();
+            pushed += k;
+        }
+        sent += n;
+    }
+}
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start)
+           .count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t packets = (argc > 1) ? strtoul(argv[1], NULL, 10) : 5000000;
+    packets -= packets % PRODUCERS;
+    bool in_order = true;
+    cout << packets << " packets of " << PACKET_SIZE << " bytes, batches of "
+         << BATCH << ", " << RING_SLOTS << " slots" << endl;
+
+    // The baseline: a std::queue behind a mutex, one packet at a time
+    {
+        queue<BenchPacket> q;
+        mutex lock;
+        auto start = chrono::steady_clock::now();
+        thread producer([&] {
+            BenchPacket packet;
+            for (size_t i = 0; i < packets; i++) {
+                fillPacket(packet, 0, i);
+                lock_guard<mutex> guard(lock);
+                q.push(packet);
+            }
+        });
+        OrderCheck check(1);
+        for (size_t received = 0; received < packets; ) {
+            BenchPacket packet;
+            {
+                lock_guard<mutex> guard(lock);
+                if (q.empty())
+                    continue;
+                packet = q.front();
+                q.pop();
+            }
+            check.see(packet);
+            received++;
+        }
+        producer.join();
+        in_order &= report("mutex queue, 1 producer", packets,
+                           secondsSince(start), check.complete(packets));
+    }
+
+    {
+        SpscRing<BenchPacket, RING_SLOTS> *ring =
+            new SpscRing<BenchPacket, RING_SLOTS>;
+        auto start = chrono::steady_clock::now();
+        thread producer([&] { produceBatches(*ring, 0, packets); });
+        bool ok = consumeBatches(*ring, packets, 1);
+        producer.join();
+        in_order &= report("SPSC ring, 1 producer", packets,
+                           secondsSince(start), ok);
+        delete ring;
+    }
+
+    {
+        MpscRing<BenchPacket, RING_SLOTS> *ring =
+            new MpscRing<BenchPacket, RING_SLOTS>;
+        auto start = chrono::steady_clock::now();
+        vector<thread> producers;
+        size_t share = packets / PRODUCERS;
+        for (int p = 0; p < PRODUCERS; p++)
+            producers.push_back(thread([&, p] {
+                produceBatches(*ring, p, share);
+            }));
+        bool ok = consumeBatches(*ring, packets, PRODUCERS);
+        for (size_t p = 0; p < producers.size(); p++)
+            producers[p].join();
+        in_order &= report("MPSC ring, 4 producers", packets,
+                           secondsSince(start), ok);
+        delete ring;
+    }
+    return in_order ? 0 : 1;
+}
@@ -0,0 +1,191 @@
+/*
+ * session.h: State the server keeps for each client it is serving
+ * Written By Dylan Hoffmann & Lucas Campbell
+ *
+ * The server answers every packet as it arrives, so all it knows about a
+ * transfer in progress lives here rather than on the stack of a loop
+ * waiting for that client's next packet. That lets one server interleave
+ * any number of clients.
+ */
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "protocol.h"
+#include "utils.h"
+#include "journal.h"
+#include "chunks.h"
+#include <string>
+#include <set>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <ctime>
+
+/*
+ * FileReceipt
+ * A file the server has answered the pilot of and is collecting packets for
+ * Fields:
+ * * file_pilot: pilot of the file, replaced if the client switches to an
+ *               encoding we offered
+ * * file_data: reassembly buffer, see startReassembly
+ * * packets: packet numbers still missing from file_data
+ * * journal: where received packets are saved in case the server dies, or
+ *            NULL if the file is not journaled
+ * * unsaved: packets received but not yet saved to the journal
+ * * received_hash, hashed_packets: running hash of the in-order prefix of
+ *                                  the received packets
+ * * response: our answer to the file's pilot, repeated if the client did
+ *             not get it
+ * * signatures, base_data, block_size: the delta we offered, if any: our
+ *                                      block signatures, the copy of the
+ *                                      file they are of and their block size
+ * * recovered: packets recovered from an earlier run's journal
+ * * started: true once data has arrived, after which the client cannot
+ *            change the pilot
+ */
+struct FileReceipt {
+    FilePilot file_pilot;
+    std::string file_data;
+    std::set<int> packets;
+    ReceiveJournal *journal;
+    std::vector<int> unsaved;
+    ChecksumContext received_hash;
+    int hashed_packets;
+    std::string response;
+    std::string signatures;
+    std::string base_data;
+    size_t block_size;
+    int recovered;
+    bool started;
+    FileReceipt(FilePilot fp) :
+        file_pilot(fp), journal(NULL), hashed_packets(0), block_size(0),
+        recovered(0), started(false) {}
+};
+
+/*
+ * FileWrite
+ * A file received in full, or to be copied from one the target holds,
+ * handed to a disk worker to be decoded, written and checked
+ * Fields:
+ * * receipt: the file's receipt, deleted by the worker once written, or
+ *            NULL for a copy
+ * * data_hash: hash of the data as received
+ * * ok: set by the worker, true if the file passed the internal check
+ * * written_hash: set by the worker to the hash of what ended up in the
+ *                 target, if anything did
+ */
+struct FileWrite {
+    FileReceipt *receipt;
+    unsigned char data_hash[SHA1_LEN];
+    bool ok;
+    std::string written_hash;
+    FileWrite(FileReceipt *r) : receipt(r), ok(false) {}
+};
+
+/*
+ * FilePreparation
+ * A file whose pilot waits on a disk worker to recover what an earlier run
+ * journaled of it and to read the target's older copy of it, before we
+ * answer
+ * Fields:
+ * * receipt: the file's receipt, the worker's until it is done
+ * * complete: set by the worker if the journal held all of the file
+ * * data_hash: set by the worker to the hash of the file, if complete
+ */
+struct FilePreparation {
+    FileReceipt *receipt;
+    bool complete;
+    unsigned char data_hash[SHA1_LEN];
+    FilePreparation(FileReceipt *r) : receipt(r), complete(false) {}
+};
+
+struct Session;
+
+/*
+ * DiskJob
+ * Disk work for a session, done by a worker thread so the session's shard
+ * can keep answering packets meanwhile
+ * Fields:
+ * * work: run by a worker. Must not touch the session.
+ * * done: run on the session's shard once work is finished, to bring the
+ *         result into the session
+ */
+struct DiskJob {
+    std::function<void()> work;
+    std::function<void(Session &)> done;
+};
+
+/*
+ * Session
+ * One client's copy of a directory
+ * Fields:
+ * * id: session id the client tags its packets with
+ * * tag: the tag itself, which we put on our answers too
+ * * target_dir: directory the files are written to
+ * * dir_pilot: the client's directory pilot
+ * * existing: {filename, checksum} of the target before the transfer
+ * * filehash: {filename, checksum} of the target as files are written
+ * * by_hash: index of the files in the target by content, checksum ->
+ *            filename
+ * * have_files: IDs of files the client was told to skip
+ * * failed_e2es: IDs of files that failed the server-side internal check
+ * * received_files: IDs of files fully received, though perhaps still
+ *                   being written, or skipped. Files may finish in any
+ *                   order, so one slow file holds up no others.
+ * * receipts: files being received, by ID
+ * * preparing: IDs of files whose pilot waits on a FilePreparation
+ * * chunks: where chunks of files received this session are, if the
+ *           client chunks files, or NULL
+ * * store_summary: names of the chunks in the chunk store, as advertised
+ *                  to this client
+ * * e2e_response: our end-to-end answer, once every file is in
+ * * last_heard: when the client last sent us anything
+ * * ready: false until the target has been hashed, meanwhile the client
+ *          gets no answers
+ * * disk_jobs: disk work queued for the session, run one at a time in
+ *              order; the first is the one running
+ * * writing: names of the files disk_jobs will write, which are not to be
+ *            copied from meanwhile
+ */
+struct Session {
+    uint64_t id;
+    std::string tag;
+    std::string target_dir;
+    DirPilot dir_pilot;
+    std::map<std::string, std::string> existing;
+    std::map<std::string, std::string> filehash;
+    std::multimap<std::string, std::string> by_hash;
+    std::set<int> have_files;
+    std::vector<std::string> failed_e2es;
+    std::set<int> received_files;
+    std::map<int, FileReceipt *> receipts;
+    std::set<int> preparing;
+    ChunkIndex *chunks;
+    std::string store_summary;
+    std::string e2e_response;
+    time_t last_heard;
+    bool ready;
+    std::deque<DiskJob> disk_jobs;
+    std::set<std::string> writing;
+    Session(uint64_t i, std::string t, DirPilot dp) :
+        id(i), tag(makeSessionTag(i)), target_dir(t), dir_pilot(dp),
+        chunks(NULL), last_heard(time(NULL)), ready(false) {}
+};
+
+/*
+ * SessionTable
+ * Every session the server knows of, looked up by id for each packet
+ * Fields:
+ * * live: sessions in progress
+ * * ended: when each recently ended session ended. Its client may still
+ *          have packets on the way, a repeated DirPilot among them, which
+ *          must not start the session over.
+ */
+struct SessionTable {
+    std::unordered_map<uint64_t, Session *> live;
+    std::unordered_map<uint64_t, time_t> ended;
+};
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * shard.h: State of the thread that serves the server's sessions
+ * Written By Dylan Hoffmann & Lucas Campbell
+ *
+ * The comp150 socket answers whoever sent the packet it read last, so
+ * every packet but data has to be answered before the next read. All
+ * sessions are therefore served by the thread that reads the socket.
+ * Spreading them across threads of their own (fileserver -n) was tried
+ * and taken out: with that thread waiting on the others for every
+ * answer, it was slower than serving them itself.
+ */
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "protocol.h"
+#include "session.h"
+#include "ring.h"
+#include "packetpool.h"
+#include <vector>
+
+/*
+ * ShardPacket
+ * A packet as read, for the shard to serve
+ * Fields:
+ * * session_id: id of the session the packet is tagged with
+ * * len: length of the packet, without the null after it
+ * * data: the packet, tag and all, null terminated
+ */
+struct ShardPacket {
+    uint64_t session_id;
+    size_t len;
+    char data[PACKET_BUFFER_SIZE];
+};
+
+/*
+ * Reply
+ * A packet the shard has built to answer its client with, sent before
+ * the next read
+ * Fields:
+ * * buffer: the packet
+ * * len: how much of the buffer to send
+ */
+struct Reply {
+    PacketBuffer buffer;
+    size_t len;
+    Reply(PacketBuffer b, size_t l) : buffer(std::move(b)), len(l) {}
+};
+
+/*
+ * Shard
+ * The sessions being served, and what is on its way to them
+ * Fields:
+ * * sessions: the sessions
+ * * finished_jobs: sessions whose running disk job a worker has finished.
+ *                  A session has one job running at most, so this only
+ *                  fills up with more sessions than it has slots.
+ * * replies: packets to send in answer to the one being served
+ */
+struct Shard {
+    SessionTable sessions;
+    MpscRing<uint64_t, 1024> finished_jobs;
+    std::vector<Reply> replies;
+};
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * sparse.cpp: Implements zero run lists
+ * Written by: Dylan Hoffmann and Lucas Campbell
+ *
+ * A zero run list is a sequence of entries:
+ *   'D' | length (4 bytes) | bytes   -- data sent as it is
+ *   'Z' | length (4 bytes)           -- that many zero bytes
+ */
+
+#include "sparse.h"
+#include "protocol.h"
+#include <cstring>
+#include <stdint.h>
+
+using namespace std;
+
+const char RUN_DATA = 'D';
+const char RUN_ZEROS = 'Z';
+// Longest stretch one entry covers, to stay within its 4 byte length
+const size_t RUN_MAX_LEN = 1UL << 30;
+
+/*
+ * zeroRunLength
+ * Number of zero bytes at the start of a block, checked a word at a time
+ */
+static size_t zeroRunLength(const char *data, size_t len)
+{
+    size_t i = 0;
+    uint64_t word;
+    for (; i + sizeof(word) <= len; i += sizeof(word)) {
+        memcpy(&word, data + i, sizeof(word));
+        if (word != 0)
+            break;
+    }
+    while (i < len && data[i] == '\0')
+        i++;
+    return i;
+}
+
+/*
+ * appendRun
+ * Add entries for 'len' bytes of data (or zeros if 'data' is NULL)
+ */
+static void appendRun(string &list, const char *data, size_t len)
+{
+    while (len > 0) {
+        size_t piece = min(len, RUN_MAX_LEN);
+        list += (data == NULL) ? RUN_ZEROS : RUN_DATA;
+        appendUint32(list, piece);
+        if (data != NULL) {
+            list.append(data, piece);
+            data += piece;
+        }
+        len -= piece;
+    }
+}
+
+bool isAllZero(const char *data, size_t len)
+{
+    return zeroRunLength(data, len) == len;
+}
+
+string makeZeroRunList(const string &data)
+{
+    string list;
+    const char *bytes = data.data();
+    size_t size = data.size();
+    size_t data_start = 0;
+    size_t pos = 0;
+    while (pos < size) {
+        // memchr is about as fast a way to skip nonzero data as there is
+        const char *zero = (const char *)memchr(bytes + pos, 0, size - pos);
+        if (zero == NULL)
+            break;
+        pos = zero - bytes;
+        size_t run = zeroRunLength(bytes + pos, size - pos);
+        if (run >= ZERO_RUN_MIN) {
+            appendRun(list, bytes + data_start, pos - data_start);
+            appendRun(list, NULL, run);
+            data_start = pos + run;
+        }
+        pos += run;
+    }
+    appendRun(list, bytes + data_start, size - data_start);
+    return list;
+}
+
+bool applyZeroRunList(const string &list, string &result)
+{
+    result.clear();
+    size_t pos = 0;
+    while (pos < list.size()) {
+        char op = list[pos++];
+        if (pos + 4 > list.size())
+            return false;
+        size_t len = readUint32(list.data() + pos);
+        pos += 4;
+        if (op == RUN_DATA) {
+            if (pos + len > list.size())
+                return false;
+            result.append(list, pos, len);
+            pos += len;
+        }
+        else if (op == RUN_ZEROS)
+            result.append(len, '\0');
+        else
+            return false;
+    }
+    return true;
+}
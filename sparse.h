@@ -0,0 +1,48 @@
+/*
+ * sparse.h: Interface for sending the runs of zeros in a file by length
+ * Written By Dylan Hoffmann & Lucas Campbell
+ *
+ * Disk images, preallocated databases and the like are mostly zeros, which
+ * there is no point sending 480 bytes at a time. A file in ENCODING_SPARSE
+ * is sent as a zero run list: its nonzero stretches are sent as they are,
+ * and each long enough run of zeros as just its length. The server leaves
+ * zero blocks as holes when it writes the file.
+ */
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <string>
+
+// Shortest run of zeros worth its own entry in a zero run list
+const size_t ZERO_RUN_MIN = 256;
+
+/*
+ * isAllZero
+ * Args:
+ * * data: pointer to a block of memory
+ * * len: its length
+ *
+ * Returns: true if every byte of the block is zero
+ */
+bool isAllZero(const char *data, size_t len);
+
+/*
+ * makeZeroRunList
+ * Args:
+ * * data: contents of a file
+ *
+ * Returns: the zero run list describing 'data'
+ */
+std::string makeZeroRunList(const std::string &data);
+
+/*
+ * applyZeroRunList
+ * Args:
+ * * list: zero run list from makeZeroRunList
+ * * result: pass-by-reference string, filled with the rebuilt file
+ *
+ * Returns: false if the list is malformed
+ */
+bool applyZeroRunList(const std::string &list, std::string &result);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * File for testing content-defined chunking: every chunk list must rebuild
+ * the file it was made from, whether its chunks are sent, repeated within
+ * the file or found in files received earlier, and a damaged list must be
+ * refused rather than misapplied
+ */
+
+#include "chunks.h"
+#include "utils.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <set>
+#include <vector>
+#include <unistd.h>
+using namespace std;
+
+int FAILURES = 0;
+string DIR_NAME;
+
+void check(bool ok, const string &what)
+{
+    printf("%s: %s\n", ok ? "ok  " : "FAIL", what.c_str());
+    if (!ok)
+        FAILURES++;
+}
+
+string randomData(size_t len)
+{
+    string data(len, '\0');
+    for (size_t i = 0; i < len; i++)
+        data[i] = rand() % 256;
+    return data;
+}
+
+// Put a file in the test directory, as the server writes a received one
+void writeFile(const string &fname, const string &data)
+{
+    FILE *file = fopen(makeFileName(DIR_NAME, fname).c_str(), "wb");
+    fwrite(data.data(), 1, data.size(), file);
+    fclose(file);
+}
+
+// Chunk 'data' and rebuild it, with 'sent' and 'index' as left by the
+// files before it
+bool roundTrip(const string &data, set<string> &sent, ChunkIndex &index,
+               string &list)
+{
+    vector<string> added;
+    list = makeChunkList(data, sent, set<string>(), added);
+    string result;
+    return applyChunkList(list, index, result) && result == data;
+}
+
+// Chunks end in order at the end of the data, none too big, and none too
+// small but the last
+bool chunksInBounds(const string &data)
+{
+    vector<size_t> ends = findChunks(data);
+    size_t start = 0;
+    for (size_t i = 0; i < ends.size(); i++) {
+        size_t len = ends[i] - start;
+        if (ends[i] <= start || len > CHUNK_MAX_SIZE ||
+            (i + 1 < ends.size() && len < CHUNK_MIN_SIZE))
+            return false;
+        start = ends[i];
+    }
+    return start == data.size();
+}
+
+int main()
+{
+    srand(117);
+    char dir_template[] = "/tmp/chunkstestXXXXXX";
+    if (mkdtemp(dir_template) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    DIR_NAME = dir_template;
+    ChunkIndex index(DIR_NAME, NULL);
+    set<string> sent;
+    string list;
+
+    check(findChunks("").empty() && roundTrip("", sent, index, list) &&
+          list.empty(), "empty file");
+    string tiny = randomData(100);
+    check(findChunks(tiny).size() == 1 && roundTrip(tiny, sent, index, list),
+          "file shorter than one chunk");
+
+    string zeros(300 * 1024, '\0');
+    check(chunksInBounds(zeros) && roundTrip(zeros, sent, index, list) &&
+          list.size() < zeros.size() / 2,
+          "all zeros, repeated chunks sent once");
+
+    string first = randomData(200 * 1024);
+    check(chunksInBounds(first) && roundTrip(first, sent, index, list),
+          "random file");
+    writeFile("first", first);
+    index.addFile("first", first);
+
+    // A later file sharing most of the first's chunks refers to them
+    string second = first.substr(0, 50000) + randomData(300) +
+                    first.substr(50000);
+    check(roundTrip(second, sent, index, list) &&
+          list.size() < second.size() / 4,
+          "edited copy of an earlier file, its chunks referred to");
+    string second_list = list;
+
+    // Damaged lists are refused, or at least never pass for the file
+    string result;
+    bool refused = true;
+    for (size_t len = 0; len < second_list.size(); len++) {
+        if (applyChunkList(second_list.substr(0, len), index, result) &&
+            result == second)
+            refused = false;
+    }
+    check(refused, "every truncation of a chunk list");
+    check(!applyChunkList("X", index, result), "unknown entry");
+    check(!applyChunkList("N\x10", index, result), "new chunk cut short");
+    check(!applyChunkList("R" + string(SHA1_LEN-1, 'x'), index, result),
+          "reference to an unknown chunk");
+
+    // A chunk whose file has changed since cannot be had from it
+    string changed = first;
+    for (size_t i = 0; i < changed.size(); i += 1000)
+        changed[i] ^= 0xff;
+    writeFile("first", changed);
+    ChunkIndex fresh_index(DIR_NAME, NULL);
+    fresh_index.addFile("first", first);
+    check(!applyChunkList(second_list, fresh_index, result),
+          "reference to a chunk of a file changed since");
+
+    unlink(makeFileName(DIR_NAME, "first").c_str());
+    rmdir(DIR_NAME.c_str());
+
+    printf("%s\n", FAILURES == 0 ? "PASSED" : "FAILED");
+    return FAILURES == 0 ? 0 : 1;
+}
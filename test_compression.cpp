@@ -0,0 +1,88 @@
+/*
+ * File for testing compression of the data sent for a file: every stream
+ * must decompress to what was compressed, a damaged one must be refused,
+ * and only data that shrinks should be picked for compressing
+ */
+
+#include "compression.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+using namespace std;
+
+int FAILURES = 0;
+
+void check(bool ok, const string &what)
+{
+    printf("%s: %s\n", ok ? "ok  " : "FAIL", what.c_str());
+    if (!ok)
+        FAILURES++;
+}
+
+string randomData(size_t len)
+{
+    string data(len, '\0');
+    for (size_t i = 0; i < len; i++)
+        data[i] = rand() % 256;
+    return data;
+}
+
+string textData(size_t len)
+{
+    const char *words[] = { "packet ", "server ", "client ", "nasty ",
+                            "file ", "checksum ", "pilot ", "\n" };
+    string data;
+    while (data.size() < len)
+        data += words[rand() % 8];
+    data.resize(len);
+    return data;
+}
+
+bool roundTrip(const string &data, string &packed)
+{
+    packed = compressData(data);
+    string result;
+    return decompressData(packed, result) && result == data;
+}
+
+int main()
+{
+    srand(117);
+    string packed, result;
+
+    check(roundTrip("", packed) && !worthCompressing(""), "empty data");
+    check(roundTrip("x", packed), "a single byte");
+    string zeros(1 << 20, '\0');
+    check(roundTrip(zeros, packed) && packed.size() < zeros.size() / 100 &&
+          worthCompressing(zeros), "all zeros");
+    string text = textData(3 << 20);
+    check(roundTrip(text, packed) && packed.size() < text.size() / 2 &&
+          worthCompressing(text), "text, over many inflate steps");
+    string noise = randomData(1 << 20);
+    check(roundTrip(noise, packed) && !worthCompressing(noise),
+          "random data, passed over");
+
+    // Damaged streams are refused, or at least never pass for the data
+    string small = textData(5000);
+    packed = compressData(small);
+    bool refused = true;
+    for (size_t len = 0; len < packed.size(); len++) {
+        if (decompressData(packed.substr(0, len), result))
+            refused = false;
+    }
+    check(refused, "every truncation of a stream");
+    refused = true;
+    for (size_t i = 0; i < packed.size(); i++) {
+        string garbled = packed;
+        garbled[i] ^= 0x5a;
+        if (decompressData(garbled, result) && result == small)
+            refused = false;
+    }
+    check(refused, "every byte of a stream garbled");
+    check(!decompressData(packed + "extra", result),
+          "trailing bytes after a stream");
+    check(!decompressData(small, result), "data that is not a stream");
+
+    printf("%s\n", FAILURES == 0 ? "PASSED" : "FAILED");
+    return FAILURES == 0 ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+/*
+ * File for testing delta encoding: every delta must rebuild the file it
+ * was made from, and a damaged one must be refused rather than misapplied
+ */
+
+#include "delta.h"
+#include "protocol.h"
+#include "utils.h"
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+using namespace std;
+
+int FAILURES = 0;
+
+void check(bool ok, const string &what)
+{
+    printf("%s: %s\n", ok ? "ok  " : "FAIL", what.c_str());
+    if (!ok)
+        FAILURES++;
+}
+
+string randomData(size_t len)
+{
+    string data(len, '\0');
+    for (size_t i = 0; i < len; i++)
+        data[i] = rand() % 256;
+    return data;
+}
+
+// Delta 'data' against 'base' and back again
+bool roundTrip(const string &base, const string &data, size_t block_size,
+               string &delta)
+{
+    string signatures = makeSignatures(base, block_size);
+    delta = makeDelta(data, signatures, block_size);
+    string result;
+    return applyDelta(base, delta, block_size, result) && result == data;
+}
+
+int main()
+{
+    srand(117);
+    const size_t block = 4 * PACKET_SIZE;
+    string base = randomData(10 * block + 123);
+    string delta;
+
+    check(roundTrip("", "", block, delta) && delta.empty(),
+          "empty file against empty base");
+    check(roundTrip(base, "", block, delta), "empty file against a base");
+    check(roundTrip("", base, block, delta), "file against empty base");
+    check(roundTrip(base, base.substr(0, 100), block, delta),
+          "file shorter than one block");
+    check(roundTrip(base.substr(0, 100), base, block, delta),
+          "base shorter than one block");
+
+    string zeros(10 * block + block / 2, '\0');
+    check(roundTrip(zeros, zeros, block, delta) && delta.size() < block,
+          "all zeros against itself, copied rather than sent");
+    check(roundTrip(base, zeros, block, delta), "all zeros against a base");
+
+    string edited = base.substr(0, 3 * block + 17) + randomData(500) +
+                    base.substr(3 * block + 17);
+    check(roundTrip(base, edited, block, delta) &&
+          delta.size() < 2 * block + 500,
+          "insertion mid file, only the blocks around it sent");
+    check(roundTrip(base, base, block, delta) && delta.size() < 200,
+          "unchanged file");
+
+    // The FPSG path: the server signs its copy and offers a delta, the
+    // client fetches the signatures as packets and answers with the delta
+    size_t block_size = chooseDeltaBlockSize(base.size());
+    string signatures = makeSignatures(base, block_size);
+    string answer = "FPSG" + to_string(7) + " " +
+                    to_string(packetsNeeded(signatures.size())) + " " +
+                    to_string(block_size);
+    stringstream offer(answer.substr(4));
+    int offer_ID, num_sig_packets;
+    size_t offer_block_size;
+    offer >> offer_ID >> num_sig_packets >> offer_block_size;
+    string fetched;
+    for (int i = 0; i < num_sig_packets; i++)
+        fetched += signatures.substr(i * PACKET_SIZE, PACKET_SIZE);
+    check(offer_ID == 7 && offer_block_size == block_size &&
+          fetched == signatures, "FPSG offer and its signature packets");
+    delta = makeDelta(edited, fetched, offer_block_size);
+    string result;
+    check(applyDelta(base, delta, offer_block_size, result) &&
+          result == edited, "delta against fetched signatures");
+
+    // A signature cut short is not matched, and costs only its block
+    string cut = signatures.substr(0, signatures.size() - 3);
+    delta = makeDelta(base, cut, block_size);
+    check(applyDelta(base, delta, block_size, result) && result == base,
+          "truncated signatures");
+
+    // Damaged deltas are refused, or at least never pass for the file
+    delta = makeDelta(edited, signatures, block_size);
+    bool refused = true;
+    for (size_t len = 0; len < delta.size(); len++) {
+        if (applyDelta(base, delta.substr(0, len), block_size, result) &&
+            result == edited)
+            refused = false;
+    }
+    check(refused, "every truncation of a delta");
+    check(!applyDelta(base, "X", block_size, result), "unknown instruction");
+    check(!applyDelta(base, "C", block_size, result),
+          "copy instruction cut short");
+    string past_end = "C";
+    appendUint32(past_end, 10);
+    appendUint32(past_end, 1);
+    check(!applyDelta(base, past_end, block, result),
+          "copy of a block past the end of the base");
+    string long_literal = "L";
+    appendUint32(long_literal, 100);
+    long_literal += "short";
+    check(!applyDelta(base, long_literal, block_size, result),
+          "literal longer than the delta");
+
+    printf("%s\n", FAILURES == 0 ? "PASSED" : "FAILED");
+    return FAILURES == 0 ? 0 : 1;
+}
@@ -0,0 +1,226 @@
+/*
+ * File for testing the receive journal and the packet range lists that
+ * report what is missing: packets saved by one run must come back intact
+ * in the next, and a damaged journal or list must cost only what it
+ * damaged
+ */
+
+#include "journal.h"
+#include "protocol.h"
+#include "utils.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <set>
+#include <vector>
+#include <unistd.h>
+using namespace std;
+
+int FAILURES = 0;
+string DIR_NAME;
+// Where the third record's check starts in a .JRNL: past the header
+// (magic, version, packet count, encoding, hash) and two records, then
+// the record's packet number and length
+const long THIRD_CHECK = 4*4 + 20 + 2*16 + 2*4;
+
+void check(bool ok, const string &what)
+{
+    printf("%s: %s\n", ok ? "ok  " : "FAIL", what.c_str());
+    if (!ok)
+        FAILURES++;
+}
+
+string randomData(size_t len)
+{
+    string data(len, '\0');
+    for (size_t i = 0; i < len; i++)
+        data[i] = rand() % 256;
+    return data;
+}
+
+string fileHash(const string &data)
+{
+    unsigned char hash[SHA1_LEN];
+    computeChecksum((const unsigned char *)data.data(), data.size(), hash);
+    return string((const char *)hash, SHA1_LEN-1);
+}
+
+set<int> allPackets(int num_packets)
+{
+    set<int> packets;
+    for (int i = 0; i < num_packets; i++)
+        packets.insert(i);
+    return packets;
+}
+
+// Reassembly buffer and missing packets for a file, as the server starts
+void startFile(const FilePilot &pilot, string &file_data, set<int> &packets)
+{
+    file_data.assign((size_t)(pilot.num_packets-1) * PACKET_SIZE, '\0');
+    packets = allPackets(pilot.num_packets);
+}
+
+// Save some of a file's packets, as a run that then dies would
+void saveSome(const FilePilot &pilot, const string &contents,
+              const vector<int> &packet_nums)
+{
+    ReceiveJournal journal(DIR_NAME, pilot);
+    string file_data;
+    set<int> packets;
+    startFile(pilot, file_data, packets);
+    journal.recover(file_data, packets);
+    string data;
+    for (size_t i = 0; i < packet_nums.size(); i++)
+        data += contents.substr((size_t)packet_nums[i] * PACKET_SIZE,
+                                PACKET_SIZE);
+    journal.record(packet_nums, data);
+}
+
+// Recover what was saved, checking it against the file's contents
+int recoverSome(const FilePilot &pilot, const string &contents,
+                set<int> &packets, bool &intact)
+{
+    ReceiveJournal journal(DIR_NAME, pilot);
+    string file_data;
+    startFile(pilot, file_data, packets);
+    int recovered = journal.recover(file_data, packets);
+    intact = true;
+    for (int i = 0; i < pilot.num_packets; i++) {
+        if (packets.count(i) != 0)
+            continue;
+        size_t loc = (size_t)i * PACKET_SIZE;
+        if (file_data.compare(loc, PACKET_SIZE,
+                              contents.substr(loc, PACKET_SIZE)) != 0)
+            intact = false;
+    }
+    return recovered;
+}
+
+// Change one byte of a file in the test directory
+void damage(const string &fname, long offset)
+{
+    FILE *file = fopen(makeFileName(DIR_NAME, fname).c_str(), "r+b");
+    fseek(file, offset, SEEK_SET);
+    int byte = fgetc(file);
+    fseek(file, offset, SEEK_SET);
+    fputc(byte ^ 0xff, file);
+    fclose(file);
+}
+
+void testRangeLists()
+{
+    check(makeRangeList(set<int>(), 100).empty() &&
+          unpackRangeList("").empty(), "empty range list");
+    set<int> packets({0, 1, 2, 3, 7, 9, 10, 11, 500});
+    string list = makeRangeList(packets, 100);
+    check(list == "0-3 7 9-11 500" && unpackRangeList(list) == packets,
+          "range list round trip");
+    packets = allPackets(5000);
+    for (int i = 0; i < 5000; i += 3)
+        packets.erase(i);
+    list = makeRangeList(packets, 60);
+    set<int> covered = unpackRangeList(list);
+    set<int> lowest(packets.begin(), packets.upper_bound(*covered.rbegin()));
+    check(list.size() <= 60 && covered == lowest,
+          "range list cut to fit, lowest packets first");
+    check(unpackRangeList("3-").empty() && unpackRangeList("-3").empty() &&
+          unpackRangeList("7-2").empty() && unpackRangeList("x").empty() &&
+          unpackRangeList("4-5x").empty() &&
+          unpackRangeList("99999999999").empty(),
+          "garbled range list entries skipped");
+    check(unpackRangeList("1 junk 3-4") == set<int>({1, 3, 4}),
+          "good entries kept around garbled ones");
+}
+
+int main()
+{
+    srand(117);
+    char dir_template[] = "/tmp/journaltestXXXXXX";
+    if (mkdtemp(dir_template) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    DIR_NAME = dir_template;
+
+    testRangeLists();
+
+    // A file of 10 packets, the last a short one
+    string contents = randomData(9 * PACKET_SIZE + 100);
+    FilePilot pilot(10, 7, fileHash(contents), "file");
+    set<int> packets;
+    bool intact;
+    check(recoverSome(pilot, contents, packets, intact) == 0 &&
+          packets == allPackets(10), "nothing saved, nothing recovered");
+    check(recoverSome(pilot, contents, packets, intact) == 0,
+          "empty journal");
+
+    saveSome(pilot, contents, vector<int>({0, 2, 9}));
+    saveSome(pilot, contents, vector<int>({3}));
+    check(recoverSome(pilot, contents, packets, intact) == 4 && intact &&
+          packets == set<int>({1, 4, 5, 6, 7, 8}),
+          "saved packets recovered, the last short");
+
+    // The FPRS path: what is still missing goes back to the client
+    string fID = to_string(pilot.file_ID);
+    string answer = "FPRS" + fID + " ";
+    answer += makeRangeList(packets,
+                            511 - SESSION_TAG_LEN - answer.length());
+    check(unpackRangeList(answer.substr(answer.find(" ") + 1)) == packets,
+          "FPRS answer lists the missing packets");
+
+    // A record cut short by a crash costs only its packet
+    string journal_name = makeFileName(DIR_NAME, "file.JRNL");
+    FILE *journal = fopen(journal_name.c_str(), "r+b");
+    fseek(journal, 0, SEEK_END);
+    long journal_len = ftell(journal);
+    fclose(journal);
+    if (truncate(journal_name.c_str(), journal_len - 5) != 0)
+        perror("truncate");
+    check(recoverSome(pilot, contents, packets, intact) == 3 && intact &&
+          packets.count(3) == 1, "truncated journal");
+
+    // As does a packet damaged on disk, or a damaged record
+    damage("file.PART", 2 * PACKET_SIZE + 10);
+    check(recoverSome(pilot, contents, packets, intact) == 2 && intact &&
+          packets.count(2) == 1, "damaged packet data");
+    damage("file.JRNL", THIRD_CHECK);
+    check(recoverSome(pilot, contents, packets, intact) == 1 && intact &&
+          packets.count(9) == 1, "damaged journal record");
+
+    // A journal for another version of the file is thrown away
+    string changed = contents;
+    changed[0] ^= 0xff;
+    FilePilot other(10, 7, fileHash(changed), "file");
+    check(recoverSome(other, changed, packets, intact) == 0 &&
+          packets == allPackets(10), "journal of another version");
+    check(recoverSome(pilot, contents, packets, intact) == 0,
+          "old version's journal gone");
+
+    // One short packet, and a file of zeros
+    string tiny = randomData(100);
+    FilePilot tiny_pilot(1, 8, fileHash(tiny), "tiny");
+    saveSome(tiny_pilot, tiny, vector<int>({0}));
+    {
+        ReceiveJournal journal(DIR_NAME, tiny_pilot);
+        string file_data;
+        set<int> tiny_packets;
+        startFile(tiny_pilot, file_data, tiny_packets);
+        check(journal.recover(file_data, tiny_packets) == 1 &&
+              file_data == tiny && tiny_packets.empty(),
+              "file shorter than one packet");
+        journal.discard();
+    }
+    string zeros(4 * PACKET_SIZE, '\0');
+    FilePilot zero_pilot(4, 9, fileHash(zeros), "zeros");
+    saveSome(zero_pilot, zeros, vector<int>({0, 1, 2, 3}));
+    check(recoverSome(zero_pilot, zeros, packets, intact) == 4 && intact &&
+          packets.empty(), "all zeros");
+
+    ReceiveJournal(DIR_NAME, pilot).discard();
+    ReceiveJournal(DIR_NAME, other).discard();
+    ReceiveJournal(DIR_NAME, zero_pilot).discard();
+    check(rmdir(DIR_NAME.c_str()) == 0, "discard leaves nothing behind");
+
+    printf("%s\n", FAILURES == 0 ? "PASSED" : "FAILED");
+    return FAILURES == 0 ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+/*
+ * File for testing zero run lists: every list must rebuild the file it was
+ * made from, leaving out only runs of zeros long enough to be worth it,
+ * and a damaged one must be refused rather than misapplied
+ */
+
+#include "sparse.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+using namespace std;
+
+int FAILURES = 0;
+
+void check(bool ok, const string &what)
+{
+    printf("%s: %s\n", ok ? "ok  " : "FAIL", what.c_str());
+    if (!ok)
+        FAILURES++;
+}
+
+// Random data with no zero bytes, so only the runs we put in are zeros
+string nonzeroData(size_t len)
+{
+    string data(len, '\0');
+    for (size_t i = 0; i < len; i++)
+        data[i] = 1 + rand() % 255;
+    return data;
+}
+
+bool roundTrip(const string &data, string &list)
+{
+    list = makeZeroRunList(data);
+    string result;
+    return applyZeroRunList(list, result) && result == data;
+}
+
+int main()
+{
+    srand(117);
+    string list;
+
+    check(roundTrip("", list) && list.empty(), "empty file");
+    string zeros(1 << 20, '\0');
+    check(roundTrip(zeros, list) && list.size() < 16 &&
+          isAllZero(zeros.data(), zeros.size()), "all zeros");
+    string short_run = nonzeroData(100) + string(ZERO_RUN_MIN - 1, '\0') +
+                       nonzeroData(100);
+    check(roundTrip(short_run, list) && list.size() > short_run.size(),
+          "zero run too short to leave out");
+    string tiny(10, '\0');
+    check(roundTrip(tiny, list), "file of zeros shorter than a run");
+
+    string holes = string(5000, '\0') + nonzeroData(3000) +
+                   string(70000, '\0') + nonzeroData(10) + string(300, '\0');
+    check(roundTrip(holes, list) && list.size() < 3100 &&
+          !isAllZero(holes.data(), holes.size()),
+          "zeros at the start, middle and end left out");
+
+    // Word at a time checks must not miss a byte at either end
+    string word = string(64, '\0');
+    bool found_all = true;
+    for (size_t i = 0; i < word.size(); i++) {
+        word[i] = 1;
+        for (size_t len = i + 1; len <= word.size(); len++)
+            if (isAllZero(word.data(), len))
+                found_all = false;
+        if (!isAllZero(word.data(), i))
+            found_all = false;
+        word[i] = 0;
+    }
+    check(found_all, "a single nonzero byte, anywhere");
+
+    // Damaged lists are refused, or at least never pass for the file
+    list = makeZeroRunList(holes);
+    string result;
+    bool refused = true;
+    for (size_t len = 0; len < list.size(); len++) {
+        if (applyZeroRunList(list.substr(0, len), result) && result == holes)
+            refused = false;
+    }
+    check(refused, "every truncation of a list");
+    check(!applyZeroRunList(string("X\x01\x00\x00\x00", 5), result),
+          "unknown entry");
+    check(!applyZeroRunList(string("D\x10\x00\x00\x00" "abc", 8), result),
+          "data entry longer than the list");
+    check(!applyZeroRunList("Z\x10", result), "length cut short");
+
+    printf("%s\n", FAILURES == 0 ? "PASSED" : "FAILED");
+    return FAILURES == 0 ? 0 : 1;
+}
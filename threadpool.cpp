@@ -0,0 +1,174 @@
+/*
+ * threadpool.cpp: Implements a fixed-size pool of worker threads
+ * Written by: Dylan Hoffmann and Lucas Campbell
+ */
+
+#include "threadpool.h"
+
+using namespace std;
+
+// The pool the running thread works for, and its queue in that pool
+static thread_local ThreadPool *current_pool = NULL;
+static thread_local int current_queue = -1;
+
+ThreadPool::ThreadPool(int num_workers) :
+    pending(0), busy(0), next_queue(0), stopping(false)
+{
+    if (num_workers < 1)
+        num_workers = 1;
+    for (int i = 0; i < num_workers; i++)
+        queues.push_back(unique_ptr<Queue>(new Queue));
+    for (int i = 0; i < num_workers; i++)
+        workers.push_back(thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    wait();
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    task_ready.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+void ThreadPool::submit(function<void()> task)
+{
+    size_t q;
+    {
+        // Counted before it is queued, so it is never taken uncounted
+        lock_guard<mutex> guard(lock);
+        pending++;
+        if (current_pool == this)
+            q = current_queue;
+        else
+            q = next_queue++ % queues.size();
+    }
+    {
+        lock_guard<mutex> guard(queues[q]->lock);
+        queues[q]->tasks.push_back(task);
+    }
+    task_ready.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    unique_lock<mutex> guard(lock);
+    all_done.wait(guard, [this] { return pending == 0 && busy == 0; });
+}
+
+void ThreadPool::runTogether(const vector<function<void()>> &tasks)
+{
+    size_t left = tasks.size();
+    for (size_t i = 0; i < tasks.size(); i++) {
+        function<void()> task = tasks[i];
+        submit([this, task, &left] {
+            task();
+            lock_guard<mutex> guard(lock);
+            left--;
+            task_ready.notify_all();
+        });
+    }
+    int index = (current_pool == this) ? current_queue : -1;
+    while (true) {
+        function<void()> task;
+        if (takeTask(index, task)) {
+            runTask(task);
+            continue;
+        }
+        // Nothing to steal: our tasks are all running elsewhere
+        unique_lock<mutex> guard(lock);
+        if (left == 0)
+            return;
+        task_ready.wait(guard, [this, &left] {
+            return left == 0 || pending > 0;
+        });
+        if (left == 0)
+            return;
+    }
+}
+
+ThreadPool *ThreadPool::current()
+{
+    return current_pool;
+}
+
+/*
+ * takeTask
+ * Take the newest task off queue 'index', or failing that the oldest off
+ * any other queue. An index of -1 only steals.
+ *
+ * Returns: true if a task was taken, now counted as busy
+ */
+bool ThreadPool::takeTask(int index, function<void()> &task)
+{
+    int n = queues.size();
+    bool found = false;
+    if (index >= 0) {
+        Queue &own = *queues[index];
+        lock_guard<mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            found = true;
+        }
+    }
+    for (int i = 1; i <= n && !found; i++) {
+        Queue &victim = *queues[(index + i + n) % n];
+        lock_guard<mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            found = true;
+        }
+    }
+    if (found) {
+        lock_guard<mutex> guard(lock);
+        pending--;
+        busy++;
+    }
+    return found;
+}
+
+/*
+ * runTask
+ * Run a task taken with takeTask, and count it as done
+ */
+void ThreadPool::runTask(function<void()> &task)
+{
+    task();
+    lock_guard<mutex> guard(lock);
+    busy--;
+    if (busy == 0 && pending == 0)
+        all_done.notify_all();
+}
+
+/*
+ * workerLoop
+ * Run by every worker thread: run tasks from its own queue, or stolen from
+ * the others, until the pool is destroyed.
+ */
+void ThreadPool::workerLoop(int index)
+{
+    current_pool = this;
+    current_queue = index;
+    while (true) {
+        function<void()> task;
+        if (takeTask(index, task)) {
+            runTask(task);
+            continue;
+        }
+        unique_lock<mutex> guard(lock);
+        task_ready.wait(guard, [this] { return stopping || pending > 0; });
+        if (stopping && pending == 0)
+            return; // nothing left to run
+    }
+}
+
+int defaultWorkerCount()
+{
+    int n = thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
@@ -0,0 +1,108 @@
+/*
+ * threadpool.h: Interface for a fixed-size pool of worker threads, used to
+ *               spread per-file work (reads, votes, hashes) across cores
+ * Written By Dylan Hoffmann & Lucas Campbell
+ *
+ * Files in a directory range from a few bytes to gigabytes, so the work is
+ * far too lopsided to hand out up front. Each worker keeps its own queue,
+ * runs the newest task on it first, and when it runs dry steals the oldest
+ * task from another worker's. A big task can split itself with runTogether
+ * and the pieces go to whichever workers are idle.
+ */
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <functional>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/*
+ * ThreadPool
+ * A fixed number of worker threads, each with its own task queue, that
+ * steal from each other when idle.
+ * Constructor args:
+ * * int num_workers: number of worker threads to start. Values less than 1
+ *                    are treated as 1.
+ * Additional info: the destructor waits for all queued tasks to finish
+ * before joining the workers.
+ */
+class ThreadPool {
+public:
+    ThreadPool(int num_workers);
+    ~ThreadPool();
+
+    /*
+     * submit
+     * Queue a task to be run by a worker. Tasks submitted by a worker go on
+     * its own queue, others are spread across the workers' queues.
+     * Args:
+     * * task: callable to run. Must not throw.
+     *
+     * Returns: None
+     */
+    void submit(std::function<void()> task);
+
+    /*
+     * wait
+     * Block until every task submitted so far has finished running. Not to
+     * be called by a worker.
+     *
+     * Returns: None
+     */
+    void wait();
+
+    /*
+     * runTogether
+     * Run tasks on the pool and return once all of them are done. The
+     * calling thread runs queued tasks too while it waits, so a task may
+     * split itself up this way without tying up its worker.
+     * Args:
+     * * tasks: callables to run. Must not throw.
+     *
+     * Returns: None
+     */
+    void runTogether(const std::vector<std::function<void()>> &tasks);
+
+    /*
+     * current
+     * Returns: the pool the calling thread is a worker of, or NULL
+     */
+    static ThreadPool *current();
+
+private:
+    struct Queue {
+        std::deque<std::function<void()>> tasks;
+        std::mutex lock;
+    };
+
+    void workerLoop(int index);
+    bool takeTask(int index, std::function<void()> &task);
+    void runTask(std::function<void()> &task);
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Queue>> queues;   // one per worker
+    std::mutex lock;       // guards the counts below
+    std::condition_variable task_ready;
+    std::condition_variable all_done;
+    int pending;     // number of tasks queued and not yet taken
+    int busy;        // number of tasks currently being run
+    size_t next_queue;     // where the next outside submit goes
+    bool stopping;
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+};
+
+/*
+ * defaultWorkerCount
+ * Number of workers to use when none is given on the command line
+ *
+ * Returns: the number of hardware threads on this host, or 1 if unknown
+ */
+int defaultWorkerCount();
+
+#endif
@@ -4,6 +4,8 @@
  */
 
 #include "utils.h"
+#include "threadpool.h"
+#include "hashcache.h"
 #include "c150nastyfile.h"        // for c150nastyfile & framework
 #include "c150grading.h"
 #include <string>
@@ -19,9 +21,21 @@
 #include <cerrno>
 #include <iostream>
 #include <fstream>                // for input files 
+#include <vector>
+#include <mutex>
+#include <functional>
+#include <algorithm>
 
 int FILE_NASTINESS;
 int NETWORK_NASTINESS;
+std::recursive_mutex GRADING_LOCK;
+
+// Files this big have the copies trustedFileRead votes on read in parallel
+const size_t PARALLEL_READ_MIN = 1 << 20;
+// Files smaller than this are hashed in batches of about this many bytes,
+// so that a directory of tiny files is not all task overhead
+const size_t HASH_BATCH_BYTES = 256 << 10;
+const size_t HASH_BATCH_FILES = 64;
 
 
 using namespace std;
@@ -46,6 +60,28 @@ void computeChecksum(const unsigned char *data, size_t size,
     hash[SHA1_LEN-1] = '\0';
 }
 
+ChecksumContext::ChecksumContext()
+{
+    ctx = EVP_MD_CTX_create();
+    EVP_DigestInit_ex(ctx, EVP_sha1(), NULL);
+}
+
+ChecksumContext::~ChecksumContext()
+{
+    EVP_MD_CTX_destroy(ctx);
+}
+
+void ChecksumContext::update(const unsigned char *data, size_t size)
+{
+    EVP_DigestUpdate(ctx, data, size);
+}
+
+void ChecksumContext::final(unsigned char (&hash)[SHA1_LEN])
+{
+    EVP_DigestFinal_ex(ctx, hash, NULL);
+    hash[SHA1_LEN-1] = '\0';
+}
+
 /*
  * cmpChecksums
  * Compares two hashes and returns true if they are equal. Returns false
@@ -86,101 +122,76 @@ char *trustedFileRead(string dirname, string file_name, size_t &size)
 
     bool found_match = false;
     int correct_index;
-    int copies = 6;
+    const int copies = 6;
     char *file_buffs[copies];
+    size_t sizes[copies];
     int num_tries = 0;
+    // Rounds in a row in which a read failed outright
+    int failed = 0;
     while (!found_match) {
-        if (num_tries > 0)
+        if (num_tries > 0) {
+            lock_guard<recursive_mutex> guard(GRADING_LOCK);
             *GRADING << "File: " << full_path << " re-trying trustedFileRead, "
                      << "attempt #" << num_tries+1 << endl;
+        }
+        if (failed > copies+1) {
+            lock_guard<recursive_mutex> guard(GRADING_LOCK);
+            *GRADING << "Read of  " << file_name << " failed too many "
+                    << "times, exiting\n";
+            exit(-1);
+        }
 
         string hashes[copies];
-        // File read/write/stat errors
-        int failed = 0;
         //keep a count of duplicate hashes
         map<string, int> counts;
         
-        // Read file repeatedly/check to see if we got the same thing each time
-        for (int i = 0; i < copies; i++) {
-            if (failed > copies+1) {
-                *GRADING << "Read of  " << file_name << " failed too many "
-                        << "times, exiting\n";
-                exit(-1);
-            }
-            //  Misc variables, mostly for return codes
-            void *fopenretval;
-            string errorString;
-            char *buffer;
-            unsigned char hash[SHA1_LEN];
-            struct stat statbuf;  
-            size_t src_size;
-
-            // Read whole input file 
-            if (lstat(full_path.c_str(), &statbuf) != 0) {
-                fprintf(stderr,"trustedFileRead: error stating supplied source"
-                        "file %s\n", full_path.c_str());
-                failed++;
-                break;
-            }
-            // Make an input buffer large enough for
-            // the whole file
-            src_size = statbuf.st_size;
-            buffer = (char *)malloc(src_size);
-            file_buffs[i] = buffer;
-
-            NASTYFILE inputFile(FILE_NASTINESS);
-
-            // do an fopen on the input file
-            fopenretval = inputFile.fopen(full_path.c_str(), "rb");  
-          
-            if (fopenretval == NULL) {
-                cerr << "Error opening input file " << full_path << 
-                      " errno=" << strerror(errno) << endl;
-                failed++;
-                for (int j = i; j >=0; j--)
-                    free(file_buffs[j]);
-                break;
-            }
-            // Read the whole file
-            size = inputFile.fread(buffer, 1, src_size);
-            if (size != src_size) {
-                cerr << "Error reading file " << full_path << 
-                      "  errno=" << strerror(errno) << endl;
-                failed++;
-                for (int j = i; j >=0; j--)
-                    free(file_buffs[j]);
-                break;
-            }
-            // Close the file
-            if (inputFile.fclose() != 0 ) {
-                cerr << "Error closing input file " << full_path << 
-                      " errno=" << strerror(errno) << endl;
-                failed++;
-                for (int j = i; j >=0; j--)
-                    free(file_buffs[j]);
-                break;
+        // Read file repeatedly/check to see if we got the same thing each
+        // time. The reads of a big file are split across the pool we are
+        // running on, if any.
+        auto readCopy = [&](int i) {
+            file_buffs[i] = singleFileRead(dirname, file_name, sizes[i]);
+            if (file_buffs[i] != NULL) {
+                unsigned char hash[SHA1_LEN];
+                computeChecksum((const unsigned char *)file_buffs[i],
+                                sizes[i], hash);
+                hashes[i] = string((const char *)hash, SHA1_LEN-1);
             }
-
-            // Store the hash of the read file
-            computeChecksum((const unsigned char *)buffer, size, hash);
-            hashes[i] = string((const char *)hash, SHA1_LEN-1);
-            auto occurs = counts.find(hashes[i]);
-            // Increment count of that checksum
-            if (occurs == counts.end()){
-                counts[(hashes[i])] = 1;
-            }
-            else (occurs->second)++;
-            //reset, because we succeeded once
-            failed = 0;
+        };
+        struct stat statbuf;
+        ThreadPool *pool = ThreadPool::current();
+        if (pool != NULL && lstat(full_path.c_str(), &statbuf) == 0 &&
+            (size_t)statbuf.st_size >= PARALLEL_READ_MIN) {
+            vector<function<void()>> reads;
+            for (int i = 0; i < copies; i++)
+                reads.push_back([&readCopy, i] { readCopy(i); });
+            pool->runTogether(reads);
         }
-        // check to see if enough checksums match
+        else {
+            for (int i = 0; i < copies; i++)
+                readCopy(i);
+        }
+        bool read_all = true;
         for (int i = 0; i < copies; i++) {
+            if (file_buffs[i] == NULL)
+                read_all = false;
+            else
+                counts[hashes[i]]++;
+        }
+        failed = read_all ? 0 : failed + 1;
+
+        // check to see if enough checksums match
+        for (int i = 0; i < copies && read_all; i++) {
             if (counts[(hashes[i])] == copies){
                 found_match = true;
                 correct_index = i;
                 break;
             }
         }
+        if (!found_match) {
+            for (int i = 0; i < copies; i++)
+                free(file_buffs[i]);
+            num_tries++;
+        }
     }
 
     //clean up duplicate copies
@@ -189,11 +200,100 @@ char *trustedFileRead(string dirname, string file_name, size_t &size)
             free(file_buffs[i]);
     }
 
-    *GRADING << "Successfully read " << full_path << endl;
+    {
+        lock_guard<recursive_mutex> guard(GRADING_LOCK);
+        *GRADING << "Successfully read " << full_path << endl;
+    }
 
+    size = sizes[correct_index];
     return file_buffs[correct_index];
 }
 
+/*
+ * singleFileRead
+ * Reads a desired file once, with no voting. Used where the contents will be
+ * checked against a hash we already know.
+ * Args:
+ * * dirname: name of the directory of the file
+ * * file_name: name of the file to be read
+ * * size: pass-by-reference size_t that will be filled with the number of
+ *         bytes read from the file
+ *
+ * Returns: pointer to a malloc'd array of bytes that contains the contents of
+ *          the desired file, or NULL if the file could not be read.
+ */
+char *singleFileRead(string dirname, string file_name, size_t &size)
+{
+    string full_path = makeFileName(dirname, file_name);
+    //  Misc variables, mostly for return codes
+    void *fopenretval;
+    char *buffer;
+    struct stat statbuf;  
+    size_t src_size;
+
+    // Read whole input file 
+    if (lstat(full_path.c_str(), &statbuf) != 0) {
+        fprintf(stderr,"singleFileRead: error stating supplied source"
+                "file %s\n", full_path.c_str());
+        return NULL;
+    }
+    // Make an input buffer large enough for
+    // the whole file
+    src_size = statbuf.st_size;
+    buffer = (char *)malloc(src_size);
+
+    NASTYFILE inputFile(FILE_NASTINESS);
+
+    // do an fopen on the input file
+    fopenretval = inputFile.fopen(full_path.c_str(), "rb");  
+  
+    if (fopenretval == NULL) {
+        cerr << "Error opening input file " << full_path << 
+              " errno=" << strerror(errno) << endl;
+        free(buffer);
+        return NULL;
+    }
+    // Read the whole file
+    size = inputFile.fread(buffer, 1, src_size);
+    if (size != src_size) {
+        cerr << "Error reading file " << full_path << 
+              "  errno=" << strerror(errno) << endl;
+        inputFile.fclose();
+        free(buffer);
+        return NULL;
+    }
+    // Close the file
+    if (inputFile.fclose() != 0 ) {
+        cerr << "Error closing input file " << full_path << 
+              " errno=" << strerror(errno) << endl;
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+/*
+ * readFileChecksum
+ * Reads a file once and computes the SHA1 checksum of what was read
+ * Args:
+ * * dirname: the name of a directory that exists
+ * * file_name: the name of a file in that directory
+ * * size: pass-by-reference size_t, filled with the number of bytes read
+ * * hash: pass-by-reference array filled with the hash of the bytes read
+ *
+ * Returns: false if the file could not be read, true otherwise
+ */
+bool readFileChecksum(string dirname, string file_name, size_t &size,
+                      unsigned char (&hash)[SHA1_LEN])
+{
+    char *file_data = singleFileRead(dirname, file_name, size);
+    if (file_data == NULL)
+        return false;
+    computeChecksum((const unsigned char *)file_data, size, hash);
+    free(file_data);
+    return true;
+}
+
 /*
  * getFileChecksum
  * computes SHA1 checksum of a given filename and stores it in a given unsigned
@@ -219,6 +319,34 @@ char *getFileChecksum(string dirname, string file_name, size_t &size,
     return file_data;
 }
 
+/*
+ * getKnownFileChecksum
+ * Like getFileChecksum, for a file whose checksum we already expect. The file
+ * is read once; if that copy hashes to 'expected' it is returned as is,
+ * otherwise we fall back to a full trustedFileRead.
+ * Args:
+ * * dirname: the name of a directory that exists
+ * * file_name: the name of a file that exists in that directory
+ * * expected: the 20 byte SHA1 we believe the file has
+ * * size: pass-by-reference size_t, filled with the number of bytes returned
+ * * hash: pass-by-reference array filled with the hash of the returned data
+ *
+ * Returns: A pointer to a block of malloc'd memory that is 'size' bytes long
+ *          and contains the contents of the desired file
+ */
+char *getKnownFileChecksum(string dirname, string file_name, string expected,
+                           size_t &size, unsigned char (&hash)[SHA1_LEN])
+{
+    char *file_data = singleFileRead(dirname, file_name, size);
+    if (file_data != NULL) {
+        computeChecksum((const unsigned char *)file_data, size, hash);
+        if (string((const char *)hash, SHA1_LEN-1) == expected)
+            return file_data;
+        free(file_data);
+    }
+    return getFileChecksum(dirname, file_name, size, hash);
+}
+
 
 // ------------------------------------------------------
 //
@@ -294,19 +422,44 @@ string makeFileName(string dir, string name)
 
 /*
  * fillChecksumTable
- * Flls a directory checksum table mapping file names to SHA1 hashs
+ * Flls a directory checksum table mapping file names to SHA1 hashs. Files are
+ * read, voted on and hashed concurrently by a pool of worker threads.
  * Args:
  * * map<string, string> &filehash: An empty map to be filled with
  *                                  {filename, checksum} pairs
  * * DIR* SRC: Pointer to the source dir
  * * const char* sourceDir: name of the source directory
+ * * int num_workers: number of threads to hash files with
+ * * ChecksumCache *cache: consulted before reading each file and updated
+ *                         with every hash computed. May be NULL.
+ *
+ * Return: None
+ */
+void fillChecksumTable(map<string, string> &filehash,
+                        DIR *SRC, const char* sourceDir, int num_workers,
+                        ChecksumCache *cache)
+{
+    ThreadPool pool(num_workers);
+    fillChecksumTable(filehash, SRC, sourceDir, pool, cache);
+}
+
+/*
+ * fillChecksumTable
+ * As above, on a pool the caller keeps
+ * Args:
+ * * pool: the pool to hash files on, waited on before returning
+ * * (the rest as above)
  *
  * Return: None
  */
 void fillChecksumTable(map<string, string> &filehash,
-                        DIR *SRC, const char* sourceDir)
+                        DIR *SRC, const char* sourceDir, ThreadPool &pool,
+                        ChecksumCache *cache)
 {
     struct dirent *sourceFile;  // Directory entry for source file
+    // {size, name} of the regular files, and the stat of each we could
+    vector<pair<size_t, string>> files;
+    map<string, struct stat> stats;
     while ((sourceFile = readdir(SRC)) != NULL) {
 
             if ( (strcmp(sourceFile->d_name, ".") == 0) ||
@@ -314,21 +467,63 @@ void fillChecksumTable(map<string, string> &filehash,
                 continue;          // never copy . or ..
 
             string full_filename = makeFileName(sourceDir, sourceFile->d_name);
-            string filename = sourceFile->d_name;
 
             // check that is a regular file
             if (!isFile(full_filename))
                  continue;                     
+            struct stat statbuf;
+            size_t size = 0;
+            if (lstat(full_filename.c_str(), &statbuf) == 0) {
+                stats[sourceFile->d_name] = statbuf;
+                size = statbuf.st_size;
+            }
+            files.push_back(make_pair(size, sourceFile->d_name));
+    }
+    // Biggest first, so the last file to finish is a small one
+    sort(files.rbegin(), files.rend());
+
+    // Hash every file on the pool, merging results into the table as
+    // each one finishes
+    mutex filehash_lock;
+    auto hashFile = [&filehash, &filehash_lock, &stats, sourceDir, cache]
+                    (const string &filename) {
+        // Unchanged files keep the hash they were verified to have
+        string hash_str;
+        auto found = stats.find(filename);
+        bool have_stat = (found != stats.end());
+        if (cache == NULL || !have_stat ||
+            !cache->lookup(found->second, hash_str)) {
             // add {filename, checksum} to the table
             unsigned char hash[SHA1_LEN];
             size_t size; //throwaway
             char * to_free = 
                 getFileChecksum(string(sourceDir), filename, size, hash);
             free(to_free); //malloc'd data
-            
-            string hash_str = string((const char*)hash, SHA1_LEN-1);
-            filehash[filename] = hash_str;
+
+            hash_str = string((const char*)hash, SHA1_LEN-1);
+            if (cache != NULL && have_stat)
+                cache->store(found->second, hash_str);
+        }
+        lock_guard<mutex> guard(filehash_lock);
+        filehash[filename] = hash_str;
+    };
+    size_t i = 0;
+    while (i < files.size()) {
+        // A big file is a task of its own, small ones go in batches
+        vector<string> batch;
+        size_t batch_bytes = 0;
+        do {
+            batch.push_back(files[i].second);
+            batch_bytes += files[i].first;
+            i++;
+        } while (i < files.size() && batch_bytes < HASH_BATCH_BYTES &&
+                 batch.size() < HASH_BATCH_FILES);
+        pool.submit([hashFile, batch] {
+            for (size_t f = 0; f < batch.size(); f++)
+                hashFile(batch[f]);
+        });
     }
+    pool.wait();
 }
 
 /*
@@ -350,25 +545,31 @@ void printHash(const unsigned char *hash)
 /*
  * getDirHash
  * Given a map of {filename, checksum} pairs, create and return an overall SHA1
- * hash based upon the filenames and checksums together.
+ * hash based upon the filenames and checksums together. Entries are fed to
+ * the hash one at a time in sorted filename order, so the result is the hash
+ * of every name and checksum concatenated without that string ever being
+ * built. The whole map is still needed: entries arrive in whatever order
+ * files finish, and a SHA1 stream cannot take one in ahead of those it
+ * already holds, so the hash is not kept up as files complete.
  *
  * Args:
  * * filehash: the hashmap of filename:SHA1hash pairs
  *
  * Return: string which is the directory hash
  */ 
-string getDirHash(map<string, string> filehash)
+string getDirHash(const map<string, string> &filehash)
 {
-
-    string to_hash("");
+    ChecksumContext dir_hash;
     for (auto iter = filehash.begin(); iter != filehash.end(); iter++)
     {
-        to_hash += iter->first + iter->second;
+        dir_hash.update((const unsigned char *)iter->first.data(),
+                        iter->first.size());
+        dir_hash.update((const unsigned char *)iter->second.data(),
+                        iter->second.size());
     }
     
     unsigned char hash[SHA1_LEN];
-    computeChecksum((const unsigned char *)to_hash.c_str(), to_hash.size(),
-                    hash);
+    dir_hash.final(hash);
 
     return string((const char *)hash, SHA1_LEN-1);
 }
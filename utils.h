@@ -1,11 +1,45 @@
 #include <string>
 #include <map> 
+#include <mutex>
 #include <dirent.h>
+#include <openssl/evp.h>
+
+class ChecksumCache;
+class ThreadPool;
 #ifndef SHA1_H
 #define SHA1_H
 
 const int SHA1_LEN = 21;
 
+// Serializes writes to the GRADING log from worker threads. Recursive, so
+// a thread holding it for a run of work may call code that takes it too.
+extern std::recursive_mutex GRADING_LOCK;
+
+/*
+ * Unlocked
+ * Lets go of a lock the caller holds, once, for as long as it exists, so
+ * other threads can take it while the caller waits on them
+ * Constructor args:
+ * * lock: the lock, or NULL for none
+ */
+class Unlocked {
+public:
+    Unlocked(std::recursive_mutex *lock) : lock(lock)
+    {
+        if (lock != NULL)
+            lock->unlock();
+    }
+    ~Unlocked()
+    {
+        if (lock != NULL)
+            lock->lock();
+    }
+private:
+    std::recursive_mutex *lock;
+    Unlocked(const Unlocked &) = delete;
+    Unlocked &operator=(const Unlocked &) = delete;
+};
+
 /*
  * computeChecksum
  * computes SHA1 checksum of the given buffer
@@ -21,6 +55,34 @@ const int SHA1_LEN = 21;
 void computeChecksum(const unsigned char *data, size_t size,
                      unsigned char (&hash)[SHA1_LEN]);
 
+/*
+ * ChecksumContext
+ * Incremental SHA1 computation, for data that becomes available a piece at a
+ * time. Feeding a buffer through update() in any number of pieces yields the
+ * same hash as computeChecksum() on the whole buffer.
+ */
+class ChecksumContext {
+public:
+    ChecksumContext();
+    ~ChecksumContext();
+    /*
+     * update
+     * Add the next 'size' bytes of data to the running hash
+     */
+    void update(const unsigned char *data, size_t size);
+    /*
+     * final
+     * Fill 'hash' with the SHA1 of everything passed to update(), null
+     * terminated like computeChecksum(). The context may not be updated
+     * afterwards.
+     */
+    void final(unsigned char (&hash)[SHA1_LEN]);
+private:
+    EVP_MD_CTX *ctx;
+    ChecksumContext(const ChecksumContext &) = delete;
+    ChecksumContext &operator=(const ChecksumContext &) = delete;
+};
+
 /*
  * cmpChecksums
  * Compares two hashes and returns true if they are equal. Returns false
@@ -48,6 +110,35 @@ bool cmpChecksums(unsigned char hash1[SHA1_LEN], unsigned char hash2[SHA1_LEN]);
  */
 char *trustedFileRead(std::string source_dir, std::string file_name, size_t &size);
 
+/*
+ * singleFileRead
+ * Reads a desired file once, with no voting. Used where the contents will be
+ * checked against a hash we already know.
+ * Args:
+ * * dirname: name of the directory of the file
+ * * file_name: name of the file to be read
+ * * size: pass-by-reference size_t that will be filled with the number of
+ *         bytes read from the file
+ *
+ * Returns: pointer to a malloc'd array of bytes that contains the contents of
+ *          the desired file, or NULL if the file could not be read.
+ */
+char *singleFileRead(std::string dirname, std::string file_name, size_t &size);
+
+/*
+ * readFileChecksum
+ * Reads a file once and computes the SHA1 checksum of what was read
+ * Args:
+ * * dirname: the name of a directory that exists
+ * * file_name: the name of a file in that directory
+ * * size: pass-by-reference size_t, filled with the number of bytes read
+ * * hash: pass-by-reference array filled with the hash of the bytes read
+ *
+ * Returns: false if the file could not be read, true otherwise
+ */
+bool readFileChecksum(std::string dirname, std::string file_name,
+                      size_t &size, unsigned char (&hash)[SHA1_LEN]);
+
 /*
  * getFileChecksum
  * computes SHA1 checksum of a given filename and stores it in a given unsigned
@@ -68,6 +159,25 @@ char *trustedFileRead(std::string source_dir, std::string file_name, size_t &siz
 char *getFileChecksum(std::string source_name, std::string file_name,
                       size_t &size, unsigned char (&hash)[SHA1_LEN]);
 
+/*
+ * getKnownFileChecksum
+ * Like getFileChecksum, for a file whose checksum we already expect. The file
+ * is read once; if that copy hashes to 'expected' it is returned as is,
+ * otherwise we fall back to a full trustedFileRead.
+ * Args:
+ * * dirname: the name of a directory that exists
+ * * file_name: the name of a file that exists in that directory
+ * * expected: the 20 byte SHA1 we believe the file has
+ * * size: pass-by-reference size_t, filled with the number of bytes returned
+ * * hash: pass-by-reference array filled with the hash of the returned data
+ *
+ * Returns: A pointer to a block of malloc'd memory that is 'size' bytes long
+ *          and contains the contents of the desired file
+ */
+char *getKnownFileChecksum(std::string dirname, std::string file_name,
+                           std::string expected, size_t &size,
+                           unsigned char (&hash)[SHA1_LEN]);
+
 /*
  * checkDirectory
  * Makes sure directory eists
@@ -101,25 +211,41 @@ std::string makeFileName(std::string dir, std::string name);
 
 /*
  * fillChecksumTable
- * Flls a directory checksum table mapping file names to SHA1 hashs
+ * Flls a directory checksum table mapping file names to SHA1 hashs, hashing
+ * files concurrently on a pool of num_workers threads of its own
  * Args:
  * * map<string, string> &filehash: PBR An empty map\
  * * DIR* SRC: Pointer to the source dir
  * * const char* sourceDir: name of the source directory
+ * * int num_workers: number of threads used to read and hash files
+ * * ChecksumCache *cache: hashes of unchanged files are taken from here and
+ *                         new ones recorded in it. May be NULL.
  *
  * Return: None the map is pass-by-reference 
  */
 void fillChecksumTable(std::map<std::string, std::string> &filehash,
-                       DIR *SRC, const char* sourceDir);
+                       DIR *SRC, const char* sourceDir, int num_workers,
+                       ChecksumCache *cache);
+
+/*
+ * fillChecksumTable
+ * As above, hashing files on a pool the caller keeps for other work too.
+ * Returns once the pool has nothing left to run, so nothing else should be
+ * queued on it meanwhile.
+ */
+void fillChecksumTable(std::map<std::string, std::string> &filehash,
+                       DIR *SRC, const char* sourceDir, ThreadPool &pool,
+                       ChecksumCache *cache);
 /*
  * getDirHash
- * Computes the SHA1 hash of the entire directory
+ * Computes the SHA1 hash of the entire directory, streaming each sorted
+ * {filename, hash} entry through the hash rather than concatenating them
  * Args:
  * * map<string, string> filehash: A map mapping all dir files to SHA1 hashs
  *
  * Return string directory hash
  */
-std::string getDirHash(std::map<std::string, std::string> filehash);
+std::string getDirHash(const std::map<std::string, std::string> &filehash);
 
 /*
  * printHash